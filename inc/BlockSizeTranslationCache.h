@@ -84,7 +84,7 @@ class BlockSizeTranslationCache : public Cache {
     ~BlockSizeTranslationCache();
 
     virtual bool writeBlock(Request* req);
-    virtual void readBlock(Request* req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request*>>> &reads, uint64_t priority);
+    virtual void readBlock(Request* req, uint64_t priority);
 
 
     static Cache *addNewBlockSizeTranslationCache(std::string cacheName, uint64_t blockSize1, uint64_t blockSize2);
@@ -75,10 +75,13 @@
 #ifndef BOUNDEDCACHE_H
 #define BOUNDEDCACHE_H
 #include "Cache.h"
+#include "EvictionPolicy.h"
+#include "FrequencySketch.h"
 #include "Loggable.h"
 #include "ReaderWriterLock.h"
 #include "Trackable.h"
 #include "UnixIO.h"
+#include <atomic>
 #include <future>
 #include <memory>
 
@@ -88,17 +91,23 @@
 #define BLK_WR 3
 #define BLK_AVAIL 4
 
-const uint64_t MAX_CACHE_NAME_LEN = 30;
+#define INDEX_ALIGN 64 //cache line, index entries and bin keys are laid out from a multiple of it
+#define SHM_LAYOUT_VERSION 2 //part of shared index segment names, bump whenever their layout changes so older segments are not reused
+
+const uint32_t MAX_HASHED_FILES = 4096; //file indices below this get their bin hash from a lock free table
 
 struct dummy {};
 template <class Lock>
 class BoundedCache : public Cache {
   public:
-    BoundedCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity);
+    BoundedCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity, unsigned int evictionPolicy = LRU_EVICTION);
     virtual ~BoundedCache();
 
     virtual bool writeBlock(Request *req);
-    virtual void readBlock(Request *req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority);
+    virtual void readBlock(Request *req, uint64_t priority);
+    virtual void finishRequest(Request *req, int64_t blockIndex);
+    virtual bool lookupBlock(Request *req);
+    virtual void shareBlock(Request *req);
 
     virtual bool blockReserve(uint32_t index, uint32_t fileIndex, bool &found, int &reservedIndex, bool prefetch = false);
     virtual void addFile(uint32_t index, std::string filename, uint64_t blockSize, std::uint64_t fileSize);
@@ -107,29 +116,32 @@ class BoundedCache : public Cache {
     virtual void cleanReservation();
 
   protected:
+    //Kept small so a tier's entry plus its counters fits a cache line (the bin's keys are probed separately)
     struct BlockEntry {
         uint32_t fileIndex;
         uint32_t blockIndex;
-        uint32_t timeStamp;
-        uint32_t status;
-        uint32_t prefetched;
-        char origCache[32];
+        uint64_t timeStamp; //full nanoseconds, a truncated clock wraps every few seconds and scrambles LRU order
+        EvictionEntry eviction;
+        uint8_t status;
+        uint8_t prefetched;
+        uint8_t origin; //Cache::tier() of the cache the block came from
         // std::atomic<uint32_t> activeCnt;
     };
 
     // virtual int getBlockIndex(uint32_t index, uint32_t fileIndex);
     virtual int getBlockIndex(uint32_t index, uint32_t fileIndex, BlockEntry *entry = NULL);
-    virtual int oldestBlockIndex(uint32_t index, uint32_t fileIndex, bool &found);
+    virtual int oldestBlockIndex(uint32_t index, uint32_t fileIndex, bool &found, bool prefetch = false);
     virtual uint32_t getBinIndex(uint32_t index, uint32_t fileIndex);
     virtual uint32_t getBinOffset(uint32_t index, uint32_t fileIndex);
 
-    //TODO: eventually when we create a flag for stat keeping we probably dont need to store the cacheName...
-    virtual void blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t byte, int32_t prefetch, std::string cacheName = "") = 0;
+    //TODO: eventually when we create a flag for stat keeping we probably dont need to store the origin...
+    virtual void blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t byte, int32_t prefetch, uint8_t origin) = 0;
 
-    virtual bool blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs = false, uint32_t cnt = 0, char *origCache = NULL) = 0;
+    virtual bool blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs = false, uint32_t cnt = 0, uint8_t *origin = NULL) = 0;
     // virtual char *blockMiss(uint32_t index, uint64_t &size, uint32_t fileIndex, std::unordered_map<uint64_t,std::future<std::future<Request*>>> &reads);
     virtual uint8_t *getBlockData(uint32_t blockIndex) = 0;
     virtual void setBlockData(uint8_t *data, uint32_t blockIndex, uint64_t size) = 0;
+    virtual uint8_t *readBlockData(uint32_t blockIndex, Request *req); //tiers that copy anyway can land the block in req->dest
     virtual void readBlockEntry(uint32_t blockIndex, BlockEntry *entry) = 0;
     virtual void writeBlockEntry(uint32_t blockIndex, BlockEntry *entry) = 0;
     virtual void readBin(uint32_t binIndex, BlockEntry *entries) = 0;
@@ -138,12 +150,27 @@ class BoundedCache : public Cache {
     virtual int decBlkCnt(uint32_t blk) = 0;
     virtual bool anyUsers(uint32_t blk) = 0;
 
+    //Lets readers sleep (futex) until a slot's block is published, kept next to the slot so it works across processes
+    struct BlockWaitWord {
+        std::atomic<uint32_t> seq; //bumped every time the slot becomes available
+        std::atomic<uint32_t> waiters;
+    };
+    virtual BlockWaitWord *blockWaitWord(uint32_t blk); //NULL when the tier can't be waited on, readers then poll
+    void publishBlock(uint32_t blk);
+    void waitForBlock(BlockWaitWord *word, uint32_t seq, double timeout);
+
     virtual void getCompareBlkEntry(uint32_t index, uint32_t fileIndex, BlockEntry *entry);
 
     virtual std::shared_ptr<BlockEntry> getCompareBlkEntry(uint32_t index, uint32_t fileIndex);
 
     virtual bool sameBlk(BlockEntry *blk1, BlockEntry *blk2);
 
+    //Packed (fileIndex + 1, blockIndex + 1) of every slot, lets a bin be probed in place instead of copied out
+    static uint64_t blockKey(uint32_t index, uint32_t fileIndex) { return ((uint64_t)(fileIndex + 1) << 32) | (index + 1); }
+    void setBlockKey(uint32_t blk, uint32_t fileIndex, uint32_t blockIndex); //fileIndex/blockIndex as stored in the entry (+1)
+    int probeBin(uint32_t binIndex, uint64_t key, uint32_t start);
+    uint64_t fileHash(uint32_t fileIndex);
+
     uint64_t _cacheSize;
     uint64_t _blockSize;
     uint32_t _associativity;
@@ -154,12 +181,18 @@ class BoundedCache : public Cache {
     std::atomic_uint _outstanding;
 
     std::unordered_map<uint64_t, uint64_t> _blkMap;
+    uint64_t *_blkKeys; //_numBlocks keys owned by the tier, NULL if its index can't be read in place
+    std::atomic<uint64_t> _fileHashes[MAX_HASHED_FILES];
 
     // T *_lock;
     Lock *_binLock;
     ReaderWriterLock *_localLock;
+    EvictionPolicy *_policy;
+    FrequencySketch *_sketch; //admission filter set up by the tier (it decides where the counts live), NULL admits everything
 
   private:
+    int admitBlock(std::vector<EvictionSlot> &slots, std::vector<std::shared_ptr<BlockEntry>> &entries, uint32_t slot, uint32_t binOffset, BlockEntry *incoming);
+    void writeBackSlots(std::vector<EvictionSlot> &slots, std::vector<std::shared_ptr<BlockEntry>> &entries, uint32_t binOffset);
     void trackBlock(std::string cacheName, std::string action, uint32_t fileIndex, uint32_t blockIndex, uint64_t priority);
 };
 
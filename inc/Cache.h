@@ -76,7 +76,7 @@
 #define CACHE_H
 #include "CacheStats.h"
 #include "Loggable.h"
-#include "PriorityThreadPool.h"
+#include "WorkStealingThreadPool.h"
 #include "ReaderWriterLock.h"
 #include "Request.h"
 #include "ThreadPool.h"
@@ -88,6 +88,8 @@
 #include <unordered_set>
 
 #define BASECACHENAME "base"
+#define MAX_PREFETCH_FILES 4096 //Files with a larger register index keep the configured prefetch depth
+#define MAX_PREFETCH_STREAMS 8   //Readers (pos indices) of a file past this share cancellation epochs with earlier ones
 
 class Cache : public Loggable, public Trackable<std::string, Cache *> {
   public:
@@ -97,33 +99,66 @@ class Cache : public Loggable, public Trackable<std::string, Cache *> {
     // virtual bool writeBlock(uint32_t index, uint64_t size, char *buffer, uint32_t fileIndex, Cache *originating = NULL);
     virtual bool writeBlock(Request *req);
 
-    // Note about the "reads" argument:
-    // the key to the map is the block number
-    // the value is two chained futures that return the requested block
-    // we need two futures because we potentially need to decompress the data, the second future allows the decompression to happen asynchronous without blocking a transfer thread.
-    // if we dont decompress, we can simply use a promise for the second future to immediately make the data available.
-    //
-    // the return value either returns the request block if it is present in any of the client side caches, or it signfies we need to wait for the network requests to finish (aka call get on the futures in "reads").
-
-    Request *requestBlock(uint32_t index, uint64_t &size, uint32_t fileIndex, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority);
-    virtual void readBlock(Request *req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority);
+    // The return value is the requested block if it is present in any of the client side caches (ready is set),
+    // otherwise the block is on its way and wait() on the request blocks until it arrives.
+
+    // dest optionally points at where the whole block belongs in the caller's buffer, the network level
+    // receives (or decompresses) straight into it and the request comes back with data == dest.
+    Request *requestBlock(uint32_t index, uint64_t &size, uint32_t fileIndex, uint64_t priority, uint8_t *dest = NULL);
+    virtual void readBlock(Request *req, uint64_t priority);
+    // Finishes a request this level deferred (see Request::defer), called from Request::wait on the waiting thread.
+    virtual void finishRequest(Request *req, int64_t arg);
+    // A demand read is waiting on a block a queued prefetch is bringing in, start that transfer now.
+    virtual void promoteBlock(uint32_t fileIndex, uint32_t blkIndex);
+    // Fills req from the first shared level (this one or below) already holding the block, without reserving
+    // anything or going to the network. Used once another process's fetch of the block has landed.
+    virtual bool lookupBlock(Request *req);
+    // Copies a block that just arrived into the shared levels (this one or below) holding a slot for it, so other
+    // processes can have it before the reader gets around to writing it back. The reader's references are left alone.
+    virtual void shareBlock(Request *req);
+
+    // Misses requested between these two calls (on the calling thread) are held back so the
+    // last level can combine contiguous blocks of a file into a single range request.
+    virtual void beginRequestBatch();
+    virtual void endRequestBatch();
 
     virtual void addCacheLevel(Cache *, uint64_t level = 0);
     virtual Cache *getCacheAtLevel(uint64_t level);
     virtual Cache *getCacheByName(std::string name);
+    virtual Cache *getCacheByTier(uint8_t tier);
     virtual Cache *getNextLevel();
     virtual void setLevel(uint64_t level);
     uint32_t numBlocks();
 
     virtual bool bufferWrite(Request *req);
+    // Like bufferWrite but the future is ready once every level has its copy, so a block delivered
+    // into a caller's buffer can populate the caches while the caller waits on its other blocks.
+    std::future<bool> writeBlockAsync(Request *req);
 
     double getRequestTime();
 
     virtual std::string name() { return _name; }
+    //Small fixed id for the tier, what cache indexes store to remember where a block came from (0 = unknown)
+    uint8_t tier() { return _tier; }
+    //Whether other processes on the node see this level's blocks
+    bool shared() { return _shared; }
+    static uint8_t tierId(std::string name);
 
     virtual void addFile(uint32_t index, std::string filename, uint64_t blockSize, std::uint64_t fileSize);
     //void prefetchBlocks(uint32_t index, uint64_t startBlk, uint64_t endBlk, uint64_t numBlks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex);
     void prefetchBlocks(uint32_t index, std::vector<uint64_t> blocks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex);
+    //Requests every block of the file at once (contiguous misses go out as range requests), the caches are filled in the background
+    void prefetchFile(uint64_t fileSize, uint64_t blkSize, uint32_t regFileIndex);
+
+    //Per file prefetch window, readahead style: every demand hit on a prefetched block widens it by one
+    //(so it doubles each time a whole window gets used) and every prefetched block evicted unread halves it
+    static uint32_t prefetchWindow(uint32_t fileIndex);
+    static void prefetchUsed(uint32_t fileIndex);
+    static void prefetchWasted(uint32_t fileIndex);
+    //Drops the file's prefetches that have not been requested yet (on close)
+    static void cancelPrefetches(uint32_t fileIndex);
+    //Drops only the ones queued for one reader of the file (pos index), when it jumps away
+    static void cancelPrefetches(uint32_t fileIndex, uint32_t index);
 
     CacheStats stats;
 
@@ -184,6 +219,7 @@ class Cache : public Loggable, public Trackable<std::string, Cache *> {
     uint64_t _ioAmts[_ioWinSize];
 
     std::string _name;
+    uint8_t _tier;
     uint64_t _level;
     Cache *_nextLevel;
     Cache *_base;
@@ -204,10 +240,15 @@ class Cache : public Loggable, public Trackable<std::string, Cache *> {
     ThreadPool<std::function<void()>> *_writePool;
 
     std::mutex _pMutex;
-    PriorityThreadPool<std::function<void()>> *_prefetchPool;
+    WorkStealingThreadPool<std::function<void()>> *_prefetchPool;
     std::unordered_set<std::string> _prefetches;
+    static std::atomic<uint32_t> _prefetchWindows[MAX_PREFETCH_FILES]; //0 until the file sees any feedback
+    static std::atomic<uint32_t> _prefetchEpochs[MAX_PREFETCH_FILES]; //Bumped to cancel, a prefetch runs only while its epoch is current
+    static std::atomic<uint32_t> _streamEpochs[MAX_PREFETCH_FILES][MAX_PREFETCH_STREAMS]; //Same, per reader of the file
+    static uint32_t prefetchEpoch(uint32_t fileIndex);
+    static uint64_t prefetchEpoch(uint32_t fileIndex, uint32_t index); //The file's epoch in the high half, the reader's in the low
     //void prefetch(uint32_t index, uint64_t startBlk, uint64_t endBlk, uint64_t numBlocks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex);
-    void prefetch(uint32_t index, std::vector<uint64_t> blocks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex);
+    void prefetch(uint32_t index, std::vector<uint64_t> blocks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex, uint64_t epoch);
 };
 
 #endif /* CACHE_H */
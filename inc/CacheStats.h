@@ -102,6 +102,9 @@ class CacheStats {
         read,
         constructor,
         destructor,
+        admitted, //blocks allowed to evict a victim by the admission filter
+        rejected, //blocks the admission filter kept out
+        wasted,   //prefetched blocks evicted before anyone read them
         last
     };
 
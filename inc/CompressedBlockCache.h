@@ -0,0 +1,138 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#ifndef COMPRESSEDBLOCKCACHE_H
+#define COMPRESSEDBLOCKCACHE_H
+
+#include "CacheStats.h"
+#include "Loggable.h"
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct CompressedBlk {
+    CompressedBlk(uint8_t *data, uint64_t size) : data(data), size(size) {}
+    ~CompressedBlk() { delete[] data; }
+    uint8_t *data;
+    uint64_t size;
+};
+
+//Server side store of compressed blocks so a block is compressed once no matter how
+//many clients ask for it. Sized and evicted (LRU) separately from the raw block caches.
+class CompressedBlockCache : public Loggable {
+  public:
+    CompressedBlockCache(std::string name, uint64_t cacheSize);
+    ~CompressedBlockCache();
+
+    //Returns the compressed block, on a miss compressBlk is run once and its result
+    //shared with anyone else asking for the block in the meantime. NULL on failure.
+    //A file reopened with another block size or compression level gets its own blocks.
+    std::shared_ptr<CompressedBlk> getBlock(uint32_t fileIndex, uint32_t blk, uint64_t blkSize, int compLevel, std::function<CompressedBlk *()> compressBlk);
+
+    CacheStats stats;
+
+  private:
+    struct Key {
+        uint32_t fileIndex;
+        uint32_t blk;
+        uint64_t blkSize;
+        int compLevel;
+        bool operator==(const Key &other) const {
+            return fileIndex == other.fileIndex && blk == other.blk && blkSize == other.blkSize && compLevel == other.compLevel;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+    struct Entry {
+        std::shared_future<std::shared_ptr<CompressedBlk>> blk;
+        std::list<Key>::iterator lru;
+        uint64_t size; //Zero until the block is compressed
+    };
+
+    void evict(); //Must lock _mutex
+
+    std::string _name;
+    uint64_t _cacheSize;
+    uint64_t _usedSize;
+
+    std::mutex _mutex;
+    std::unordered_map<Key, Entry, KeyHash> _blocks;
+    std::list<Key> _lru; //Most recently used at the front
+};
+
+#endif /* COMPRESSEDBLOCKCACHE_H */
@@ -103,6 +103,7 @@ const int maxSystemFd = 19459526;
 
 //Thread Pools
 const unsigned int numServerThreads = 16;
+const unsigned int numServerBlockThreads = getenv("TAZER_SERVER_BLOCK_THREADS") ? atoi(getenv("TAZER_SERVER_BLOCK_THREADS")) : 16;
 const unsigned int numServerCompThreads = 1;
 const unsigned int numClientTransThreads = NUMTHREADS;
 const unsigned int numClientDecompThreads = 1;
@@ -116,6 +117,7 @@ const unsigned int messageRetry = (unsigned int)10; //Simulates infinite retry..
 const unsigned int socketsPerConnection = 1;
 const unsigned int socketStep = 1024;
 const unsigned int socketRetry = 1;
+const unsigned int maxRequestsInFlight = getenv("TAZER_MAX_REQUESTS_IN_FLIGHT") ? atoi(getenv("TAZER_MAX_REQUESTS_IN_FLIGHT")) : 8; //Tagged block requests outstanding per socket
 
 //Input file Parameters
 const unsigned int fileOpenRetry = 1;
@@ -140,18 +142,24 @@ const bool useMemoryCache = true;
 static uint64_t memoryCacheSize = getenv("TAZER_PRIVATE_MEM_CACHE_SIZE") ? atol(getenv("TAZER_PRIVATE_MEM_CACHE_SIZE")) : 64 * 1024 * 1024UL;
 const uint32_t memoryCacheAssociativity = 16UL;
 const uint64_t memoryCacheBlocksize = maxBlockSize;
+const unsigned int memoryCacheEviction = getenv("TAZER_PRIVATE_MEM_CACHE_EVICTION") ? atoi(getenv("TAZER_PRIVATE_MEM_CACHE_EVICTION")) : 0; //0 LRU, 1 CLOCK, 2 ARC, 3 2Q
+const bool memoryCacheAdmission = getenv("TAZER_PRIVATE_MEM_CACHE_ADMISSION") ? atoi(getenv("TAZER_PRIVATE_MEM_CACHE_ADMISSION")) : 0; //only evict for blocks seen more often than the victim (TinyLFU)
 
 //Shared Memory Cache Parameters
 const bool useSharedMemoryCache = getenv("TAZER_SHARED_MEM_CACHE") ? atoi(getenv("TAZER_SHARED_MEM_CACHE")) : 0;
 static uint64_t sharedMemoryCacheSize = getenv("TAZER_SHARED_MEM_CACHE_SIZE") ? atol(getenv("TAZER_SHARED_MEM_CACHE_SIZE")) : 1 * 1024 * 1024 * 1024UL;
 const uint32_t sharedMemoryCacheAssociativity = 16UL;
 const uint64_t sharedMemoryCacheBlocksize = maxBlockSize;
+const unsigned int sharedMemoryCacheEviction = getenv("TAZER_SHARED_MEM_CACHE_EVICTION") ? atoi(getenv("TAZER_SHARED_MEM_CACHE_EVICTION")) : 0; //0 LRU, 1 CLOCK, 2 ARC, 3 2Q
+const bool sharedMemoryCacheAdmission = getenv("TAZER_SHARED_MEM_CACHE_ADMISSION") ? atoi(getenv("TAZER_SHARED_MEM_CACHE_ADMISSION")) : 0; //only evict for blocks seen more often than the victim (TinyLFU)
 
 //BurstBuffer Cache Parameters
 const bool useBurstBufferCache = getenv("TAZER_BB_CACHE") ? atoi(getenv("TAZER_BB_CACHE")) : 0;
 static uint64_t burstBufferCacheSize = getenv("TAZER_BB_CACHE_SIZE") ? atol(getenv("TAZER_BB_CACHE_SIZE")) : 1 * 1024 * 1024 * 1024UL;
 const uint32_t burstBufferCacheAssociativity = 16UL;
 const uint64_t burstBufferCacheBlocksize = maxBlockSize;
+const unsigned int burstBufferCacheEviction = getenv("TAZER_BB_CACHE_EVICTION") ? atoi(getenv("TAZER_BB_CACHE_EVICTION")) : 0; //0 LRU, 1 CLOCK, 2 ARC, 3 2Q
+const bool burstBufferCacheAdmission = getenv("TAZER_BB_CACHE_ADMISSION") ? atoi(getenv("TAZER_BB_CACHE_ADMISSION")) : 0; //only evict for blocks seen more often than the victim (TinyLFU)
 const std::string burstBufferCacheFilePath("/tmp/" + tazer_id + "/tazer_cache/bbc"); // TODO: have option to pass from environment variable
 
 //File Cache Parameters
@@ -159,13 +167,18 @@ const bool useFileCache = getenv("TAZER_FILE_CACHE") ? atoi(getenv("TAZER_FILE_C
 static uint64_t fileCacheSize = getenv("TAZER_FILE_CACHE_SIZE") ? atol(getenv("TAZER_FILE_CACHE_SIZE")) : 1 * 1024 * 1024 * 1024UL;
 const uint32_t fileCacheAssociativity = 16UL;
 const uint64_t fileCacheBlocksize = maxBlockSize;
+const unsigned int fileCacheEviction = getenv("TAZER_FILE_CACHE_EVICTION") ? atoi(getenv("TAZER_FILE_CACHE_EVICTION")) : 0; //0 LRU, 1 CLOCK, 2 ARC, 3 2Q
+const bool fileCacheAdmission = getenv("TAZER_FILE_CACHE_ADMISSION") ? atoi(getenv("TAZER_FILE_CACHE_ADMISSION")) : 0; //only evict for blocks seen more often than the victim (TinyLFU)
 const std::string fileCacheFilePath("/tmp/" + tazer_id + "/tazer_cache/fc"); // TODO: have option to pass from environment variable
+const bool fileCacheDirectIO = getenv("TAZER_FILE_CACHE_DIRECT_IO") ? atoi(getenv("TAZER_FILE_CACHE_DIRECT_IO")) : 0; //bypass the page cache for block data (blocksize must be a multiple of 4KB)
+const uint32_t fileCacheCheckpointBlocks = getenv("TAZER_FILE_CACHE_CHECKPOINT") ? atoi(getenv("TAZER_FILE_CACHE_CHECKPOINT")) : 1024; //blocks written between index checkpoints (0 only checkpoints at exit)
 
 //Bounded Filelock Cache Parameters
 const bool useBoundedFilelockCache = getenv("TAZER_BOUNDED_FILELOCK_CACHE") ? atoi(getenv("TAZER_BOUNDED_FILELOCK_CACHE")) : 0;
 static uint64_t boundedFilelockCacheSize = getenv("TAZER_BOUNDED_FILELOCK_CACHE_SIZE") ? atol(getenv("TAZER_BOUNDED_FILELOCK_CACHE_SIZE")) : 1 * 1024 * 1024 * 1024UL;
 const uint32_t boundedFilelockCacheAssociativity = 16UL;
 const uint64_t boundedFilelockCacheBlocksize = maxBlockSize;
+const unsigned int boundedFilelockCacheEviction = getenv("TAZER_BOUNDED_FILELOCK_CACHE_EVICTION") ? atoi(getenv("TAZER_BOUNDED_FILELOCK_CACHE_EVICTION")) : 0; //0 LRU, 1 CLOCK, 2 ARC, 3 2Q
 const std::string boundedFilelockCacheFilePath("/tmp/" + tazer_id + "/tazer_cache/gc"); // TODO: have option to pass from environment variable
 
 //Filelock Cache Parameters
@@ -176,6 +189,9 @@ const std::string filelockCacheFilePath("/tmp/" + tazer_id + "/tazer_cache/gc");
 //Network Cache Parameters
 const bool useNetworkCache = getenv("TAZER_NETWORK_CACHE") ? atoi(getenv("TAZER_NETWORK_CACHE")) : 1;
 const uint64_t networkBlockSize = maxBlockSize;
+const unsigned int maxRangeBlks = getenv("TAZER_MAX_RANGE_BLKS") ? atoi(getenv("TAZER_MAX_RANGE_BLKS")) : 64; //Most contiguous misses sent as one range request
+const uint32_t inflightTableSize = getenv("TAZER_INFLIGHT_TABLE_SIZE") ? atoi(getenv("TAZER_INFLIGHT_TABLE_SIZE")) : 16384; //Slots in the node wide table of blocks being fetched, 0 lets every process fetch its own misses
+const double inflightTimeout = getenv("TAZER_INFLIGHT_TIMEOUT") ? atof(getenv("TAZER_INFLIGHT_TIMEOUT")) : 60.0; //Seconds a live process may hold a block before a waiter fetches it itself
 
 //LocalFile Cache Parameters
 const bool useLocalFileCache = getenv("TAZER_LOCAL_FILE_CACHE") ? atoi(getenv("TAZER_LOCAL_FILE_CACHE")) : 0;
@@ -196,6 +212,8 @@ const bool useServerNetworkCache = getenv("TAZER_NETWORK_CACHE") ? atoi(getenv("
 const uint64_t serverCacheSize = getenv("TAZER_SERVER_CACHE_SIZE") ? atol(getenv("TAZER_SERVER_CACHE_SIZE")) : 20UL * 1024 * 1024 * 1024;
 const uint64_t serverCacheBlocksize = maxBlockSize;
 const uint32_t serverCacheAssociativity = 16UL;
+const uint64_t serverCompressedCacheSize = getenv("TAZER_SERVER_COMPRESSED_CACHE_SIZE") ? atol(getenv("TAZER_SERVER_COMPRESSED_CACHE_SIZE")) : 4UL * 1024 * 1024 * 1024;
+const uint64_t serverWriteCoalesceSize = getenv("TAZER_SERVER_WRITE_COALESCE_SIZE") ? atol(getenv("TAZER_SERVER_WRITE_COALESCE_SIZE")) : 16UL * 1024 * 1024; //Adjacent output writes are gathered up to this size before hitting the file, keep it at least outputFileBufferSize or full client buffers skip it
 const std::string ServerConnectionsPath(getenv("TAZER_SERVER_CONNECTIONS") ? getenv("TAZER_SERVER_CONNECTIONS") : "");
 
 const bool prefetchEvict = getenv("TAZER_PREFETCH_EVICT") ? atoi(getenv("TAZER_PREFETCH_EVICT")) : 0; //When evicting a block, choose prefetched blocks first.
@@ -205,6 +223,11 @@ const bool prefetchEvict = getenv("TAZER_PREFETCH_EVICT") ? atoi(getenv("TAZER_P
 const unsigned int prefetcherType = getenv("TAZER_PREFETCHER_TYPE") ? atoi(getenv("TAZER_PREFETCHER_TYPE")) : 0;
 const unsigned int numPrefetchBlks = getenv("TAZER_PREFETCH_NUM_BLKS") ? atoi(getenv("TAZER_PREFETCH_NUM_BLKS")) : 1;
 const int prefetchDelta = getenv("TAZER_PREFETCH_DELTA") ? atoi(getenv("TAZER_PREFETCH_DELTA")) : 1;
+const unsigned int prefetchMaxDepth = getenv("TAZER_PREFETCH_MAX_DEPTH") ? atoi(getenv("TAZER_PREFETCH_MAX_DEPTH")) : 32; //Most blocks the stride prefetcher keeps ahead of a stream
+const unsigned int strideConfidence = getenv("TAZER_PREFETCH_STRIDE_CONFIDENCE") ? atoi(getenv("TAZER_PREFETCH_STRIDE_CONFIDENCE")) : 2; //Repeats of a stride before we prefetch along it
+const std::string markovModelPath = getenv("TAZER_PREFETCH_MODEL_PATH") ? getenv("TAZER_PREFETCH_MODEL_PATH") : "/tmp/" + tazer_id + "/tazer_cache/markov"; //Where the markov prefetcher keeps its per file models
+const unsigned int markovThreshold = getenv("TAZER_PREFETCH_MARKOV_THRESHOLD") ? atoi(getenv("TAZER_PREFETCH_MARKOV_THRESHOLD")) : 25; //Percent of a block's transitions a successor needs before we prefetch it
+const uint64_t wholeFileFetchSize = getenv("TAZER_WHOLE_FILE_FETCH_SIZE") ? atol(getenv("TAZER_WHOLE_FILE_FETCH_SIZE")) : 0; //Files up to this size are fetched whole at open (0 = off, a meta line can ask with a 'w' after its prefetch field)
 const std::string prefetchFileDir = getenv("TAZER_PREFETCH_FILEDIR") ? getenv("TAZER_PREFETCH_FILEDIR") : "./";
 
 //const bool prefetchGlobal = getenv("TAZER_PREFETCH_GLOBAL") ? atoi(getenv("TAZER_PREFETCH_GLOBAL")) : 1;
@@ -215,6 +238,8 @@ const std::string prefetchFileDir = getenv("TAZER_PREFETCH_FILEDIR") ? getenv("T
 //-----------------------------------------------------
 
 const uint64_t outputFileBufferSize = 16UL * 1024 * 1024;
+const unsigned int outputWindow = getenv("TAZER_OUTPUT_WINDOW") ? atoi(getenv("TAZER_OUTPUT_WINDOW")) : 8; //Output buffers sent but not yet acked per file
+const int outputAckPollTime = 1; //ms to wait on a write ack before looking for more output buffers to send
 
 const bool reuseFileCache = true; //josh, what is the point of a reusable cache if you dont reuse it!?!?! ;)
 const bool bufferFileCacheWrites = true;
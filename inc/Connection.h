@@ -80,8 +80,11 @@
 #include "Trackable.h"
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <poll.h>
 #include <queue>
@@ -89,13 +92,26 @@
 #include <unordered_map>
 #include <vector>
 
+//Per socket state for tagged (pipelined) requests on the client
+//Responses are read by whichever waiter is free and handed to their owner by id
+struct TaggedSocket {
+    TaggedSocket(int sock) : socket(sock), inFlight(0), reading(false), failed(false), retired(false) {}
+    int socket;
+    uint32_t inFlight;
+    bool reading;
+    bool failed;
+    bool retired; //Replaced but still open, closed once no one can be reading it
+    std::unordered_multimap<uint32_t, std::shared_ptr<void>> arrived;
+    std::condition_variable cv;
+};
+
 class Connection : public Loggable, public Trackable<std::string, Connection *> {
   public:
     Connection(std::string hostAddr, int port);             //Client
     Connection(int sock, std::string clientAddr, int port); //Server
     ~Connection();
 
-    void lock();
+    void lock(bool tagged = false);
     int unlock();
 
     void incCnt();
@@ -107,8 +123,16 @@ class Connection : public Loggable, public Trackable<std::string, Connection *>
     bool addSocket();                           //Client only
     bool initiate(unsigned int numConnections); //Client only
 
+    std::shared_ptr<TaggedSocket> beginTagged(uint32_t &id); //Client only, ids are unique across sockets
+    bool recvTagged(std::shared_ptr<TaggedSocket> tagged, uint32_t id, std::function<bool(Connection *, uint32_t &, std::shared_ptr<void> &)> recvOne, std::shared_ptr<void> &msg);
+    void endTagged(std::shared_ptr<TaggedSocket> tagged); //Client only
+
     bool addSocket(int socket); //Server only
     int pollMsg();              //Server only
+    bool msgWaiting(int timeout = 0); //Is more data waiting on the locked socket, or does it arrive within timeout ms
+    void setSocket(int socket);  //Server only, the socket a worker receives on (-1 to clear)
+    void lockSocket(int socket); //Server only
+    void unlockSocket();         //Server only
 
     int closeSocket();
     int closeSocket(int &socket);
@@ -144,13 +168,21 @@ class Connection : public Loggable, public Trackable<std::string, Connection *>
   private:
     bool isServer();
     bool isClient();
+    void retireTagged(std::shared_ptr<TaggedSocket> tagged); //Must lock _sMutex
+    void replaceSocket(int socket);                           //Must lock _sMutex
+    void releaseTagged(std::shared_ptr<TaggedSocket> tagged); //Must lock _sMutex
 
     std::mutex _sMutex;               //Lock used for _pfds and _sockets
     std::vector<struct pollfd> _pfds; //Used for server
-    std::queue<int> _sockets;         //Used for clients
+    std::deque<int> _sockets;         //Used for clients
     std::condition_variable _cv;      //Used for clients to pop from queue
     std::atomic_uint _numSockets;     //Number of sockets for both
 
+    std::unordered_map<int, std::shared_ptr<TaggedSocket>> _tagged; //Used for clients, protected by _sMutex
+    unsigned int _exclusiveWaiting;                                  //Clients waiting for an idle socket
+
+    std::mutex _sendMutex; //Used by server workers to serialize sends
+
     unsigned int _nextSocket; //Index used by server to start polling from
     int _inMsgs;
 
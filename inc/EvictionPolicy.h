@@ -0,0 +1,133 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#ifndef EVICTIONPOLICY_H
+#define EVICTIONPOLICY_H
+#include <stdint.h>
+#include <vector>
+
+#define LRU_EVICTION 0
+#define CLOCK_EVICTION 1
+#define ARC_EVICTION 2
+#define TWOQ_EVICTION 3
+
+//Lists a block can be on (T1/T2 for ARC, A1in/Am for 2Q)
+#define EVICT_NONE 0
+#define EVICT_RECENT 1
+#define EVICT_FREQUENT 2
+
+//Replacement state kept in every slot's BlockEntry, so it is shared and persisted along with the rest of the index
+struct EvictionEntry {
+    uint64_t admitted;       //when the current block entered the slot
+    uint32_t ghostFileIndex; //block this slot last evicted (+1, 0 for none)
+    uint32_t ghostBlockIndex;
+    uint16_t binState; //per bin state (CLOCK hand, ARC target), only used in a bin's first slot
+    uint8_t queue;     //list the block is on, or the CLOCK reference bit
+    uint8_t ghostQueue;
+};
+
+//A slot of a bin as the policy sees it, policies set dirty on any slot whose state they change
+struct EvictionSlot {
+    EvictionEntry *state;
+    uint64_t timeStamp; //last access
+    uint32_t fileIndex; //+1, 0 for none
+    uint32_t blockIndex;
+    bool valid;     //holds an available block
+    bool evictable; //valid and not in use
+    bool dirty;
+};
+
+//Picks victims within one bin of a BoundedCache, bins are small so policies just scan
+class EvictionPolicy {
+  public:
+    virtual ~EvictionPolicy();
+
+    //A cached block was hit, returns true if its state needs writing back
+    virtual bool touch(EvictionEntry *state) = 0;
+    //Slot to evict for the incoming block, -1 if nothing is evictable
+    virtual int victim(std::vector<EvictionSlot> &bin, uint32_t fileIndex, uint32_t blockIndex) = 0;
+    //The incoming block takes over slot (evicting its occupant if valid)
+    virtual void admit(std::vector<EvictionSlot> &bin, uint32_t slot, uint32_t fileIndex, uint32_t blockIndex) = 0;
+
+    static EvictionPolicy *newEvictionPolicy(unsigned int type);
+
+  protected:
+    static int oldest(std::vector<EvictionSlot> &bin, int queue = -1, bool byAdmission = false);
+    static int ghost(std::vector<EvictionSlot> &bin, uint32_t fileIndex, uint32_t blockIndex);
+    static uint32_t count(std::vector<EvictionSlot> &bin, uint8_t queue);
+    static uint32_t countGhosts(std::vector<EvictionSlot> &bin, uint8_t queue);
+    static void remember(EvictionSlot &slot);
+};
+
+#endif /* EVICTIONPOLICY_H */
@@ -78,10 +78,13 @@
 #include <atomic>
 #include <future>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #define FILECACHENAME "filecache"
+#define BURSTBUFFERCACHENAME "burstbuffer"
 
 class FileCache : public BoundedCache<MultiReaderWriterLock> {
   public:
@@ -93,16 +96,27 @@ class FileCache : public BoundedCache<MultiReaderWriterLock> {
   protected:
     virtual uint8_t *getBlockData(unsigned int blockIndex);
     virtual void setBlockData(uint8_t *data, unsigned int blockIndex, uint64_t size);
+    virtual uint8_t *readBlockData(uint32_t blockIndex, Request *req);
     virtual void cleanUpBlockData(uint8_t *data);
 
   private:
     struct MemBlockEntry : BlockEntry {
         std::atomic<uint32_t> activeCnt;
+        BlockWaitWord wait;
     };
-    void writeToFile(uint64_t size, uint8_t *buff);
-    void readFromFile(uint64_t size, uint8_t *buff);
-    virtual void blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t byte, int32_t prefetch = -1, std::string cacheName = FILECACHENAME);
-    virtual bool blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs = false, uint32_t cnt = 0, char *origCache = NULL);
+    //Shared by every process using the cache file
+    struct IndexState {
+        std::atomic<uint32_t> dirty; //blocks may have been written since the index on disk was checkpointed
+        std::atomic<uint32_t> written;
+    };
+    void writeToFile(uint64_t size, uint8_t *buff, uint64_t offset);
+    void readFromFile(uint64_t size, uint8_t *buff, uint64_t offset);
+    void writeBlockFile(uint64_t size, uint8_t *buff, uint64_t offset);
+    void readBlockFile(uint64_t size, uint8_t *buff, uint64_t offset);
+    uint8_t *allocBuffer();
+    void checkpoint();
+    virtual void blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t byte, int32_t prefetch, uint8_t origin);
+    virtual bool blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs = false, uint32_t cnt = 0, uint8_t *origin = NULL);
     virtual void readBlockEntry(uint32_t blockIndex, BlockEntry *entry);
     virtual void writeBlockEntry(uint32_t blockIndex, BlockEntry *entry);
     virtual void readBin(uint32_t binIndex, BlockEntry *entries);
@@ -111,21 +125,27 @@ class FileCache : public BoundedCache<MultiReaderWriterLock> {
     virtual int incBlkCnt(uint32_t blk);
     virtual int decBlkCnt(uint32_t blk);
     virtual bool anyUsers(uint32_t blk);
+    virtual BlockWaitWord *blockWaitWord(uint32_t blk);
 
     MemBlockEntry *_blkIndex;
+    IndexState *_indexState;
 
     uint32_t _pid;
     std::string _filePath;
     std::atomic_uint *_fullFlag;
     int _blocksfd;
+    int _directfd; //O_DIRECT handle for block data, -1 when going through the page cache
     int _blkIndexfd;
+    uint64_t _indexOffset;
+
+    std::mutex _bufLock;
+    std::vector<uint8_t *> _bufs;
 
     unixopen_t _open;
     unixclose_t _close;
-    unixread_t _read;
-    unixwrite_t _write;
-    unixlseek_t _lseek;
-    unixfsync_t _fsync;
+    unixpread_t _pread;
+    unixpwrite_t _pwrite;
+    unixfdatasync_t _fdatasync;
 };
 
 #endif /* BUSTBUFFERCACHE_H */
@@ -0,0 +1,110 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#ifndef FREQUENCYSKETCH_H
+#define FREQUENCYSKETCH_H
+#include <atomic>
+#include <stdint.h>
+
+#define SKETCH_DEPTH 4
+
+//Count-min sketch of recent block accesses with 4 bit saturating counters, the frequency filter of TinyLFU.
+//Counters are halved every sample period so old popularity fades. Like MultiReaderWriterLock it can be placed
+//in shared memory, so every process using a cache feeds (and is judged by) the same counts.
+class FrequencySketch {
+  public:
+    FrequencySketch(uint32_t numBlocks);
+    FrequencySketch(uint32_t numBlocks, uint8_t *dataAddr, bool init = false);
+    ~FrequencySketch();
+    static uint64_t getDataSize(uint32_t numBlocks);
+
+    //keys are BoundedCache block keys ((fileIndex + 1) << 32 | (blockIndex + 1))
+    void increment(uint64_t key);
+    uint32_t frequency(uint64_t key);
+    //A candidate only displaces a victim that has been seen less often
+    bool admit(uint64_t candidate, uint64_t victim);
+
+  private:
+    static uint64_t rowWidth(uint32_t numBlocks);
+    void counter(uint64_t hash, uint32_t row, uint64_t &word, uint32_t &shift);
+    void halve();
+
+    uint64_t _width; //counters per row, a power of two
+    uint64_t _sampleSize;
+    std::atomic<uint64_t> *_samples; //increments since the last halving
+    std::atomic<uint64_t> *_table;   //SKETCH_DEPTH rows of _width counters, 16 to a word
+    uint8_t *_dataAddr;
+};
+
+#endif /* FREQUENCYSKETCH_H */
@@ -0,0 +1,127 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+
+#ifndef INFLIGHTTABLE_H
+#define INFLIGHTTABLE_H
+#include <atomic>
+#include <stdint.h>
+
+#define INFLIGHT_POLL_INTERVAL 0.1 //seconds between checks that the owner of a block we wait on is still alive
+
+//Node wide table of the blocks being fetched over the network. It lives in shared memory, so when several
+//processes miss the same block at once exactly one of them (the owner) sends for it, the rest wait until the
+//owner has written it back through its caches and then read it from a shared level. Slots are direct mapped by
+//block, a block whose slot is taken by another block is fetched untracked rather than waiting for room.
+class InflightTable {
+  public:
+    enum Claim {
+        OWNER,    //the caller fetches the block and releases it once written back
+        WAIT,     //someone else is fetching it, wait() on the returned slot
+        UNTRACKED //slot busy with another block, fetch without dedup
+    };
+
+    InflightTable(uint32_t numSlots);
+    ~InflightTable();
+    //NULL when disabled (TAZER_INFLIGHT_TABLE_SIZE=0) or without shared memory, since file indices are only node wide with it
+    static InflightTable *openInflightTable();
+
+    Claim claim(uint32_t fileIndex, uint32_t blkIndex, uint32_t &slot);
+    void release(uint32_t fileIndex, uint32_t blkIndex);
+    //Returns true once the owner releases the block. Returns false if the owner died (or held it past
+    //TAZER_INFLIGHT_TIMEOUT), the claim is then handed to the caller who must fetch and release it.
+    bool wait(uint32_t slot, uint32_t fileIndex, uint32_t blkIndex);
+
+  private:
+    struct Slot {
+        std::atomic<uint64_t> key;       //(fileIndex + 1) << 32 | (blkIndex + 1), 0 when free
+        std::atomic<uint64_t> claimTime; //when the current owner took it, 0 when free
+        std::atomic<uint32_t> owner;     //pid, 0 when free and for an instant while a claim is being filled in
+        std::atomic<uint32_t> seq;       //futex word, bumped on every release
+        std::atomic<uint32_t> waiters;   //skip the wake syscall when nobody sleeps
+        uint32_t pad;
+    };
+
+    static uint64_t blockKey(uint32_t fileIndex, uint32_t blkIndex);
+    uint32_t slotIndex(uint64_t key);
+    bool abandoned(Slot &slot, uint32_t owner, uint64_t since);
+    void take(Slot &slot);
+
+    uint32_t _numSlots;
+    uint32_t _pid;
+    uint64_t _size;
+    Slot *_slots;
+};
+
+#endif /* INFLIGHTTABLE_H */
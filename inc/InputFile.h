@@ -78,7 +78,7 @@
 #include "ConnectionPool.h"
 #include "FileCacheRegister.h"
 #include "TazerFile.h"
-#include "PriorityThreadPool.h"
+#include "WorkStealingThreadPool.h"
 #include "ReaderWriterLock.h"
 #include "Prefetcher.h"
 #include <atomic>
@@ -98,21 +98,26 @@ class InputFile : public TazerFile {
     uint64_t fileSize();
 
     ssize_t read(void *buf, size_t count, uint32_t index = 0);
+    ssize_t pread(void *buf, size_t count, uint64_t offset, uint32_t index = 0);
+    ssize_t readv(const struct iovec *iov, int iovcnt, uint32_t index = 0);
+    ssize_t preadv(const struct iovec *iov, int iovcnt, uint64_t offset, uint32_t index = 0);
     ssize_t write(const void *buf, size_t count, uint32_t index = 0);
     off_t seek(off_t offset, int whence, uint32_t index = 0);
 
     static void printHits();
-    static PriorityThreadPool<std::packaged_task<std::shared_future<Request*>()>> _transferPool;
-    static PriorityThreadPool<std::packaged_task<Request*()>> _decompressionPool;
+    static WorkStealingThreadPool<std::function<void()>> _transferPool;
+    static WorkStealingThreadPool<std::function<void()>> _decompressionPool;
 
     static Cache *_cache;
 
   private:
     uint64_t fileSizeFromServer();
 
-    bool trackRead(size_t count, uint32_t index, uint32_t startBlock, uint32_t endBlock);
+    bool trackRead(size_t count, uint64_t offset, uint32_t startBlock, uint32_t endBlock);
 
-    uint64_t copyBlock(char *buf, char *blkBuf, uint32_t blk, uint32_t startBlock, uint32_t endBlock, uint32_t fpIndex, uint64_t count);
+    uint64_t copyBlock(const struct iovec *iov, int iovcnt, char *blkBuf, uint32_t blk, uint32_t startBlock, uint32_t endBlock, uint64_t offset, uint64_t count);
+    static void scatter(const struct iovec *iov, int iovcnt, uint64_t pos, char *src, uint64_t len);
+    static uint8_t *contiguous(const struct iovec *iov, int iovcnt, uint64_t pos, uint64_t len);
 
     std::mutex _openCloseLock;
     std::atomic<uint64_t> _fileSize;
@@ -85,7 +85,7 @@ class LocalFileCache : public Cache {
 
     bool writeBlock(Request *req);
 
-    virtual void readBlock(Request *req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority);
+    virtual void readBlock(Request *req, uint64_t priority);
     void printStats();
 
     static Cache *addNewLocalFileCache(std::string cacheName);
@@ -0,0 +1,127 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#ifndef MARKOVPREFETCHER_H
+#define MARKOVPREFETCHER_H
+
+#include "Prefetcher.h"
+#include "Loggable.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#define MARKOV_SUCCESSORS 4
+#define MARKOV_MAGIC 0x4b4d5a54 //"TZMK"
+#define MARKOV_VERSION 1
+
+//Learns which block tends to follow which for a file, and prefetches the likely successors of
+//each access. The model is loaded from Config::markovModelPath when the file is opened and the
+//transitions seen by this run are merged back into it when the file goes away, so later runs
+//start out knowing the pattern.
+class MarkovPrefetcher : public Prefetcher {
+public:
+    MarkovPrefetcher(std::string name, std::string fileName);
+    ~MarkovPrefetcher();
+
+    std::vector<uint64_t> getBlocks(uint32_t fileIndex, uint64_t startBlk, uint64_t endBlk, uint64_t numBlocks, uint64_t blkSize, uint64_t fileSize);
+
+    //Files still open at exit are never destroyed, so the client saves their models on the way out
+    static void saveAll();
+
+private:
+    //The few most frequent successors of a block, with how often each was seen
+    struct Node {
+        uint32_t next[MARKOV_SUCCESSORS];
+        uint16_t count[MARKOV_SUCCESSORS];
+    };
+    typedef std::unordered_map<uint32_t, Node> Model;
+
+    static void addTransition(Model &model, uint32_t from, uint32_t to, uint16_t cnt);
+    static bool load(std::string path, Model &model);
+    bool save();
+
+    std::string _path;
+    std::mutex _lock;
+    Model _model;
+    Model _learned; //Only what this run saw, merged into whatever is on disk by the time we save
+    std::unordered_map<uint32_t, uint32_t> _lastBlk; //Per stream
+
+    //Pointers so they outlive static destruction, saveAll runs from the library destructor
+    static std::mutex *_instancesMutex;
+    static std::unordered_set<MarkovPrefetcher *> *_instances;
+};
+
+#endif //MARKOVPREFETCHER_H
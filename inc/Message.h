@@ -126,6 +126,7 @@ struct requestBlkMsg {
     msgHeader header;
     uint32_t start;
     uint32_t end;
+    uint32_t id; //Echoed back in each sendBlkMsg so responses can be matched out of order
     char* name;
 };
 
@@ -133,6 +134,7 @@ struct sendBlkMsg {
     msgHeader header;
     int compression;
     uint32_t blk;
+    uint32_t id;
     uint32_t dataSize;
     char* data;
 };
@@ -162,10 +164,29 @@ struct writeMsg {
 struct ackMsg {
     msgHeader header;
     msgType ackType;
+    unsigned int sn; //Write acks are cumulative, every write up to and including sn is on the server
+    unsigned int failed; //The server could not do what is being acked (write the data, or get it to disk on close)
 };
 
 #pragma pack(pop)
 
+//A received block waiting to be picked up by the requester of id
+struct taggedBlk {
+    taggedBlk() : blk(0), dataSize(0), data(NULL), borrowed(false) {}
+    ~taggedBlk() {
+        if (!borrowed)
+            delete[] data;
+    }
+    std::string name;
+    unsigned int blk;
+    unsigned int dataSize;
+    char *data;
+    bool borrowed; //data was received into a buffer the requester supplied
+};
+
+//Lets a receiver pick the buffer a block is received into once the header is read, returns NULL to allocate one
+typedef std::function<char *(unsigned int id, unsigned int blk, unsigned int dataSize)> blkDestFunc;
+
 void printMsgHeader(char *pkt);
 msgType getMsgType(char *msg);
 bool checkMsg(char *pkt, unsigned int size);
@@ -181,8 +202,8 @@ int64_t clientRecRetryCount(Connection *connection, char *buff, int64_t size);
 bool sendOpenFileMsg(Connection *connection, std::string name, unsigned int blkSize, bool compress, bool output);
 std::string parseOpenFileMsg(char *pkt, unsigned int &blkSize, bool &compress, bool &output);
 
-bool sendRequestBlkMsg(Connection *connection, std::string name, unsigned int start, unsigned int end);
-std::string parseRequestBlkMsg(char *pkt, unsigned int &start, unsigned int &end);
+bool sendRequestBlkMsg(Connection *connection, std::string name, unsigned int start, unsigned int end, unsigned int id);
+std::string parseRequestBlkMsg(char *pkt, unsigned int &start, unsigned int &end, unsigned int &id);
 
 bool sendCloseFileMsg(Connection *connection, std::string name);
 std::string parseCloseFileMsg(char *pkt);
@@ -194,10 +215,13 @@ std::string parseFileSizeMsg(char *pkt, uint64_t &fileSize, uint8_t &open);
 bool recFileSizeMsg(Connection *connection, uint64_t &fileSize);
 
 bool sendSendBlkMsg(Connection *connection, std::string name, unsigned int blk, char *data, unsigned int dataSize);
-std::string recSendBlkMsg(Connection *connection, char **data, unsigned int &blk, unsigned int &dataSize, unsigned int dataBufSize = 0);
+std::string recSendBlkMsg(Connection *connection, char **data, unsigned int &blk, unsigned int &dataSize, unsigned int &id, unsigned int dataBufSize = 0, blkDestFunc dest = NULL);
+bool recTaggedBlkMsg(Connection *connection, uint32_t &id, std::shared_ptr<void> &msg, unsigned int dataBufSize, blkDestFunc dest = NULL);
 
-bool sendAckMsg(Connection *connection, msgType ackType);
+bool sendAckMsg(Connection *connection, msgType ackType, unsigned int sn = 0, bool failed = false);
 bool recAckMsg(Connection *connection, msgType expMstType);
+bool recAckMsg(Connection *connection, msgType expMstType, unsigned int &sn);
+bool recAckMsg(Connection *connection, msgType expMstType, unsigned int &sn, bool &failed);
 
 bool sendRequestFileSizeMsg(Connection *connection, std::string name);
 std::string parseRequestFileSizeMsg(char *pkt);
@@ -207,7 +231,7 @@ bool sendCloseServerMsg(Connection *connection);
 bool sendPingMsg(Connection *connection);
 
 bool sendWriteMsg(Connection *connection, std::string name, char *data, unsigned int dataSize, unsigned int compSize, uint64_t fp, unsigned int sn);
-std::string parseWriteMsg(char *pkt, char **data, unsigned int &dataSize, unsigned int &compSize, uint64_t &fp);
+std::string parseWriteMsg(char *pkt, char **data, unsigned int &dataSize, unsigned int &compSize, uint64_t &fp, unsigned int &sn);
 
 int pollWrapper(Connection *connection);
 int64_t pollRecWrapper(Connection *connection, char **buff);
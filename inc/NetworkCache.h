@@ -76,35 +76,71 @@
 #define NETWORKCACHE_H
 #include "Cache.h"
 #include "ConnectionPool.h"
-#include "PriorityThreadPool.h"
+#include "InflightTable.h"
+#include "WorkStealingThreadPool.h"
+#include <memory>
+#include <mutex>
+#include <vector>
 
 class NetworkCache : public Cache {
   public:
-    NetworkCache(std::string cacheName, PriorityThreadPool<std::packaged_task<std::shared_future<Request*>()>> &txPool, PriorityThreadPool<std::packaged_task<Request*()>> &decompPool);
+    NetworkCache(std::string cacheName, WorkStealingThreadPool<std::function<void()>> &txPool, WorkStealingThreadPool<std::function<void()>> &decompPool);
     virtual ~NetworkCache();
 
     bool writeBlock(Request* req);
 
-    virtual void readBlock(Request* req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request*>>> &reads, uint64_t priority);
+    virtual void readBlock(Request* req, uint64_t priority);
+    virtual void finishRequest(Request *req, int64_t arg);
+    virtual void promoteBlock(uint32_t fileIndex, uint32_t blkIndex);
+    virtual void beginRequestBatch();
+    virtual void endRequestBatch();
 
     void setFileCompress(uint32_t index, bool compress);
     void setFileConnectionPool(uint32_t index, ConnectionPool *nmconPool);
 
     void printStats();
 
-    static Cache *addNewNetworkCache(std::string cacheName, PriorityThreadPool<std::packaged_task<std::shared_future<Request*>()>> &txPool, PriorityThreadPool<std::packaged_task<Request*()>> &decompPool);
+    static Cache *addNewNetworkCache(std::string cacheName, WorkStealingThreadPool<std::function<void()>> &txPool, WorkStealingThreadPool<std::function<void()>> &decompPool);
     void addFile(uint32_t index, std::string filename, uint64_t blockSize, std::uint64_t fileSize);
 
+    //A block waiting on the network, its request is completed once the data is in place
+    struct PendingBlk {
+        Request *req;
+        uint64_t priority;
+    };
+
+    //A range request sitting in the transfer pool, whoever claims it first sends it
+    struct PendingTransfer {
+        std::atomic_bool claimed;
+        bool promotable; //Prefetches are listed in _pending until claimed
+        std::vector<PendingBlk> blks;
+    };
+
+  protected:
+    virtual void setBase(Cache *base);
+
   private:
     Request* decompress(Request* req,char *compBuf, uint32_t compBufSize, uint32_t blkBufSize, uint32_t blk);
     // std::future<Request*> requestBlk(Connection *server, uint32_t blkStart, uint32_t blkEnd, uint32_t fileIndex, uint32_t priority);
-    std::future<Request*> requestBlk(Connection *server, Request* req, uint32_t priority);
+    bool requestBlks(Connection *server, std::vector<PendingBlk> &blks, uint32_t priority);
+    void deliverBlk(PendingBlk &blk, char *data, uint32_t dataSize, uint32_t priority);
+    void releaseBlk(Request *req);
+    void transferBlks(std::vector<PendingBlk> blks);
+    void runTransfer(std::shared_ptr<PendingTransfer> transfer, uint64_t priority);
+    char *claimDest(uint32_t id, uint32_t blk, uint32_t dataSize);
     std::atomic_uint _outstanding;
     std::unordered_map<uint32_t, bool> _compressMap;
     std::unordered_map<uint32_t, ConnectionPool *> _conPoolMap;
-    PriorityThreadPool<std::packaged_task<std::shared_future<Request*>()>> &_transferPool;
-    PriorityThreadPool<std::packaged_task<Request*()>> &_decompPool;
+    WorkStealingThreadPool<std::function<void()>> &_transferPool;
+    WorkStealingThreadPool<std::function<void()>> &_decompPool;
     ReaderWriterLock *_lock;
+    InflightTable *_inflight; //NULL when blocks are not deduplicated across processes
+
+    std::mutex _destMutex;
+    std::unordered_map<uint64_t, Request *> _dests; //Blocks received straight into a caller's buffer, by request id and block
+
+    std::mutex _pendingMutex;
+    std::unordered_map<uint64_t, std::shared_ptr<PendingTransfer>> _pending; //Queued prefetch transfers by file and block, so a demand read can promote them
 };
 
 #endif /* NETWORKCACHE_H */
@@ -75,6 +75,7 @@
 #ifndef OutputFile_H_
 #define OutputFile_H_
 #include <atomic>
+#include <map>
 #include <mutex>
 #include <string>
 
@@ -91,12 +92,23 @@ class OutputFile : public TazerFile {
     void close();
 
     ssize_t read(void *buf, size_t count, uint32_t index);
+    ssize_t pread(void *buf, size_t count, uint64_t offset, uint32_t index);
+    ssize_t readv(const struct iovec *iov, int iovcnt, uint32_t index);
+    ssize_t preadv(const struct iovec *iov, int iovcnt, uint64_t offset, uint32_t index);
     ssize_t write(const void *buf, size_t count, uint32_t index);
 
     off_t seek(off_t offset, int whence, uint32_t index);
     uint64_t fileSize();
 
   private:
+    //A buffer ready to go out, sent in seqNum order
+    struct PendingWrite {
+        char *buf;
+        uint64_t size;
+        uint64_t compSize;
+        uint64_t fp;
+    };
+
     bool openFileOnServer();
     bool closeFileOnServer();
     uint64_t fileSizeFromServer();
@@ -104,6 +116,11 @@ class OutputFile : public TazerFile {
     uint64_t compress(char **buffer, uint64_t offset, uint64_t size);
     void addTransferTask(char *buf, uint64_t size, uint64_t compSize, uint64_t fp, uint32_t seqNum);
     void addCompressTask(char *buf, uint64_t size, uint64_t fp, uint32_t seqNum);
+    bool nextReady(uint32_t &seqNum, PendingWrite &write);
+    void sendReady();
+    void sendWrite(char *buf, uint64_t size, uint64_t compSize, uint64_t fp, uint32_t seqNum);
+    bool recvWriteAck();
+    void drainWrites();
 
     bool trackWrites(size_t count, uint32_t index, uint32_t startBlock, uint32_t endBlock);
     //    void compress(CompressionWorkArgs task);
@@ -115,6 +132,13 @@ class OutputFile : public TazerFile {
     std::atomic_uint _sendNum;
     std::mutex _openCloseLock;
 
+    std::mutex _readyLock;                   //Only protects _ready so buffers can be queued while we send
+    std::map<uint32_t, PendingWrite> _ready; //Compressed (or not) buffers waiting for their turn
+    std::mutex _sendLock;                    //Protects everything below
+    uint32_t _numUnacked;                    //Writes sent since the last cumulative ack
+    uint32_t _lastSent;
+    bool _writeFailed; //A write never made it to the server, close reports it
+
     char *_buffer;
     uint64_t _bufferIndex;
     uint64_t _bufferFp;
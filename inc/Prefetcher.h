@@ -82,6 +82,8 @@
 #define NONE 0
 #define DELTA 1
 #define PERFECT 2
+#define STRIDE 3
+#define MARKOV 4
 
 //TODO: Store some stats?
 class Prefetcher : public Loggable {
@@ -75,25 +75,55 @@
 #ifndef REQUEST_H
 #define REQUEST_H
 #include "Timer.h"
+#include <condition_variable>
+#include <mutex>
 #include <string.h>
-#include <unordered_map>
+
+#define MAX_CACHE_LEVELS 16
 
 class Cache;
+struct RequestPool;
+
+//Requests are recycled through a per-thread pool, use Request::allocate/Request::release instead of new/delete.
 struct Request {
     uint8_t *data;
+    uint8_t *dest; //Caller buffer a full block may be delivered into instead of data being allocated
     Cache *originating;
     uint32_t blkIndex;
     uint32_t fileIndex;
     uint64_t size;
     uint64_t time;
-    std::unordered_map<Cache *, uint8_t> reservedMap;
+    uint8_t reserved[MAX_CACHE_LEVELS]; //Indexed by cache level, set when that level has a reference to drop on write back
     bool ready;
-    std::string waitingCache;
+    Cache *waitingCache;
 
     // Request() : data(NULL),originating(NULL),blkIndex(0),fileIndex(0),size(0){
 
     // }
-    Request(uint32_t blk, uint32_t fileIndex, uint64_t size, Cache *orig, uint8_t *data) : data(data), originating(orig), blkIndex(blk), fileIndex(fileIndex), size(size), time(Timer::getCurrentTime()), ready(false), waitingCache("") {
-    }
+    Request(uint32_t blk, uint32_t fileIndex, uint64_t size, Cache *orig, uint8_t *data);
+
+    // A request that isn't ready when requestBlock returns is finished one of two ways: whoever
+    // delivers the block calls complete(), or the level that can only get it by waiting (e.g. on a
+    // reservation someone else holds) defers to the waiter, which then does the waiting in wait().
+    void defer(Cache *cache, int64_t arg);
+    void complete();
+    Request *wait();
+
+    static Request *allocate(uint32_t blk, uint32_t fileIndex, uint64_t size, Cache *orig, uint8_t *data);
+    static void release(Request *req);
+
+  private:
+    void reset(uint32_t blk, uint32_t fileIndex, uint64_t size, Cache *orig, uint8_t *data);
+
+    Cache *_deferred;
+    int64_t _deferredArg;
+    bool _done;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+
+    RequestPool *_pool; //Pool this request goes back to
+    Request *_nextFree;
+
+    friend struct RequestPool;
 };
 #endif //REQUEST_H
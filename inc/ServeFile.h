@@ -84,6 +84,7 @@
 #include <string>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
@@ -91,6 +92,7 @@
 
 #include "BlockCache.h"
 #include "Cache.h"
+#include "CompressedBlockCache.h"
 #include "Connection.h"
 #include "ConnectionPool.h"
 #include "Loggable.h"
@@ -103,8 +105,9 @@ class ServeFile : public Loggable, public Trackable<std::string, ServeFile *> {
     ServeFile(std::string name, bool compress, uint64_t blkSize, uint64_t initialCompressTasks, bool output = false, bool remove = false);
     ~ServeFile();
 
-    bool transferBlk(Connection *connection, uint32_t blk);
+    bool transferBlk(Connection *connection, int socket, uint32_t blk, uint32_t id = 0);
     bool writeData(char *data, uint64_t size, uint64_t fp);
+    bool flush(bool sync = true);
 
     std::string name();
     uint64_t size();
@@ -121,9 +124,12 @@ class ServeFile : public Loggable, public Trackable<std::string, ServeFile *> {
 
   private:
     static bool addConnections();
-    uint64_t compress(uint64_t blk, uint8_t *blkData, uint8_t *&msg);
+    CompressedBlk *compress(uint32_t blk);
     void addCompressTask(uint32_t blk);
-    bool sendData(Connection *connection, uint64_t blk, Request *request);
+    Request *readBlk(uint32_t blk);
+    bool sendData(Connection *connection, int socket, uint64_t blk, uint32_t id, uint8_t *msgData, uint64_t msgSize);
+    bool writeAt(struct iovec *iov, int iovcnt, uint64_t fp);
+    bool flushPending();
 
     std::string _name;
     bool _output;
@@ -140,16 +146,20 @@ class ServeFile : public Loggable, public Trackable<std::string, ServeFile *> {
 
     ReaderWriterLock _prefetchLock;
 
-    std::mutex _fileMutex;
-    std::atomic<uint64_t> _outstandingWrites;
+    std::mutex _fileMutex; //Protects the output state below
+    int _fd;                  //Output files stay open until the ServeFile goes away
+    std::vector<char> _pending; //Adjacent writes not yet handed to the file
+    uint64_t _pendingFp;
+    bool _dirty; //Written since the last fdatasync
 
     static Cache _cache;
+    static CompressedBlockCache _compCache;
     uint32_t _regFileIndex;
     static ThreadPool<std::function<void()>> _pool;
 
     static std::vector<Connection *> _connections;
-    static PriorityThreadPool<std::packaged_task<std::shared_future<Request *>()>> _transferPool;
-    static PriorityThreadPool<std::packaged_task<Request *()>> _decompressionPool;
+    static WorkStealingThreadPool<std::function<void()>> _transferPool;
+    static WorkStealingThreadPool<std::function<void()>> _decompressionPool;
     // ConnectionPool *_conPool;
 };
 
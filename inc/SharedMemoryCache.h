@@ -88,11 +88,12 @@ class SharedMemoryCache : public BoundedCache<MultiReaderWriterLock> {
   protected:
     struct MemBlockEntry : BlockEntry {
         std::atomic<uint32_t> activeCnt;
+        BlockWaitWord wait;
     };
     virtual uint8_t *getBlockData(uint32_t blockIndex);
     virtual void setBlockData(uint8_t *data, uint32_t blockIndex, uint64_t size);
-    virtual void blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t byte, int32_t prefetch = -1, std::string cacheName = SHAREDMEMORYCACHENAME);
-    virtual bool blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs = false, uint32_t cnt = 0, char *origCache = NULL);
+    virtual void blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t byte, int32_t prefetch, uint8_t origin);
+    virtual bool blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs = false, uint32_t cnt = 0, uint8_t *origin = NULL);
     virtual void readBlockEntry(uint32_t blockIndex, BlockEntry *entry);
     virtual void writeBlockEntry(uint32_t blockIndex, BlockEntry *entry);
     virtual void readBin(uint32_t binIndex, BlockEntry *entries);
@@ -101,6 +102,7 @@ class SharedMemoryCache : public BoundedCache<MultiReaderWriterLock> {
     virtual int incBlkCnt(uint32_t blk);
     virtual int decBlkCnt(uint32_t blk);
     virtual bool anyUsers(uint32_t blk);
+    virtual BlockWaitWord *blockWaitWord(uint32_t blk);
 
   private:
     MemBlockEntry *_blkIndex;
@@ -84,6 +84,7 @@
 #include <queue>
 #include <sstream>
 #include <string>
+#include <sys/uio.h>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -106,6 +107,9 @@ class TazerFile : public Loggable, public Trackable<std::string, TazerFile *> {
     virtual uint64_t fileSize() = 0;
 
     virtual ssize_t read(void *buf, size_t count, uint32_t filePosIndex = 0) = 0;
+    virtual ssize_t pread(void *buf, size_t count, uint64_t offset, uint32_t filePosIndex = 0) = 0;
+    virtual ssize_t readv(const struct iovec *iov, int iovcnt, uint32_t filePosIndex = 0) = 0;
+    virtual ssize_t preadv(const struct iovec *iov, int iovcnt, uint64_t offset, uint32_t filePosIndex = 0) = 0;
     virtual ssize_t write(const void *buf, size_t count, uint32_t filePosIndex = 0) = 0;
 
     uint32_t newFilePosIndex();
@@ -117,6 +121,7 @@ class TazerFile : public Loggable, public Trackable<std::string, TazerFile *> {
     static bool removeTazerFile(std::string fileName);
     static bool removeTazerFile(TazerFile *file);
     static TazerFile *lookUpTazerFile(std::string fileName);
+    static bool closeFailed();
 
     TazerFile::Type type();
     std::string name();
@@ -141,6 +146,7 @@ class TazerFile : public Loggable, public Trackable<std::string, TazerFile *> {
     //Properties from meta data file
     bool _compress;
     uint32_t _prefetch; //Adding the option to prefetch or not a particular file
+    bool _wholeFile; //Fetch every block at open, a 'w' after the prefetch field (e.g. 0w)
     bool _save_local; //Not used yet
     uint64_t _blkSize;
 
@@ -149,6 +155,8 @@ class TazerFile : public Loggable, public Trackable<std::string, TazerFile *> {
     std::atomic_bool _active; //if the connections are up
     std::vector<Connection *> _connections;
 
+    static thread_local bool _closeFailed; //Set by a close that lost writes, see closeFailed
+
   private:
     int _fd;
 };
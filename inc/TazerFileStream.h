@@ -76,26 +76,48 @@
 #define TAZERFILESTREAM_H
 
 #include "ReaderWriterLock.h"
+#include "TazerFile.h"
 #include "Trackable.h"
 #include <stdio.h>
 
+//A FILE* opened on a TazerFile. Reads are served out of a single buffered block so fgetc/fgets
+//don't walk the cache hierarchy per call. The stream position lives in the TazerFile's file position,
+//so the buffer never goes stale when the fd is seeked underneath us.
 class TazerFileStream : public Trackable<FILE *, TazerFileStream *> {
   public:
-    static bool addStream(FILE *fp, int fd);
+    static bool addStream(FILE *fp, int fd, TazerFile *file, unsigned int index);
     static bool removeStream(FILE *fp);
-    static int lookupStream(FILE *fp, ReaderWriterLock *&lock);
+    static TazerFileStream *lookupStream(FILE *fp);
 
     ReaderWriterLock *getLock();
     int getFileDescriptor();
+    TazerFile *getTazerFile();
+    unsigned int getFilePosIndex();
 
-    TazerFileStream(int fd);
+    size_t read(void *ptr, size_t count);
+    int getc();
+    char *gets(char *s, int n);
+    long int tell();
+    bool eof();
+    void clearEof();
+
+    TazerFileStream(int fd, TazerFile *file, unsigned int index);
     ~TazerFileStream();
 
     static bool init;
 
   private:
+    bool fill(uint64_t pos);
+
     int tazerFileDescriptor;
+    TazerFile *_file;
+    unsigned int _index;
     ReaderWriterLock lock;
+
+    char *_buf;
+    uint64_t _bufStart; //file offset of _buf[0]
+    uint64_t _bufLen;
+    bool _eof;
 };
 
 #endif /* TAZERFILESTREAM_H */
@@ -94,7 +94,8 @@ class UnboundedCache : public Cache {
 
     virtual bool writeBlock(Request* req);
 
-    virtual void readBlock(Request* req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request*>>> &reads, uint64_t priority);
+    virtual void readBlock(Request* req, uint64_t priority);
+    virtual void finishRequest(Request* req, int64_t reserved);
 
     virtual void addFile(uint32_t index, std::string filename, uint64_t blockSize, std::uint64_t fileSize);
 
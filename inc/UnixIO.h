@@ -117,4 +117,10 @@ typedef int (*unixfeof_t)(FILE *fp);
 
 typedef ssize_t (*unixreadv_t)(int fd, const struct iovec *iov, int iovcnt);
 typedef ssize_t (*unixwritev_t)(int fd, const struct iovec *iov, int iovcnt);
+
+typedef ssize_t (*unixpread_t)(int fd, void *buf, size_t count, off_t offset);
+typedef ssize_t (*unixpread64_t)(int fd, void *buf, size_t count, off64_t offset);
+typedef ssize_t (*unixpreadv_t)(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+typedef ssize_t (*unixpreadv64_t)(int fd, const struct iovec *iov, int iovcnt, off64_t offset);
+typedef ssize_t (*unixpwrite_t)(int fd, const void *buf, size_t count, off_t offset);
 #endif /* UNIXIO_H_ */
\ No newline at end of file
@@ -85,6 +85,7 @@
 #include "FileCacheRegister.h"
 #include "FilelockCache.h"
 #include "LocalFileCache.h"
+#include "MarkovPrefetcher.h"
 #include "MemoryCache.h"
 #include "Message.h"
 #include "NetworkCache.h"
@@ -92,6 +93,7 @@
 #include "Prefetcher.h"
 #include "Request.h"
 #include "SharedMemoryCache.h"
+#include "StridePrefetcher.h"
 #include "Timer.h"
 #include "UnixIO.h"
 #include "lz4.h"
@@ -119,8 +121,8 @@
 
 std::once_flag init_flag;
 
-PriorityThreadPool<std::packaged_task<std::shared_future<Request *>()>> InputFile::_transferPool(Config::numClientTransThreads, "transfer pool");
-PriorityThreadPool<std::packaged_task<Request *()>> InputFile::_decompressionPool(Config::numClientDecompThreads, "decompress pool");
+WorkStealingThreadPool<std::function<void()>> InputFile::_transferPool(Config::numClientTransThreads, "transfer pool");
+WorkStealingThreadPool<std::function<void()>> InputFile::_decompressionPool(Config::numClientDecompThreads, "decompress pool");
 
 Cache *InputFile::_cache = NULL; //(BASECACHENAME);
 
@@ -143,7 +145,7 @@ void /*__attribute__((constructor))*/ InputFile::cache_init(void) {
     }
 
     if (Config::useBurstBufferCache) {
-        c = FileCache::addNewFileCache("burstbuffer", Config::burstBufferCacheSize, Config::burstBufferCacheBlocksize, Config::burstBufferCacheAssociativity, Config::burstBufferCacheFilePath);
+        c = FileCache::addNewFileCache(BURSTBUFFERCACHENAME, Config::burstBufferCacheSize, Config::burstBufferCacheBlocksize, Config::burstBufferCacheAssociativity, Config::burstBufferCacheFilePath);
         std::cerr << "[TAZER] "
                   << "bb cache: " << (void *)c << std::endl;
         InputFile::_cache->addCacheLevel(c, ++level);
@@ -229,6 +231,16 @@ InputFile::InputFile(std::string name, std::string metaName, int fd, bool openFi
         log(this) << "[TAZER] "
                   << "Perfect prefetcher" << std::endl;
         break;
+    case STRIDE:
+        _prefetcher = new StridePrefetcher("STRIDEPREFETCHER", _cache->getCacheByTier(Cache::tierId(NETWORKCACHENAME)));
+        log(this) << "[TAZER] "
+                  << "Stride prefetcher" << std::endl;
+        break;
+    case MARKOV:
+        _prefetcher = new MarkovPrefetcher("MARKOVPREFETCHER", name);
+        log(this) << "[TAZER] "
+                  << "Markov prefetcher" << std::endl;
+        break;
     default:
         std::cerr << "[TAZER] "
                   << "Prefetcher doesn't exist" << std::endl;
@@ -239,6 +251,7 @@ InputFile::InputFile(std::string name, std::string metaName, int fd, bool openFi
 InputFile::~InputFile() {
     log(this) << "Destroying file " << _metaName << std::endl;
     close();
+    delete _prefetcher;
 }
 
 void InputFile::open() {
@@ -275,6 +288,11 @@ void InputFile::open() {
                         nc->setFileCompress(_regFileIndex, _compress);
                         nc->setFileConnectionPool(_regFileIndex, pool);
                     }
+
+                    //Small files cost more in round trips than in data, ask for all of it now
+                    if (_wholeFile || _fileSize <= Config::wholeFileFetchSize) {
+                        _cache->prefetchFile(_fileSize, _blkSize, _regFileIndex);
+                    }
                 }
 
                 DPRINTF("REG: %p\n", reg);
@@ -298,38 +316,68 @@ void InputFile::close() {
     bool prev = true;
     if (_active.compare_exchange_strong(prev, false)) {
         DPRINTF("CLOSE: _FC: %p _BC: %p\n", _fc, _bc);
+        Cache::cancelPrefetches(_regFileIndex);
     }
     lock.unlock();
     // std::cout << "Closing file " << _name << std::endl;
 }
 
-uint64_t InputFile::copyBlock(char *buf, char *blkBuf, uint32_t blk, uint32_t startBlock, uint32_t endBlock, uint32_t fpIndex, uint64_t count) {
-    uint32_t blkOneSize = _blkSize - (_filePos[fpIndex] % _blkSize);
-    uint32_t localStart = ((blk - startBlock - 1) * _blkSize) + blkOneSize;
+//Copies len bytes of src to position pos of the buffer formed by concatenating iov
+void InputFile::scatter(const struct iovec *iov, int iovcnt, uint64_t pos, char *src, uint64_t len) {
+    for (int i = 0; i < iovcnt && len; i++) {
+        if (pos >= iov[i].iov_len) {
+            pos -= iov[i].iov_len;
+            continue;
+        }
+        uint64_t amt = std::min((uint64_t)iov[i].iov_len - pos, len);
+        memcpy((char *)iov[i].iov_base + pos, src, amt);
+        src += amt;
+        len -= amt;
+        pos = 0;
+    }
+}
+
+//Returns where pos lands in iov if the len bytes from there are contiguous in a single iovec, otherwise NULL
+uint8_t *InputFile::contiguous(const struct iovec *iov, int iovcnt, uint64_t pos, uint64_t len) {
+    for (int i = 0; i < iovcnt; i++) {
+        if (pos < iov[i].iov_len) {
+            return (pos + len <= iov[i].iov_len) ? (uint8_t *)iov[i].iov_base + pos : NULL;
+        }
+        pos -= iov[i].iov_len;
+    }
+    return NULL;
+}
+
+uint64_t InputFile::copyBlock(const struct iovec *iov, int iovcnt, char *blkBuf, uint32_t blk, uint32_t startBlock, uint32_t endBlock, uint64_t offset, uint64_t count) {
+    uint32_t blkOneSize = _blkSize - (offset % _blkSize);
+    uint64_t localStart = ((uint64_t)(blk - startBlock - 1) * _blkSize) + blkOneSize;
     uint32_t startFP = 0;
     uint32_t localSize = _blkSize;
 
     if (blk == startBlock && blk + 1 == endBlock) {
         localStart = 0;
-        startFP = (_filePos[fpIndex] % _blkSize);
+        startFP = (offset % _blkSize);
         localSize = count;
     }
     else if (blk == startBlock) {
         localStart = 0;
-        startFP = (_filePos[fpIndex] % _blkSize);
+        startFP = (offset % _blkSize);
         localSize -= startFP;
     }
     else if (blk + 1 == endBlock) {
-        uint32_t temp = (_filePos[fpIndex] + count) % _blkSize;
+        uint32_t temp = (offset + count) % _blkSize;
         if (temp)
             localSize = temp;
     }
     // std::cout << "localstart: " << localStart << " startFP: " << startFP << " localsize: " << localSize << std::endl;
-    memcpy(&buf[localStart], &blkBuf[startFP], localSize);
+    if (iovcnt == 1)
+        memcpy((char *)iov[0].iov_base + localStart, &blkBuf[startFP], localSize);
+    else
+        scatter(iov, iovcnt, localStart, &blkBuf[startFP], localSize);
     return localSize;
 }
 
-bool InputFile::trackRead(size_t count, uint32_t index, uint32_t startBlock, uint32_t endBlock) {
+bool InputFile::trackRead(size_t count, uint64_t offset, uint32_t startBlock, uint32_t endBlock) {
     if (Config::TrackReads) {
         unixopen_t unixopen = (unixopen_t)dlsym(RTLD_NEXT, "open");
         unixclose_t unixclose = (unixclose_t)dlsym(RTLD_NEXT, "close");
@@ -338,7 +386,7 @@ bool InputFile::trackRead(size_t count, uint32_t index, uint32_t startBlock, uin
         int fd = (*unixopen)("access_new.txt", O_WRONLY | O_APPEND | O_CREAT, 0660);
         if (fd != -1) {
             std::stringstream ss;
-            ss << _name << " " << _filePos[index] << " " << count << " " << startBlock << " " << endBlock << std::endl;
+            ss << _name << " " << offset << " " << count << " " << startBlock << " " << endBlock << std::endl;
             unixwrite(fd, ss.str().c_str(), ss.str().length());
             unixclose(fd);
             return true;
@@ -348,65 +396,104 @@ bool InputFile::trackRead(size_t count, uint32_t index, uint32_t startBlock, uin
 }
 
 ssize_t InputFile::read(void *buf, size_t count, uint32_t index) {
+    struct iovec iov = {buf, count};
+    return readv(&iov, 1, index);
+}
+
+ssize_t InputFile::readv(const struct iovec *iov, int iovcnt, uint32_t index) {
+    uint64_t offset = _filePos[index];
+    ssize_t ret = preadv(iov, iovcnt, offset, index);
+    if (ret > 0) {
+        _filePos[index] = offset + ret;
+    }
+    else if (_active.load() && offset >= _fileSize) {
+        _eof = true;
+    }
+    return ret;
+}
+
+ssize_t InputFile::pread(void *buf, size_t count, uint64_t offset, uint32_t index) {
+    struct iovec iov = {buf, count};
+    return preadv(&iov, 1, offset, index);
+}
+
+//Reads at offset without touching the file position, so any number of threads can be in here on the same fd.
+//Every block covered by every iovec is requested in one pass and waited on together.
+ssize_t InputFile::preadv(const struct iovec *iov, int iovcnt, uint64_t offset, uint32_t index) {
     if (_active.load() && _numBlks) {
         _cache->stats.start(); // "read" timer
         _cache->stats.start(); // "hit"  timer
         _cache->stats.start(); // "ovh" timer
 
-        if (_filePos[index] >= _fileSize) {
-            log(this) << "[TAZER] " << _name << " " << _filePos[index] << " " << _fileSize << " " << count << std::endl;
-            _eof = true;
+        size_t count = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            count += iov[i].iov_len;
+        }
+
+        if (offset >= _fileSize) {
+            log(this) << "[TAZER] " << _name << " " << offset << " " << _fileSize << " " << count << std::endl;
             _cache->stats.end(false, CacheStats::Metric::ovh);
             _cache->stats.end(false, CacheStats::Metric::hits);
             _cache->stats.end(false, CacheStats::Metric::read);
             return 0;
         }
 
-        char *localPtr = (char *)buf;
-        if ((uint64_t)count > _fileSize - _filePos[index]) {
-            count = _fileSize - _filePos[index];
+        if ((uint64_t)count > _fileSize - offset) {
+            count = _fileSize - offset;
         }
 
-        uint32_t startBlock = _filePos[index] / _blkSize;
-        uint32_t endBlock = ((_filePos[index] + count) / _blkSize);
+        uint32_t startBlock = offset / _blkSize;
+        uint32_t endBlock = ((offset + count) / _blkSize);
 
-        if (((_filePos[index] + count) % _blkSize)) {
+        if (((offset + count) % _blkSize)) {
             endBlock++;
         }
         if (endBlock > _numBlks) {
             endBlock = _numBlks;
         }
-        // std::cerr << "[TAZER] " << Timer::printTime() << _name << " " << _filePos[index] << " " << _fileSize << " " << count << " " << startBlock << " " << endBlock << std::endl;
+        // std::cerr << "[TAZER] " << Timer::printTime() << _name << " " << offset << " " << _fileSize << " " << count << " " << startBlock << " " << endBlock << std::endl;
 
-        trackRead(count, index, startBlock, endBlock);
+        trackRead(count, offset, startBlock, endBlock);
         bool error = false;
-        std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> reads;
-        std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> net_reads;
-        std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> local_reads;
+        std::vector<std::pair<uint32_t, Request *>> net_reads;
+        std::vector<std::pair<uint32_t, Request *>> local_reads;
+        std::vector<std::future<bool>> populating;
         uint64_t priority = 0;
+        _cache->beginRequestBatch(); //Contiguous misses go out as one range request
         for (uint32_t blk = startBlock; blk < endBlock; blk++) {
+            //A full block that lands whole in one iovec can be received (or decompressed) straight into it
+            uint64_t blkOffset = (uint64_t)blk * _blkSize;
+            uint8_t *dest = NULL;
+            if (blkOffset >= offset && blkOffset + _blkSize <= offset + count) {
+                dest = contiguous(iov, iovcnt, blkOffset - offset, _blkSize);
+            }
             _cache->stats.end(false, CacheStats::Metric::ovh);
-            auto request = _cache->requestBlock(blk, _blkSize, _regFileIndex, reads, priority);
+            auto request = _cache->requestBlock(blk, _blkSize, _regFileIndex, priority, dest);
             _cache->stats.start(); //ovh
             if (request->ready) {  //the block was in a client side cache!!
-                auto amt = copyBlock(localPtr, (char *)request->data, blk, startBlock, endBlock, index, count);
+                bool inPlace = request->dest && request->data == request->dest;
+                auto amt = (inPlace) ? _blkSize : copyBlock(iov, iovcnt, (char *)request->data, blk, startBlock, endBlock, offset, count);
                 request->originating->stats.addAmt(false, CacheStats::Metric::read, amt);
-                _cache->bufferWrite(request);
+                if (inPlace)
+                    populating.push_back(_cache->writeBlockAsync(request));
+                else
+                    _cache->bufferWrite(request);
             }
             else {
                 if (request->originating->name() == NETWORKCACHENAME) {
-                    net_reads.insert(std::make_pair(blk, reads[blk]));
+                    net_reads.emplace_back(blk, request);
                 }
                 else {
-                    local_reads.insert(std::make_pair(blk, reads[blk]));
+                    local_reads.emplace_back(blk, request);
                 }
             }
         }
+        _cache->endRequestBatch();
 
         //If prefetching is enabled for this file
         if (_prefetcher != NULL) {
-            //Get list of blocks to be prefetched
-            std::vector<uint64_t> blocks = _prefetcher->getBlocks(index, startBlock, endBlock, Config::numPrefetchBlks, _blkSize, _fileSize.load());
+            //Get list of blocks to be prefetched, as many as the file's prefetches have earned
+            std::vector<uint64_t> blocks = _prefetcher->getBlocks(index, startBlock, endBlock, Cache::prefetchWindow(_regFileIndex), _blkSize, _fileSize.load());
 
             if (!blocks.empty()) {
                 _cache->prefetchBlocks(index, blocks, _fileSize.load(), _blkSize, _regFileIndex);
@@ -419,16 +506,21 @@ ssize_t InputFile::read(void *buf, size_t count, uint32_t index) {
             _cache->stats.end(false, CacheStats::Metric::ovh);
             auto stallTime = Timer::getCurrentTime();
 
-            auto request = (*it).second.get().get(); //need to do two gets cause we cant chain futures properly yet (c++ 2x supposedly)
+            auto request = (*it).second->wait();
+            Cache *waiting = (request->waitingCache) ? request->waitingCache : request->originating;
 
-            _cache->getCacheByName(request->waitingCache)->stats.addTime(0, CacheStats::Metric::stalls, Timer::getCurrentTime() - stallTime, 1);
+            waiting->stats.addTime(0, CacheStats::Metric::stalls, Timer::getCurrentTime() - stallTime, 1);
             request->originating->stats.addTime(0, CacheStats::Metric::stalled, Timer::getCurrentTime() - stallTime, 1);
             _cache->stats.start(); //ovh
             if (request->ready) {  // hmm what does it mean if this is NULL? do we need to catch and report this?
-                auto amt = copyBlock(localPtr, (char *)request->data, blk, startBlock, endBlock, index, count);
-                _cache->getCacheByName(request->waitingCache)->stats.addAmt(0, CacheStats::Metric::stalls, amt);
+                bool inPlace = request->dest && request->data == request->dest;
+                auto amt = (inPlace) ? _blkSize : copyBlock(iov, iovcnt, (char *)request->data, blk, startBlock, endBlock, offset, count);
+                waiting->stats.addAmt(0, CacheStats::Metric::stalls, amt);
                 request->originating->stats.addAmt(false, CacheStats::Metric::stalled, amt);
-                _cache->bufferWrite(request);
+                if (inPlace) //Fill the caches from buf while we wait on the other blocks
+                    populating.push_back(_cache->writeBlockAsync(request));
+                else
+                    _cache->bufferWrite(request);
             }
         }
         for (auto it = local_reads.begin(); it != local_reads.end(); ++it) {
@@ -436,20 +528,26 @@ ssize_t InputFile::read(void *buf, size_t count, uint32_t index) {
             _cache->stats.end(false, CacheStats::Metric::ovh);
             auto stallTime = Timer::getCurrentTime();
 
-            auto request = (*it).second.get().get(); //need to do two gets cause we cant chain futures properly yet (c++ 2x supposedly)
+            auto request = (*it).second->wait();
+            Cache *waiting = (request->waitingCache) ? request->waitingCache : request->originating;
 
-            _cache->getCacheByName(request->waitingCache)->stats.addTime(false, CacheStats::Metric::stalls, Timer::getCurrentTime() - stallTime, 1);
+            waiting->stats.addTime(false, CacheStats::Metric::stalls, Timer::getCurrentTime() - stallTime, 1);
             request->originating->stats.addTime(false, CacheStats::Metric::stalled, Timer::getCurrentTime() - stallTime, 1);
             _cache->stats.start(); //ovh
             if (request->ready) {  // hmm what does it mean if this is NULL? do we need to catch and report this?
-                auto amt = copyBlock(localPtr, (char *)request->data, blk, startBlock, endBlock, index, count);
-                _cache->getCacheByName(request->waitingCache)->stats.addAmt(false, CacheStats::Metric::stalls, amt);
+                bool inPlace = request->dest && request->data == request->dest;
+                auto amt = (inPlace) ? _blkSize : copyBlock(iov, iovcnt, (char *)request->data, blk, startBlock, endBlock, offset, count);
+                waiting->stats.addAmt(false, CacheStats::Metric::stalls, amt);
                 request->originating->stats.addAmt(false, CacheStats::Metric::stalled, amt);
-                _cache->bufferWrite(request);
+                if (inPlace)
+                    populating.push_back(_cache->writeBlockAsync(request));
+                else
+                    _cache->bufferWrite(request);
             }
         }
-
-        _filePos[index] += count;
+        for (auto &populated : populating) { //buf is the caller's again once we return
+            populated.wait();
+        }
 
         _cache->stats.addAmt(false, CacheStats::Metric::hits, _blkSize);
         _cache->stats.addAmt(false, CacheStats::Metric::read, count);
@@ -484,6 +582,7 @@ uint64_t InputFile::fileSize() {
 //TODO: handle for if there is the local file present...
 off_t InputFile::seek(off_t offset, int whence, uint32_t index) {
     // std::cout << "seek: " << _name << " " << offset << " " << whence << " " << index << std::endl;
+    uint64_t prevPos = _filePos[index];
     switch (whence) {
     case SEEK_SET:
         _filePos[index] = offset;
@@ -499,6 +598,12 @@ off_t InputFile::seek(off_t offset, int whence, uint32_t index) {
         break;
     }
 
+    //Jumping further than we prefetch ahead makes whatever is still queued useless
+    uint64_t jump = (_filePos[index] > prevPos) ? _filePos[index] - prevPos : prevPos - _filePos[index];
+    if (_prefetcher && _blkSize && jump > (Cache::prefetchWindow(_regFileIndex) + 1) * _blkSize) {
+        Cache::cancelPrefetches(_regFileIndex, index); //Other readers of the file still want theirs
+    }
+
     _eof = false;
     return _filePos[index];
 }
@@ -74,6 +74,7 @@
 
 #include "Config.h"
 #include "ConnectionPool.h"
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
 #include <fcntl.h>
@@ -84,11 +85,13 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <unordered_set>
 //#include "ErrorTester.h"
 #include "InputFile.h"
+#include "MarkovPrefetcher.h"
 #include "RSocketAdapter.h"
 #include "ReaderWriterLock.h"
 #include "TazerFile.h"
@@ -108,11 +111,18 @@ bool init = false;
 ReaderWriterLock vLock;
 
 static std::unordered_set<std::string> track_files;
-static std::unordered_set<int> track_fd;
 static std::unordered_set<FILE *> track_fp;
-static std::unordered_set<int> ignore_fd;
 static std::unordered_set<FILE *> ignore_fp;
 
+//What we know about every fd that has passed through us, indexed by fd so that telling an fd is not
+//ours is a single load. fds beyond the table always take the full path.
+enum FdClass : uint8_t { FdSystem = 0,
+                         FdTazer,
+                         FdTrack,
+                         FdIgnore };
+#define FD_TABLE_SIZE 65536
+static std::atomic<uint8_t> fd_class[FD_TABLE_SIZE];
+
 unixopen_t unixopen = NULL;
 unixopen_t unixopen64 = NULL;
 unixclose_t unixclose = NULL;
@@ -144,6 +154,10 @@ unixfflush_t unixfflush = NULL;
 unixfeof_t unixfeof = NULL;
 unixreadv_t unixreadv = NULL;
 unixwritev_t unixwritev = NULL;
+unixpread_t unixpread = NULL;
+unixpread64_t unixpread64 = NULL;
+unixpreadv_t unixpreadv = NULL;
+unixpreadv64_t unixpreadv64 = NULL;
 
 void __attribute__((constructor)) tazerInit(void) {
 
@@ -187,7 +201,7 @@ void __attribute__((constructor)) tazerInit(void) {
         unixrewind = (unixrewind_t)dlsym(RTLD_NEXT, "rewind");
         unixfgetc = (unixfgetc_t)dlsym(RTLD_NEXT, "fgetc");
         unixfgets = (unixfgets_t)dlsym(RTLD_NEXT, "fgets");
-        unixfputc = (unixfputc_t)dlsym(RTLD_NEXT, "fputs");
+        unixfputc = (unixfputc_t)dlsym(RTLD_NEXT, "fputc");
         unixfputs = (unixfputs_t)dlsym(RTLD_NEXT, "fputs");
         unixflockfile = (unixflockfile_t)dlsym(RTLD_NEXT, "flockfile");
         unixftrylockfile = (unixftrylockfile_t)dlsym(RTLD_NEXT, "ftrylockfile");
@@ -196,6 +210,10 @@ void __attribute__((constructor)) tazerInit(void) {
         unixfeof = (unixfeof_t)dlsym(RTLD_NEXT, "feof");
         unixreadv = (unixreadv_t)dlsym(RTLD_NEXT, "readv");
         unixwritev = (unixwritev_t)dlsym(RTLD_NEXT, "writev");
+        unixpread = (unixpread_t)dlsym(RTLD_NEXT, "pread");
+        unixpread64 = (unixpread64_t)dlsym(RTLD_NEXT, "pread64");
+        unixpreadv = (unixpreadv_t)dlsym(RTLD_NEXT, "preadv");
+        unixpreadv64 = (unixpreadv64_t)dlsym(RTLD_NEXT, "preadv64");
 
         unsetenv("LD_PRELOAD");
         timer.end(Timer::MetricType::tazer, Timer::Metric::constructor);
@@ -220,6 +238,7 @@ void __attribute__((destructor)) tazerCleanup(void) {
         }
     }
 
+    MarkovPrefetcher::saveAll();
     delete InputFile::_cache;
 
     FileCacheRegister::closeFileCacheRegister();
@@ -270,11 +289,28 @@ inline bool checkMeta(const char *pathname, std::string &path, std::string &file
     return false;
 }
 
-inline bool trackFile(int fd) { return init ? track_fd.count(fd) : false; }
+inline uint8_t fdClass(int fd) { return (fd >= 0 && fd < FD_TABLE_SIZE) ? fd_class[fd].load(std::memory_order_acquire) : FdSystem; }
+inline void setFdClass(int fd, uint8_t cls) {
+    if (fd >= 0 && fd < FD_TABLE_SIZE)
+        fd_class[fd].store(cls, std::memory_order_release);
+}
+//Only clears if fd is still cls, a racing open may already have reused the number
+inline void clearFdClass(int fd, uint8_t cls) {
+    if (fd >= 0 && fd < FD_TABLE_SIZE)
+        fd_class[fd].compare_exchange_strong(cls, FdSystem, std::memory_order_acq_rel);
+}
+
+//True when fd is definitely not one of ours and can go straight to libc
+template <typename T>
+inline bool passThrough(T fileId) { return false; }
+inline bool passThrough(int fd) { return init && fd >= 0 && fd < FD_TABLE_SIZE && fd_class[fd].load(std::memory_order_acquire) == FdSystem; }
+inline bool passThrough(FILE *fp) { return init && fp && passThrough(fileno(fp)); }
+
+inline bool trackFile(int fd) { return init ? fdClass(fd) == FdTrack : false; }
 inline bool trackFile(FILE *fp) { return init ? track_fp.count(fp) : false; }
 inline bool trackFile(const char *name) { return init ? track_files.count(name) : false; }
 
-inline bool ignoreFile(uint64_t fd) { return init ? ignore_fd.count(fd) : false; }
+inline bool ignoreFile(int fd) { return init ? fdClass(fd) == FdIgnore : false; }
 inline bool ignoreFile(FILE *fp) { return init ? ignore_fp.count(fp) : false; }
 inline bool ignoreFile(std::string pathname) {
     if (init) {
@@ -313,15 +349,12 @@ inline auto innerWrapper(int fd, bool &isTazerFile, Func tazerFun, FuncLocal loc
 template <typename Func, typename FuncLocal, typename... Args>
 inline auto innerWrapper(FILE *fp, bool &isTazerFile, Func tazerFun, FuncLocal localFun, Args... args) {
     if (init) {
-        ReaderWriterLock *lock = NULL;
-        int fd = TazerFileStream::lookupStream(fp, lock);
-        if (fd != -1) {
+        TazerFileStream *stream = TazerFileStream::lookupStream(fp);
+        if (stream) {
             isTazerFile = true;
+            ReaderWriterLock *lock = stream->getLock();
             lock->writerLock();
-            TazerFile *file = NULL;
-            unsigned int pos = 0;
-            TazerFileDescriptor::lookupTazerFileDescriptor(fd, file, pos);
-            auto ret = tazerFun(file, pos, fd, args...);
+            auto ret = tazerFun(stream, args...);
             lock->writerUnlock();
             removeFileStream(localFun, fp);
             return ret;
@@ -342,26 +375,15 @@ inline auto innerWrapper(const char *pathname, bool &isTazerFile, Func tazerFun,
     return posixFun(args...);
 }
 
-template <typename T1, typename T2>
-inline void addToSet(std::unordered_set<int> &set, T1 value, T2 posixFun) {}
-inline void addToSet(std::unordered_set<int> &set, int value, unixopen_t posixFun) {
+template <typename T1, typename T2, typename T3>
+inline void classifyFd(T1 fileId, T2 value, T3 posixFun, uint8_t cls) {}
+inline void classifyFd(const char *pathname, int value, unixopen_t posixFun, uint8_t cls) {
     if (posixFun == unixopen || posixFun == unixopen64)
-        set.emplace(value);
-}
-inline void addToSet(std::unordered_set<FILE *> &set, FILE *value, unixfopen_t posixFun) {
-    if (posixFun == unixfopen)
-        set.emplace(value);
+        setFdClass(value, cls);
 }
-
-template <typename T1, typename T2>
-inline void removeFromSet(std::unordered_set<int> &set, T1 value, T2 posixFun) {}
-inline void removeFromSet(std::unordered_set<int> &set, int value, unixclose_t posixFun) {
+inline void classifyFd(int fd, int value, unixclose_t posixFun, uint8_t cls) {
     if (posixFun == unixclose)
-        set.erase(value);
-}
-inline void removeFromSet(std::unordered_set<FILE *> &set, FILE *value, unixfclose_t posixFun) {
-    if (posixFun == unixfclose)
-        set.erase(value);
+        clearFdClass(fd, cls);
 }
 
 template <typename FileId, typename Func, typename FuncPosix, typename... Args>
@@ -370,6 +392,9 @@ auto outerWrapper(const char *name, FileId fileId, Timer::Metric metric, Func ta
         posixFun = (FuncPosix)dlsym(RTLD_NEXT, name);
         return posixFun(args...);
     }
+    if (passThrough(fileId)) {
+        return posixFun(args...);
+    }
 
     timer.start();
 
@@ -386,16 +411,14 @@ auto outerWrapper(const char *name, FileId fileId, Timer::Metric metric, Func ta
     auto retValue = innerWrapper(fileId, isTazerFile, tazerFun, posixFun, args...);
 
     if (ignore) {
-        //Maintain the ignore_fd set
-        addToSet(ignore_fd, retValue, posixFun);
-        removeFromSet(ignore_fd, retValue, posixFun);
+        //Maintain the fd table
+        classifyFd(fileId, retValue, posixFun, FdIgnore);
         timer.end(Timer::MetricType::local, Timer::Metric::dummy); //to offset the call to start()
     }
     else { //End Timers!
         if (track) {
-            //Maintain the track_fd set
-            addToSet(track_fd, retValue, posixFun);
-            removeFromSet(track_fd, retValue, posixFun);
+            //Maintain the fd table
+            classifyFd(fileId, retValue, posixFun, FdTrack);
             timer.end(Timer::MetricType::local, metric);
         }
         else if (isTazerFile)
@@ -412,8 +435,10 @@ int tazerOpen(std::string name, std::string metaName, TazerFile::Type type, cons
     DPRINTF("tazerOpen: %s %s %u\n", name.c_str(), metaName.c_str(), type);
     int fd = (*unixopen64)(metaName.c_str(), O_RDONLY, 0);
     TazerFile *file = TazerFile::addNewTazerFile(type, name, metaName, fd);
-    if (file)
+    if (file) {
         TazerFileDescriptor::addTazerFileDescriptor(fd, file, file->newFilePosIndex());
+        setFdClass(fd, FdTazer);
+    }
     return fd;
 }
 
@@ -440,9 +465,15 @@ int open64(const char *pathname, int flags, ...) {
 }
 
 int tazerClose(TazerFile *file, unsigned int fp, int fd) {
+    clearFdClass(fd, FdTazer);
     TazerFile::removeTazerFile(file);
     TazerFileDescriptor::removeTazerFileDescriptor(fd);
-    return (*unixclose)(fd);
+    int ret = (*unixclose)(fd);
+    if (TazerFile::closeFailed()) { //Closing the file lost some of its writes
+        errno = EIO;
+        ret = -1;
+    }
+    return ret;
 }
 
 int close(int fd) {
@@ -456,12 +487,34 @@ ssize_t tazerRead(TazerFile *file, unsigned int fp, int fd, void *buf, size_t co
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
+    if (passThrough(fd))
+        return unixread(fd, buf, count);
     vLock.readerLock();
     auto ret = outerWrapper("read", fd, Timer::Metric::read, tazerRead, unixread, fd, buf, count);
     vLock.readerUnlock();
     return ret;
 }
 
+//Positional reads leave the file position alone, so they don't need vLock and can run side by side on one fd
+template <typename T>
+ssize_t tazerPread(TazerFile *file, unsigned int fp, int fd, void *buf, size_t count, T offset) {
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ssize_t ret = file->pread(buf, count, offset, fp);
+    timer.addAmt(Timer::MetricType::tazer, Timer::Metric::read, ret);
+    return ret;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    return outerWrapper("pread", fd, Timer::Metric::read, tazerPread<off_t>, unixpread, fd, buf, count, offset);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off64_t offset) {
+    return outerWrapper("pread64", fd, Timer::Metric::read, tazerPread<off64_t>, unixpread64, fd, buf, count, offset);
+}
+
 ssize_t tazerWrite(TazerFile *file, unsigned int fp, int fd, const void *buf, size_t count) {
     auto ret = file->write(buf, count, fp);
     timer.addAmt(Timer::MetricType::tazer, Timer::Metric::write, ret);
@@ -469,6 +522,8 @@ ssize_t tazerWrite(TazerFile *file, unsigned int fp, int fd, const void *buf, si
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
+    if (passThrough(fd))
+        return unixwrite(fd, buf, count);
     vLock.readerLock();
     auto ret = outerWrapper("write", fd, Timer::Metric::write, tazerWrite, unixwrite, fd, buf, count);
     vLock.readerUnlock();
@@ -481,6 +536,8 @@ T tazerLseek(TazerFile *file, unsigned int fp, int fd, T offset, int whence) {
 }
 
 off_t lseek(int fd, off_t offset, int whence) {
+    if (passThrough(fd))
+        return unixlseek(fd, offset, whence);
     vLock.readerLock();
     auto ret = outerWrapper("lseek", fd, Timer::Metric::seek, tazerLseek<off_t>, unixlseek, fd, offset, whence);
     vLock.readerUnlock();
@@ -488,6 +545,8 @@ off_t lseek(int fd, off_t offset, int whence) {
 }
 
 off64_t lseek64(int fd, off64_t offset, int whence) {
+    if (passThrough(fd))
+        return unixlseek64(fd, offset, whence);
     vLock.readerLock();
     auto ret = outerWrapper("lseek64", fd, Timer::Metric::seek, tazerLseek<off64_t>, unixlseek64, fd, offset, whence);
     vLock.readerUnlock();
@@ -540,6 +599,8 @@ int tazerFsync(TazerFile *file, unsigned int fp, int fd) {
 }
 
 int fsync(int fd) {
+    if (passThrough(fd))
+        return unixfsync(fd);
     vLock.readerLock();
     auto ret = outerWrapper("fsync", fd, Timer::Metric::stat, tazerFsync, unixfsync, fd);
     vLock.readerUnlock();
@@ -563,26 +624,57 @@ ssize_t tazerVector(const char *name, Timer::Metric metric, Func tazerFun, FuncL
     return ret;
 }
 
+ssize_t tazerReadv(TazerFile *file, unsigned int fp, int fd, const struct iovec *iov, int iovcnt) {
+    if (iovcnt < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ssize_t ret = file->readv(iov, iovcnt, fp);
+    timer.addAmt(Timer::MetricType::tazer, Timer::Metric::readv, ret);
+    return ret;
+}
+
+//All the iovecs are filled by a single pass through the cache hierarchy, no need to hold off other threads
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return tazerVector("read", Timer::Metric::readv, tazerRead, unixread, fd, iov, iovcnt);
+    return outerWrapper("readv", fd, Timer::Metric::readv, tazerReadv, unixreadv, fd, iov, iovcnt);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
     return tazerVector("write", Timer::Metric::writev, tazerWrite, unixwrite, fd, iov, iovcnt);
 }
 
+template <typename T>
+ssize_t tazerPreadv(TazerFile *file, unsigned int fp, int fd, const struct iovec *iov, int iovcnt, T offset) {
+    if (offset < 0 || iovcnt < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ssize_t ret = file->preadv(iov, iovcnt, offset, fp);
+    timer.addAmt(Timer::MetricType::tazer, Timer::Metric::readv, ret);
+    return ret;
+}
+
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    return outerWrapper("preadv", fd, Timer::Metric::readv, tazerPreadv<off_t>, unixpreadv, fd, iov, iovcnt, offset);
+}
+
+ssize_t preadv64(int fd, const struct iovec *iov, int iovcnt, off64_t offset) {
+    return outerWrapper("preadv64", fd, Timer::Metric::readv, tazerPreadv<off64_t>, unixpreadv64, fd, iov, iovcnt, offset);
+}
+
 /*Streaming**************************************************************************************************/
 
 FILE *tazerFopen(std::string name, std::string metaName, TazerFile::Type type, const char *__restrict fileName, const char *__restrict modes) {
     DPRINTF("tazerOpen: %s %s %u\n", name.c_str(), metaName.c_str(), type);
-    char m = 'r';
-    FILE *fp = (*unixfopen)(fileName, &m);
+    FILE *fp = (*unixfopen)(fileName, "r");
     if (fp) {
         int fd = fileno(fp);
         TazerFile *file = TazerFile::addNewTazerFile(type, name, metaName, fd);
         if (file) {
-            TazerFileDescriptor::addTazerFileDescriptor(fd, file, file->newFilePosIndex());
-            TazerFileStream::addStream(fp, fd);
+            unsigned int index = file->newFilePosIndex();
+            TazerFileDescriptor::addTazerFileDescriptor(fd, file, index);
+            TazerFileStream::addStream(fp, fd, file, index);
+            setFdClass(fd, FdTazer);
         }
     }
     return fp;
@@ -598,92 +690,76 @@ FILE *fopen64(const char *__restrict fileName, const char *__restrict modes) {
     return outerWrapper("fopen64", fileName, metric, tazerFopen, unixfopen64, fileName, modes);
 }
 
-int tazerFclose(TazerFile *file, unsigned int pos, int fd, FILE *fp) {
-    TazerFile::removeTazerFile(file);
+int tazerFclose(TazerFileStream *stream, FILE *fp) {
+    int fd = stream->getFileDescriptor();
+    clearFdClass(fd, FdTazer);
+    TazerFile::removeTazerFile(stream->getTazerFile());
     TazerFileDescriptor::removeTazerFileDescriptor(fd);
-    return (*unixfclose)(fp);
+    int ret = (*unixfclose)(fp);
+    if (TazerFile::closeFailed()) {
+        errno = EIO;
+        ret = EOF;
+    }
+    return ret;
 }
 
 int fclose(FILE *fp) {
     return outerWrapper("fclose", fp, Timer::Metric::close, tazerFclose, unixfclose, fp);
 }
 
-size_t tazerFread(TazerFile *file, unsigned int pos, int fd, void *__restrict ptr, size_t size, size_t n, FILE *__restrict fp) {
-    return (size_t)read(fd, ptr, size * n);
+size_t tazerFread(TazerFileStream *stream, void *__restrict ptr, size_t size, size_t n, FILE *__restrict fp) {
+    if (!size)
+        return 0;
+    return stream->read(ptr, size * n) / size;
 }
 
 size_t fread(void *__restrict ptr, size_t size, size_t n, FILE *__restrict fp) {
     return outerWrapper("fread", fp, Timer::Metric::read, tazerFread, unixfread, ptr, size, n, fp);
 }
 
-size_t tazerFwrite(TazerFile *file, unsigned int pos, int fd, const void *__restrict ptr, size_t size, size_t n, FILE *__restrict fp) {
-    return (size_t)write(fd, ptr, size * n);
+size_t tazerFwrite(TazerFileStream *stream, const void *__restrict ptr, size_t size, size_t n, FILE *__restrict fp) {
+    return (size_t)write(stream->getFileDescriptor(), ptr, size * n);
 }
 
 size_t fwrite(const void *__restrict ptr, size_t size, size_t n, FILE *__restrict fp) {
     return outerWrapper("fwrite", fp, Timer::Metric::read, tazerFwrite, unixfwrite, ptr, size, n, fp);
 }
 
-long int tazerFtell(TazerFile *file, unsigned int pos, int fd, FILE *fp) {
-    return (long int)lseek(fd, 0, SEEK_CUR);
+long int tazerFtell(TazerFileStream *stream, FILE *fp) {
+    return stream->tell();
 }
 
 long int ftell(FILE *fp) {
     return outerWrapper("ftell", fp, Timer::Metric::ftell, tazerFtell, unixftell, fp);
 }
 
-int tazerFseek(TazerFile *file, unsigned int pos, int fd, FILE *fp, long int off, int whence) {
-    return lseek(fd, off, whence);
+int tazerFseek(TazerFileStream *stream, FILE *fp, long int off, int whence) {
+    stream->clearEof();
+    return (lseek(stream->getFileDescriptor(), off, whence) == (off_t)-1) ? -1 : 0;
 }
 
 int fseek(FILE *fp, long int off, int whence) {
     return outerWrapper("fseek", fp, Timer::Metric::seek, tazerFseek, unixfseek, fp, off, whence);
 }
 
-int tazerFgetc(TazerFile *file, unsigned int pos, int fd, FILE *fp) {
-    if (!file->eof()) {
-        unsigned char buffer;
-        read(fd, &buffer, 1);
-        return (int)buffer;
-    }
-    return EOF;
+int tazerFgetc(TazerFileStream *stream, FILE *fp) {
+    return stream->getc();
 }
 
 int fgetc(FILE *fp) {
     return outerWrapper("fgetc", fp, Timer::Metric::fgetc, tazerFgetc, unixfgetc, fp);
 }
 
-char *tazerFgets(TazerFile *file, unsigned int pos, int fd, char *__restrict s, int n, FILE *__restrict fp) {
-    char *ret = NULL;
-    if (!file->eof()) {
-        int prior = file->filePos(pos);
-        size_t res = read(fd, s, n - 1);
-        if (res) {
-            unsigned int index;
-            for (index = 0; index < res; index++) {
-                if (s[index] == '\n') {
-                    index++;
-                    break;
-                }
-            }
-
-            if (index < res) {
-                file->seek(prior + index, SEEK_SET, pos);
-            }
-
-            s[index] = '\0';
-            ret = s;
-        }
-    }
-    return ret;
+char *tazerFgets(TazerFileStream *stream, char *__restrict s, int n, FILE *__restrict fp) {
+    return stream->gets(s, n);
 }
 
 char *fgets(char *__restrict s, int n, FILE *__restrict fp) {
     return outerWrapper("fgets", fp, Timer::Metric::fgets, tazerFgets, unixfgets, s, n, fp);
 }
 
-int tazerFputc(TazerFile *file, unsigned int pos, int fd, int c, FILE *fp) {
-    write(fd, (void *)&c, 1);
+int tazerFputc(TazerFileStream *stream, int c, FILE *fp) {
+    write(stream->getFileDescriptor(), (void *)&c, 1);
     return c;
 }
 
@@ -691,7 +767,7 @@ int fputc(int c, FILE *fp) {
     return outerWrapper("fputc", fp, Timer::Metric::fputc, tazerFputc, unixfputc, c, fp);
 }
 
-int tazerFputs(TazerFile *file, unsigned int pos, int fd, const char *__restrict s, FILE *__restrict fp) {
+int tazerFputs(TazerFileStream *stream, const char *__restrict s, FILE *__restrict fp) {
     unsigned int index = 0;
     while (1) {
         if (s[index] == '\0')
@@ -701,7 +777,7 @@ int tazerFputs(TazerFile *file, unsigned int pos, int fd, const char *__restrict
 
     int res = -1;
     if (index)
-        res = write(fd, s, index);
+        res = write(stream->getFileDescriptor(), s, index);
 
     if (res == -1)
         return EOF;
@@ -712,8 +788,8 @@ int fputs(const char *__restrict s, FILE *__restrict fp) {
     return outerWrapper("fputs", fp, Timer::Metric::fputs, tazerFputs, unixfputs, s, fp);
 }
 
-int tazerFeof(TazerFile *file, unsigned int pos, int fd, FILE *fp) {
-    return file->eof();
+int tazerFeof(TazerFileStream *stream, FILE *fp) {
+    return stream->eof();
 }
 
 int feof(FILE *fp) {
@@ -277,14 +277,13 @@ ssize_t LocalFile::read(void *buf, size_t count, uint32_t index) {
 
         trackRead(count, index, startBlock, endBlock);
         bool error = false;
-        std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> reads;
         uint64_t priority = 0;
         for (uint32_t blk = startBlock; blk < endBlock; blk++) {
             _cache->updateReadCnt(1);
             uint32_t dataSize = (blk + 1 == _numBlks) ? _fileSize - (blk * _blkSize) : _blkSize;
             _cache->updateOvhTime(Timer::getCurrentTime() - otime);
 
-            auto request = _cache->requestBlock(blk, _blkSize, _regFileIndex, reads, priority);
+            auto request = _cache->requestBlock(blk, _blkSize, _regFileIndex, priority);
             otime = Timer::getCurrentTime();
             // std::cout << "request blk " << blk << " from: " << request->originating->name() << request->ready << std::endl;
 
@@ -301,8 +300,6 @@ ssize_t LocalFile::read(void *buf, size_t count, uint32_t index) {
             }
         }
 
-        // std::cout<<"[TAZER] " << "read size" << reads.size() << std::endl;
-
         //If prefetching is enabled globally or for this specific file, apply specific prefetching policy
         if (Config::prefetchGlobal || _prefetch) {
             //Default: Prefetch next n (numPrefetchBlks) blocks
@@ -98,7 +98,10 @@ OutputFile::OutputFile(std::string fileName, std::string metaName, int fd) : Taz
                                                        _fileSize(0),
                                                        _messageOffset(sizeof(writeMsg) + _name.size() + 1),
                                                        _seqNum(0),
-                                                       _sendNum(0) {
+                                                       _sendNum(0),
+                                                       _numUnacked(0),
+                                                       _lastSent(0),
+                                                       _writeFailed(false) {
     std::unique_lock<std::mutex> lock(_bufferLock);
     _buffer = new char[Config::outputFileBufferSize];
     _bufferIndex = _messageOffset;
@@ -157,6 +160,7 @@ void OutputFile::close() {
         while (_seqNum.load() != _sendNum.load()) {
             std::this_thread::yield();
         }
+        drainWrites(); //Everything is on the server once the last ack is in
         //std::cout<<"[TAZER] " << "closing bi: " << _bufferIndex << " bc: " << _bufferCnt << " bfp: " << _bufferFp << " " << _totalCnt << std::endl;
 
         //Kill threads
@@ -164,11 +168,16 @@ void OutputFile::close() {
         _decompressionPool.terminate();
 
         //Close file
-        closeFileOnServer();
+        if (!closeFileOnServer() || _writeFailed) {
+            std::cerr << "[TAZER] "
+                      << "ERROR: " << _name << " may not be on the server's disk" << std::endl;
+            _closeFailed = true;
+        }
 
         //Reset values
         _seqNum.store(0);
         _sendNum.store(0);
+        _writeFailed = false;
     }
     lock.unlock();
 }
@@ -187,8 +196,10 @@ bool OutputFile::openFileOnServer() {
 
 bool OutputFile::closeFileOnServer() {
     _connections[0]->lock();
+    unsigned int sn = 0;
+    bool failed = false;
     bool ret = sendCloseFileMsg(_connections[0], _name);
-    recAckMsg(_connections[0], CLOSE_FILE_MSG);
+    ret = ret && recAckMsg(_connections[0], CLOSE_FILE_MSG, sn, failed) && !failed;
     _connections[0]->unlock();
     return ret;
 }
@@ -199,6 +210,24 @@ ssize_t OutputFile::read(void *buf, size_t count, uint32_t index) {
     return 0;
 }
 
+ssize_t OutputFile::pread(void *buf, size_t count, uint64_t offset, uint32_t index) {
+    *this << "in outputfile pread.... need to implement... exiting" << std::endl;
+    exit(-1);
+    return 0;
+}
+
+ssize_t OutputFile::readv(const struct iovec *iov, int iovcnt, uint32_t index) {
+    *this << "in outputfile readv.... need to implement... exiting" << std::endl;
+    exit(-1);
+    return 0;
+}
+
+ssize_t OutputFile::preadv(const struct iovec *iov, int iovcnt, uint64_t offset, uint32_t index) {
+    *this << "in outputfile preadv.... need to implement... exiting" << std::endl;
+    exit(-1);
+    return 0;
+}
+
 // void OutputFile::addCompressTask(char *buf, uint32_t size, uint64_t fp, uint32_t seqNum) {
 //void OutputFile::addTransferTask(char *buf, uint32_t size, uint32_t compSize, uint64_t fp, uint32_t seqNum) {
 ssize_t OutputFile::write(const void *buf, size_t count, uint32_t index) {
@@ -301,33 +330,97 @@ uint64_t OutputFile::compress(char **buffer, uint64_t offset, uint64_t size) {
         compSize = LZ4_compress_HC((*buffer) + _messageOffset, compBuf + _messageOffset, size, maxCompSize, _compLevel);
     }
 
+    if (compSize == 0 || compSize >= size) { //Did not compress, the server takes compSize == size as raw data
+        delete[] compBuf;
+        return size;
+    }
     delete[] * buffer;
     *buffer = compBuf;
     return compSize;
 }
 
 void OutputFile::addTransferTask(char *buf, uint64_t size, uint64_t compSize, uint64_t fp, uint32_t seqNum) {
-    _transferPool.addTask(seqNum, [this, buf, size, compSize, fp, seqNum] {
-        if (seqNum == _sendNum.load()) {
-            //Send the message
-            _connections[0]->lock();
-            if (sendWriteMsg(_connections[0], _name, buf, size, compSize, fp, seqNum)) {
-                if (recAckMsg(_connections[0], WRITE_MSG)) {
-
-                    _totalCnt += (size - _messageOffset);
-                    *this << "Successful write " << _totalCnt << " " << seqNum << std::endl;
-                }
-            }
-            else
-                *this << "Failed send" << std::endl;
-            _connections[0]->unlock();
-            _sendNum.fetch_add(1);
-        }
-        else
-            addTransferTask(buf, size, compSize, fp, seqNum);
+    std::unique_lock<std::mutex> lock(_readyLock);
+    _ready[seqNum] = PendingWrite{buf, size, compSize, fp};
+    lock.unlock();
+    _transferPool.addTask(seqNum, [this] {
+        sendReady();
     });
 }
 
+//Takes the buffer that is next in line if it is ready, a buffer that is ready early waits in _ready for the ones before it
+bool OutputFile::nextReady(uint32_t &seqNum, PendingWrite &write) {
+    std::unique_lock<std::mutex> lock(_readyLock);
+    if (_ready.empty() || _ready.begin()->first != _sendNum.load()) {
+        return false;
+    }
+    seqNum = _ready.begin()->first;
+    write = _ready.begin()->second;
+    _ready.erase(_ready.begin());
+    return true;
+}
+
+//Sends whatever is next in line. The connection is shared with every other file on the server, so our
+//acks can't be left on its socket for someone else to read, we give it back once they are all in. While
+//waiting on them we keep sending the buffers queued in the meantime, so the window stays full.
+void OutputFile::sendReady() {
+    std::unique_lock<std::mutex> lock(_sendLock);
+    uint32_t seqNum = 0;
+    PendingWrite write;
+    if (!nextReady(seqNum, write)) {
+        return;
+    }
+    _connections[0]->lock();
+    bool more = true;
+    while (more) {
+        sendWrite(write.buf, write.size, write.compSize, write.fp, seqNum);
+        _sendNum.fetch_add(1);
+        more = nextReady(seqNum, write);
+        while (!more && _numUnacked) { //Pick up acks as they arrive without blocking the next buffer
+            if (_connections[0]->msgWaiting(Config::outputAckPollTime))
+                recvWriteAck();
+            more = nextReady(seqNum, write);
+        }
+    }
+    _connections[0]->unlock();
+}
+
+//Must hold _sendLock and the connection. Up to Config::outputWindow writes are in flight, we only
+//stop for an ack once the window is full, the server acks cumulatively.
+void OutputFile::sendWrite(char *buf, uint64_t size, uint64_t compSize, uint64_t fp, uint32_t seqNum) {
+    if (sendWriteMsg(_connections[0], _name, buf, size, compSize, fp, seqNum)) {
+        _numUnacked++;
+        _lastSent = seqNum;
+        _totalCnt += size;
+    }
+    else {
+        *this << "Failed send" << std::endl;
+        _writeFailed = true;
+    }
+    while (_numUnacked >= Config::outputWindow && recvWriteAck()) {
+    }
+}
+
+//Must hold _sendLock and the connection
+bool OutputFile::recvWriteAck() {
+    uint32_t ackNum = 0;
+    bool failed = false;
+    if (recAckMsg(_connections[0], WRITE_MSG, ackNum, failed)) {
+        //Every write through ackNum has been answered, the unacked ones are the ones sent after it
+        _numUnacked = _lastSent - ackNum;
+        if (failed) {
+            *this << "Server failed write " << ackNum << std::endl;
+            _writeFailed = true;
+        }
+        *this << "Successful write " << _totalCnt << " " << ackNum << std::endl;
+        return true;
+    }
+    *this << "Failed write ack" << std::endl;
+    _numUnacked = 0;
+    _writeFailed = true; //We can't tell what the unacked writes did, close reports it
+    return false;
+}
+
 void OutputFile::addCompressTask(char *buf, uint64_t size, uint64_t fp, uint32_t seqNum) {
     _decompressionPool.addTask([this, buf, size, fp, seqNum] {
         char *temp = buf;
@@ -336,6 +429,17 @@ void OutputFile::addCompressTask(char *buf, uint64_t size, uint64_t fp, uint32_t
     });
 }
 
+//Waits until the server has acked everything through _lastSent
+void OutputFile::drainWrites() {
+    std::unique_lock<std::mutex> lock(_sendLock);
+    if (_numUnacked) {
+        _connections[0]->lock();
+        while (_numUnacked && recvWriteAck()) {
+        }
+        _connections[0]->unlock();
+    }
+}
+
 off_t OutputFile::seek(off_t offset, int whence, uint32_t index) {
     // std::cout << _name << " seek " << offset << " " << whence << " " << index << std::endl;
 
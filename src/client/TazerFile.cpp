@@ -96,6 +96,8 @@
 #define TIMEON(...)
 
 extern int removeStr(char *s, const char *r);
+thread_local bool TazerFile::_closeFailed = false;
+
 TazerFile::TazerFile(TazerFile::Type type, std::string name, std::string metaName, int fd) : 
     Loggable(Config::TazerFileLog, "TazerFile"),
     _type(type),
@@ -105,6 +107,7 @@ TazerFile::TazerFile(TazerFile::Type type, std::string name, std::string metaNam
     _eof(false),
     _compress(false),
     _prefetch(false),
+    _wholeFile(false),
     _save_local(false),
     _blkSize(1),
     _initMetaTime(0), 
@@ -187,7 +190,8 @@ bool TazerFile::readMetaInfo() {
             break;
         }
         _prefetch = atoi(line.substr(lcur, next - lcur).c_str());
-        log(this) << "prefetch: " << _prefetch << std::endl;
+        _wholeFile = line.substr(lcur, next - lcur).find('w') != std::string::npos;
+        log(this) << "prefetch: " << _prefetch << " whole file: " << _wholeFile << std::endl;
 
         lcur = next + 1;
         next = line.find(":", lcur);
@@ -345,6 +349,13 @@ bool TazerFile::removeTazerFile(TazerFile *file) {
     return removeTazerFile(file->_metaName);
 }
 
+//Whether the last file closed on this thread could not get its writes onto the server's disk, clears it
+bool TazerFile::closeFailed() {
+    bool ret = _closeFailed;
+    _closeFailed = false;
+    return ret;
+}
+
 TazerFile *TazerFile::lookUpTazerFile(std::string fileName) {
     if (strstr(fileName.c_str(), ".tmp") != NULL) {
         char temp[1000];
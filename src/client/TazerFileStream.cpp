@@ -73,17 +73,25 @@
 //*EndLicense****************************************************************
 
 #include "TazerFileStream.h"
+#include <string.h>
 
-TazerFileStream::TazerFileStream(int fd) : tazerFileDescriptor(fd) {
+TazerFileStream::TazerFileStream(int fd, TazerFile *file, unsigned int index) : tazerFileDescriptor(fd),
+                                                                               _file(file),
+                                                                               _index(index),
+                                                                               _buf(NULL),
+                                                                               _bufStart(0),
+                                                                               _bufLen(0),
+                                                                               _eof(false) {
 }
 
 TazerFileStream::~TazerFileStream() {
+    delete[] _buf;
 }
 
-bool TazerFileStream::addStream(FILE *fp, int fd) {
+bool TazerFileStream::addStream(FILE *fp, int fd, TazerFile *file, unsigned int index) {
     return Trackable<FILE *, TazerFileStream *>::AddTrackable(
                fp, [=]() -> TazerFileStream * {
-                   return new TazerFileStream(fd);
+                   return new TazerFileStream(fd, file, index);
                }) != NULL;
 }
 
@@ -91,14 +99,8 @@ bool TazerFileStream::removeStream(FILE *fp) {
     return Trackable<FILE *, TazerFileStream *>::RemoveTrackable(fp);
 }
 
-int TazerFileStream::lookupStream(FILE *fp, ReaderWriterLock *&lock) {
-    TazerFileStream *v = Trackable<FILE *, TazerFileStream *>::LookupTrackable(fp);
-    if (v) {
-        lock = &v->lock;
-        return v->tazerFileDescriptor;
-    }
-    lock = NULL;
-    return -1;
+TazerFileStream *TazerFileStream::lookupStream(FILE *fp) {
+    return Trackable<FILE *, TazerFileStream *>::LookupTrackable(fp);
 }
 
 ReaderWriterLock *TazerFileStream::getLock() {
@@ -107,4 +109,107 @@ ReaderWriterLock *TazerFileStream::getLock() {
 
 int TazerFileStream::getFileDescriptor() {
     return tazerFileDescriptor;
-}
\ No newline at end of file
+}
+
+TazerFile *TazerFileStream::getTazerFile() {
+    return _file;
+}
+
+unsigned int TazerFileStream::getFilePosIndex() {
+    return _index;
+}
+
+//Loads the block holding pos, returns false at end of file
+bool TazerFileStream::fill(uint64_t pos) {
+    uint64_t blkSize = _file->blkSize();
+    if (!_buf)
+        _buf = new char[blkSize];
+    _bufStart = pos - (pos % blkSize);
+    ssize_t ret = _file->pread(_buf, blkSize, _bufStart, _index);
+    _bufLen = (ret > 0) ? ret : 0;
+    return pos < _bufStart + _bufLen;
+}
+
+size_t TazerFileStream::read(void *ptr, size_t count) {
+    char *dst = (char *)ptr;
+    uint64_t pos = _file->filePos(_index);
+    size_t done = 0;
+    while (done < count) {
+        if (pos < _bufStart || pos >= _bufStart + _bufLen) {
+            //Whole blocks go straight to the caller, no point staging them
+            if (count - done >= _file->blkSize()) {
+                ssize_t ret = _file->pread(dst + done, count - done, pos, _index);
+                if (ret > 0) {
+                    done += ret;
+                    pos += ret;
+                }
+                if (done < count)
+                    _eof = true;
+                break;
+            }
+            if (!fill(pos)) {
+                _eof = true;
+                break;
+            }
+        }
+        size_t amt = std::min((uint64_t)(count - done), _bufStart + _bufLen - pos);
+        memcpy(dst + done, &_buf[pos - _bufStart], amt);
+        done += amt;
+        pos += amt;
+    }
+    _file->setFilePos(_index, pos);
+    return done;
+}
+
+int TazerFileStream::getc() {
+    uint64_t pos = _file->filePos(_index);
+    if (pos < _bufStart || pos >= _bufStart + _bufLen) {
+        if (!fill(pos)) {
+            _eof = true;
+            return EOF;
+        }
+    }
+    _file->setFilePos(_index, pos + 1);
+    return (unsigned char)_buf[pos - _bufStart];
+}
+
+char *TazerFileStream::gets(char *s, int n) {
+    if (n <= 0)
+        return NULL;
+    uint64_t pos = _file->filePos(_index);
+    int done = 0;
+    while (done < n - 1) {
+        if (pos < _bufStart || pos >= _bufStart + _bufLen) {
+            if (!fill(pos)) {
+                _eof = true;
+                break;
+            }
+        }
+        size_t avail = std::min((uint64_t)(n - 1 - done), _bufStart + _bufLen - pos);
+        char *start = &_buf[pos - _bufStart];
+        char *nl = (char *)memchr(start, '\n', avail);
+        size_t amt = (nl) ? (nl - start) + 1 : avail;
+        memcpy(s + done, start, amt);
+        done += amt;
+        pos += amt;
+        if (nl)
+            break;
+    }
+    _file->setFilePos(_index, pos);
+    if (!done)
+        return NULL;
+    s[done] = '\0';
+    return s;
+}
+
+long int TazerFileStream::tell() {
+    return (long int)_file->filePos(_index);
+}
+
+bool TazerFileStream::eof() {
+    return _eof;
+}
+
+void TazerFileStream::clearEof() {
+    _eof = false;
+}
@@ -0,0 +1,139 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "ARCPolicy.h"
+#include <algorithm>
+
+//A hit in T1 promotes the block to T2, hits in T2 just refresh its timeStamp
+bool ARCPolicy::touch(EvictionEntry *state) {
+    if (state->queue == EVICT_FREQUENT) {
+        return false;
+    }
+    state->queue = EVICT_FREQUENT;
+    return true;
+}
+
+uint32_t ARCPolicy::target(std::vector<EvictionSlot> &bin, int ghostSlot) {
+    uint32_t numSlots = bin.size();
+    uint32_t p = std::min((uint32_t)bin[0].state->binState, numSlots);
+    if (ghostSlot >= 0) {
+        uint32_t b1 = countGhosts(bin, EVICT_RECENT);
+        uint32_t b2 = countGhosts(bin, EVICT_FREQUENT);
+        if (bin[ghostSlot].state->ghostQueue == EVICT_RECENT) {
+            p = std::min(numSlots, p + std::max(b2 / b1, 1U));
+        }
+        else {
+            uint32_t delta = std::max(b1 / b2, 1U);
+            p = (p > delta) ? p - delta : 0;
+        }
+    }
+    return p;
+}
+
+int ARCPolicy::victim(std::vector<EvictionSlot> &bin, uint32_t fileIndex, uint32_t blockIndex) {
+    int ghostSlot = ghost(bin, fileIndex, blockIndex);
+    uint32_t p = target(bin, ghostSlot);
+    uint32_t t1 = count(bin, EVICT_RECENT);
+    bool inB2 = ghostSlot >= 0 && bin[ghostSlot].state->ghostQueue == EVICT_FREQUENT;
+
+    int ret = -1;
+    if (t1 > 0 && (t1 > p || (inB2 && t1 == p))) {
+        ret = oldest(bin, EVICT_RECENT);
+    }
+    if (ret < 0) {
+        ret = oldest(bin, EVICT_FREQUENT);
+    }
+    if (ret < 0) { //whatever is left, e.g. T1 when T2 is all in use, or blocks cached under another policy
+        ret = oldest(bin);
+    }
+    return ret;
+}
+
+void ARCPolicy::admit(std::vector<EvictionSlot> &bin, uint32_t slot, uint32_t fileIndex, uint32_t blockIndex) {
+    int ghostSlot = ghost(bin, fileIndex, blockIndex);
+    uint32_t p = target(bin, ghostSlot);
+    if (p != bin[0].state->binState) {
+        bin[0].state->binState = p;
+        bin[0].dirty = true;
+    }
+    if (ghostSlot >= 0) {
+        bin[ghostSlot].state->ghostQueue = EVICT_NONE;
+        bin[ghostSlot].dirty = true;
+    }
+    if (bin[slot].valid) {
+        remember(bin[slot]);
+    }
+    bin[slot].state->queue = (ghostSlot >= 0) ? EVICT_FREQUENT : EVICT_RECENT;
+    bin[slot].dirty = true;
+}
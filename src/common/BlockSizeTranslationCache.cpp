@@ -123,7 +123,7 @@ bool BlockSizeTranslationCache::writeBlock(Request *req) {
     return true;
 }
 
-void BlockSizeTranslationCache::readBlock(Request* req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request*>>> &reads, uint64_t priority){
+void BlockSizeTranslationCache::readBlock(Request* req, uint64_t priority){
 
     // std::cout<<"[TAZER] " << _name << " entering read " << index << " " << size << std::endl;
     uint32_t newIndex = req->blkIndex / _b1Perb2;
@@ -131,8 +131,7 @@ void BlockSizeTranslationCache::readBlock(Request* req, std::unordered_map<uint3
 
     req->blkIndex=newIndex;
 
-    std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request*>>> treads;
-    _nextLevel->readBlock(req,treads,priority);
+    _nextLevel->readBlock(req,priority);
     // std::cout<<"[TAZER] " << _name << " " << treads.size() << " new index " << newIndex << " offset " << offset << std::endl;
     if (req->data != NULL) {
         // _hits++;
@@ -82,24 +82,32 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <future>
+#include <linux/futex.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <signal.h>
 #include <string.h>
 #include <string>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 //#define DPRINTF(...) fprintf(stderr, __VA_ARGS__)
 #define DPRINTF(...)
 
 template <class Lock>
-BoundedCache<Lock>::BoundedCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity) : Cache(cacheName),
+BoundedCache<Lock>::BoundedCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity, unsigned int evictionPolicy) : Cache(cacheName),
                                                                                                                           _cacheSize(cacheSize),
                                                                                                                           _blockSize(blockSize),
                                                                                                                           _associativity(associativity),
                                                                                                                           _numBlocks(_cacheSize / _blockSize),
                                                                                                                           _collisions(0),
                                                                                                                           _prefetchCollisions(0),
-                                                                                                                          _outstanding(0) {
+                                                                                                                          _outstanding(0),
+                                                                                                                          _blkKeys(NULL),
+                                                                                                                          _policy(EvictionPolicy::newEvictionPolicy(evictionPolicy)),
+                                                                                                                          _sketch(NULL) {
 
     // log(this) /*std::cout*/<< "Constructing " << _name << " in Boundedcache" << std::endl;
     stats.start();
@@ -114,6 +122,9 @@ BoundedCache<Lock>::BoundedCache(std::string cacheName, uint64_t cacheSize, uint
     }
     log(this) << _name << " " << _cacheSize << " " << _blockSize << " " << _numBlocks << " " << _associativity << " " << _numBins << std::endl;
     _localLock = new ReaderWriterLock();
+    for (uint32_t i = 0; i < MAX_HASHED_FILES; i++) {
+        _fileHashes[i].store(0);
+    }
     stats.end(false, CacheStats::Metric::constructor);
 }
 
@@ -130,6 +141,8 @@ BoundedCache<Lock>::~BoundedCache() {
 
     log(this) << "deleting " << _name << " in Boundedcache" << std::endl;
     delete _localLock;
+    delete _policy;
+    delete _sketch;
 }
 
 template <class Lock>
@@ -151,27 +164,87 @@ bool BoundedCache<Lock>::sameBlk(BlockEntry *blk1, BlockEntry *blk2) {
     return blk1->fileIndex == blk2->fileIndex && blk1->blockIndex == blk2->blockIndex;
 }
 
+//Hashes are set once in addFile, so the common case needs neither _localLock nor a map lookup
 template <class Lock>
-uint32_t BoundedCache<Lock>::getBinIndex(uint32_t index, uint32_t fileIndex) {
+uint64_t BoundedCache<Lock>::fileHash(uint32_t fileIndex) {
+    if (fileIndex < MAX_HASHED_FILES) {
+        return _fileHashes[fileIndex].load(std::memory_order_relaxed);
+    }
     _localLock->readerLock();
-    uint64_t temp = _fileMap[fileIndex].hash + index;
+    auto entry = _fileMap.find(fileIndex);
+    uint64_t hash = entry != _fileMap.end() ? entry->second.hash : 0;
     _localLock->readerUnlock();
+    return hash;
+}
+
+template <class Lock>
+uint32_t BoundedCache<Lock>::getBinIndex(uint32_t index, uint32_t fileIndex) {
+    uint64_t temp = fileHash(fileIndex) + index;
     return (temp % (_numBins));
 }
 
 template <class Lock>
 uint32_t BoundedCache<Lock>::getBinOffset(uint32_t index, uint32_t fileIndex) {
-    _localLock->readerLock();
-    uint64_t temp = _fileMap[fileIndex].hash + index;
-    _localLock->readerUnlock();
-    return (temp % (_numBins)) * _associativity;
+    return getBinIndex(index, fileIndex) * _associativity;
+}
+
+//Must hold the bin's writer lock
+template <class Lock>
+void BoundedCache<Lock>::setBlockKey(uint32_t blk, uint32_t fileIndex, uint32_t blockIndex) {
+    if (_blkKeys) {
+        _blkKeys[blk] = ((uint64_t)fileIndex << 32) | blockIndex;
+    }
+}
+
+//Offset within the bin of the first slot at or after start holding key, -1 if none
+template <class Lock>
+int BoundedCache<Lock>::probeBin(uint32_t binIndex, uint64_t key, uint32_t start) {
+    const uint64_t *keys = _blkKeys + (uint64_t)binIndex * _associativity;
+    uint32_t i = start;
+#if defined(__SSE2__)
+    const __m128i cmp = _mm_set1_epi64x(key);
+    for (; i + 2 <= _associativity; i += 2) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&keys[i]), cmp);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        mask &= mask >> 1; //both 32 bit halves have to match
+        if (mask & 1) {
+            return i;
+        }
+        if (mask & 4) {
+            return i + 1;
+        }
+    }
+#endif
+    for (; i < _associativity; i++) {
+        if (keys[i] == key) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 template <class Lock>
 int BoundedCache<Lock>::getBlockIndex(uint32_t index, uint32_t fileIndex, BlockEntry *entry) {
 
-    uint32_t binOffset = getBinOffset(index, fileIndex); //index % _numBins;
     uint32_t binIndex = getBinIndex(index, fileIndex);
+    uint32_t binOffset = binIndex * _associativity;
+    if (_blkKeys) {
+        uint64_t key = blockKey(index, fileIndex);
+        for (int i = probeBin(binIndex, key, 0); i >= 0; i = probeBin(binIndex, key, i + 1)) {
+            BlockEntry found;
+            readBlockEntry(i + binOffset, &found);
+            if (found.status == BLK_AVAIL) {
+                if (entry != NULL) {
+                    entry->timeStamp = found.timeStamp;
+                    entry->prefetched = found.prefetched;
+                    entry->eviction = found.eviction;
+                }
+                return i + binOffset;
+            }
+        }
+        return -1;
+    }
+
     auto blkEntries = readBin(binIndex);
     auto cmpBlk = getCompareBlkEntry(index, fileIndex);
 
@@ -181,6 +254,7 @@ int BoundedCache<Lock>::getBlockIndex(uint32_t index, uint32_t fileIndex, BlockE
                 if (entry != NULL) {
                     entry->timeStamp = blkEntries[i]->timeStamp;
                     entry->prefetched = blkEntries[i]->prefetched;
+                    entry->eviction = blkEntries[i]->eviction;
                 }
                 return i + binOffset;
             }
@@ -190,23 +264,42 @@ int BoundedCache<Lock>::getBlockIndex(uint32_t index, uint32_t fileIndex, BlockE
 }
 
 template <class Lock>
-int BoundedCache<Lock>::oldestBlockIndex(uint32_t index, uint32_t fileIndex, bool &found) {
+void BoundedCache<Lock>::writeBackSlots(std::vector<EvictionSlot> &slots, std::vector<std::shared_ptr<BlockEntry>> &entries, uint32_t binOffset) {
+    for (uint32_t i = 0; i < _associativity; i++) {
+        if (slots[i].dirty) {
+            writeBlockEntry(i + binOffset, entries[i].get());
+        }
+    }
+}
+
+template <class Lock>
+int BoundedCache<Lock>::admitBlock(std::vector<EvictionSlot> &slots, std::vector<std::shared_ptr<BlockEntry>> &entries, uint32_t slot, uint32_t binOffset, BlockEntry *incoming) {
+    _policy->admit(slots, slot, incoming->fileIndex, incoming->blockIndex);
+    writeBackSlots(slots, entries, binOffset);
+    return slot + binOffset;
+}
+
+template <class Lock>
+int BoundedCache<Lock>::oldestBlockIndex(uint32_t index, uint32_t fileIndex, bool &found, bool prefetch) {
     found = false;
-    uint32_t minTime = -1; //this is max uint32_t
-    uint32_t minIndex = -1;
-    uint32_t minPrefetchTime = -1; //Prefetched block
+    uint64_t minPrefetchTime = -1; //Prefetched block
     uint32_t minPrefetchIndex = -1;
     uint32_t binIndex = getBinIndex(index, fileIndex);
-    uint32_t binOffset = getBinOffset(index, fileIndex);
+    uint32_t binOffset = binIndex * _associativity;
     auto cmpBlk = getCompareBlkEntry(index, fileIndex);
     BlockEntry *entry = cmpBlk.get();
     auto blkEntries = readBin(binIndex);
 
+    std::vector<EvictionSlot> slots(_associativity);
+    for (uint32_t i = 0; i < _associativity; i++) {
+        slots[i] = {&blkEntries[i]->eviction, blkEntries[i]->timeStamp, blkEntries[i]->fileIndex, blkEntries[i]->blockIndex, false, false, false};
+    }
+
     for (uint32_t i = 0; i < _associativity; i++) {
-        //Find actual, empty, or oldest
+        //Find actual, empty, or evictable
         if (blkEntries[i]->status == BLK_EMPTY) { //The space is empty!!!
             found = false;
-            return i + binOffset;
+            return admitBlock(slots, blkEntries, i, binOffset, entry);
         }
         else if (blkEntries[i]->status == BLK_RES || blkEntries[i]->status == BLK_PRE) { //The space is reserved..
             if (sameBlk(blkEntries[i].get(), entry)) {                                   //Reserved for us?
@@ -221,44 +314,54 @@ int BoundedCache<Lock>::oldestBlockIndex(uint32_t index, uint32_t fileIndex, boo
             }
         }
         else if (blkEntries[i]->status == BLK_AVAIL) {
-            //TODO: Implement other policies apart from LRU - evict based on PRIORITY
             if (sameBlk(blkEntries[i].get(), entry)) { //Well this block is already here
                 found = true;
                 return -1;
             }
-            //LRU
-            if (blkEntries[i]->timeStamp < minTime) { //Look for an old one
-                if (!anyUsers(i + binOffset)) {
-                    minTime = blkEntries[i]->timeStamp;
-                    minIndex = i + binOffset;
-                }
-            }
+            slots[i].valid = true;
+            slots[i].evictable = !anyUsers(i + binOffset);
 
             //PrefetchEvict policy evicts prefetched blocks first
-            if (Config::prefetchEvict && blkEntries[i]->prefetched && blkEntries[i]->timeStamp < minPrefetchTime) {
-                if (!anyUsers(i + binOffset)) {
-                    minPrefetchTime = blkEntries[i]->timeStamp;
-                    minPrefetchIndex = i + binOffset;
-                }
+            if (Config::prefetchEvict && slots[i].evictable && blkEntries[i]->prefetched && blkEntries[i]->timeStamp < minPrefetchTime) {
+                minPrefetchTime = blkEntries[i]->timeStamp;
+                minPrefetchIndex = i;
             }
         }
     }
 
     //If a prefetched block is found, we evict it
-    if (Config::prefetchEvict && minPrefetchTime != (uint32_t)-1 && minPrefetchIndex < _numBlocks) {
+    if (Config::prefetchEvict && minPrefetchIndex < _associativity) {
         _prefetchCollisions++;
         trackBlock(_name, "[BLOCK_EVICTED]", fileIndex, index, 1);
+        stats.addAmt(true, CacheStats::Metric::wasted, 1);
+        prefetchWasted(blkEntries[minPrefetchIndex]->fileIndex - 1);
 
-        return minPrefetchIndex;
+        return admitBlock(slots, blkEntries, minPrefetchIndex, binOffset, entry);
     }
-    if (minTime != (uint32_t)-1 && minIndex < _numBlocks) { //Did we find a space
+    int victim = _policy->victim(slots, entry->fileIndex, entry->blockIndex);
+    //Prefetches skip the filter, a prefetched block is wanted now even if it has never been seen
+    if (victim >= 0 && _sketch && !prefetch) {
+        uint64_t victimKey = ((uint64_t)slots[victim].fileIndex << 32) | slots[victim].blockIndex;
+        if (!_sketch->admit(blockKey(index, fileIndex), victimKey)) {
+            stats.addAmt(false, CacheStats::Metric::rejected, 1);
+            trackBlock(_name, "[BLOCK_REJECTED]", fileIndex, index, 0);
+            writeBackSlots(slots, blkEntries, binOffset);
+            return -1;
+        }
+        stats.addAmt(false, CacheStats::Metric::admitted, 1);
+    }
+    if (victim >= 0) { //Did we find a space
         _collisions++;
         trackBlock(_name, "[BLOCK_EVICTED]", fileIndex, index, 0);
+        if (blkEntries[victim]->prefetched) {
+            stats.addAmt(true, CacheStats::Metric::wasted, 1);
+            prefetchWasted(blkEntries[victim]->fileIndex - 1);
+        }
 
-        // log(this) /*std::cout*/<< _name << " evicting: " << minIndex << " " << _blkIndex[minIndex].blockIndex - 1 << " (" << _blkIndex[minIndex].activeCnt.load() << ") "
-        //           << " for " << index << std::endl;
-        return minIndex;
+        // log(this) /*std::cout*/<< _name << " evicting: " << victim + binOffset << " " << blkEntries[victim]->blockIndex - 1 << " for " << index << std::endl;
+        return admitBlock(slots, blkEntries, victim, binOffset, entry);
     }
+    writeBackSlots(slots, blkEntries, binOffset);
     log(this) << _name << " All space is reserved..." << std::endl;
     return -1;
 }
@@ -268,14 +371,14 @@ template <class Lock>
 bool BoundedCache<Lock>::blockReserve(uint32_t index, uint32_t fileIndex, bool &found, int &reservedIndex, bool prefetch) {
     bool ret = false;
     DPRINTF("beg br blk: %u out: %u ret %u fi %u Full: %u < %u\n", index, _outstanding.load(), ret, fileIndex, _fullFlag->load(), _numBlocks);
-    reservedIndex = oldestBlockIndex(index, fileIndex, found);
+    reservedIndex = oldestBlockIndex(index, fileIndex, found, prefetch);
     // log(this) /*std::cout*/ << " " << _name << "reserving: " << index << " " << reservedIndex << " " << found << " p: " << prefetch << std::endl;
     if (!found && reservedIndex > -1) {
         if (prefetch) {
-            blockSet(reservedIndex, fileIndex, index, BLK_PRE, prefetch, _name);
+            blockSet(reservedIndex, fileIndex, index, BLK_PRE, prefetch, _tier);
         }
         else {
-            blockSet(reservedIndex, fileIndex, index, BLK_RES, prefetch, _name);
+            blockSet(reservedIndex, fileIndex, index, BLK_RES, prefetch, _tier);
         }
         ret = true;
     }
@@ -287,21 +390,19 @@ bool BoundedCache<Lock>::blockReserve(uint32_t index, uint32_t fileIndex, bool &
 template <class Lock>
 bool BoundedCache<Lock>::writeBlock(Request *req) {
     // log(this) /*std::cout*/<< _name << " entering write: " << index << " " << size << " " << _blockSize << " " << (void *)buffer << " " << (void *)originating << " " << (void *)_nextLevel << std::endl;
-    // log(this) << "write " << _name << " fi: " << req->fileIndex << " i: " << req->blkIndex << " orig: " << req->originating->name() <<" "<<(uint32_t)req->reservedMap[this]<< std::endl;
+    // log(this) << "write " << _name << " fi: " << req->fileIndex << " i: " << req->blkIndex << " orig: " << req->originating->name() <<" "<<(uint32_t)req->reserved[_level]<< std::endl;
 
     bool ret = false;
-    if (req->reservedMap[this] > 0 || !_terminating) { //when terminating dont waste time trying to write orphan requests
+    if (req->reserved[_level] > 0 || !_terminating) { //when terminating dont waste time trying to write orphan requests
         auto index = req->blkIndex;
         auto fileIndex = req->fileIndex;
-        _localLock->readerLock();
         auto binIndex = getBinIndex(index, fileIndex);
-        _localLock->readerUnlock();
         if (req->originating == this) {
             _binLock->readerLock(binIndex);
             int blockIndex = getBlockIndex(index, fileIndex);
             _binLock->readerUnlock(binIndex);
             if (blockIndex >= 0) {
-                if (req->reservedMap[this] > 0) {
+                if (req->reserved[_level] > 0) {
                     auto t_cnt = decBlkCnt(blockIndex);
                     if (t_cnt == 0) {
                         log(this) << _name << " underflow in orig activecnt (" << t_cnt - 1 << ") for blkIndex: " << blockIndex << " fileIndex: " << fileIndex << " index: " << index << std::endl;
@@ -311,8 +412,9 @@ bool BoundedCache<Lock>::writeBlock(Request *req) {
             else {
                 std::cout << "[TAZER] " << _name << "writeblock should1 this even be possible?" << std::endl;
             }
-            cleanUpBlockData(req->data);
-            delete req;
+            if (req->data != req->dest) //The caller owns its buffer
+                cleanUpBlockData(req->data);
+            Request::release(req);
             ret = true;
         }
         else {
@@ -332,22 +434,23 @@ bool BoundedCache<Lock>::writeBlock(Request *req) {
                     BlockEntry entry;
                     readBlockEntry(blockIndex, &entry);
                     if (entry.status != BLK_WR || entry.status != BLK_AVAIL) {
-                        blockSet(blockIndex, fileIndex, index, BLK_WR, entry.prefetched, req->originating->name());
+                        blockSet(blockIndex, fileIndex, index, BLK_WR, entry.prefetched, req->originating->tier());
                         _binLock->writerUnlock(binIndex);
                         setBlockData(req->data, blockIndex, req->size);
                         _binLock->writerLock(binIndex);
-                        blockSet(blockIndex, fileIndex, index, BLK_AVAIL, entry.prefetched, req->originating->name()); //write the name of the originating cache so we can properly attribute stall time...
+                        blockSet(blockIndex, fileIndex, index, BLK_AVAIL, entry.prefetched, req->originating->tier()); //write the tier of the originating cache so we can properly attribute stall time...
                         _binLock->writerUnlock(binIndex);
+                        publishBlock(blockIndex);
                     }
                     else if (entry.status == BLK_AVAIL) {
-                        blockSet(blockIndex, fileIndex, index, BLK_AVAIL, entry.prefetched, req->originating->name()); //update timestamp
+                        blockSet(blockIndex, fileIndex, index, BLK_AVAIL, entry.prefetched, req->originating->tier()); //update timestamp
                         _binLock->writerUnlock(binIndex);
                     }
                     else { //the writer will update the timestamp
                         _binLock->writerUnlock(binIndex);
                     }
                     if (found) {
-                        if (req->reservedMap[this] > 0) {
+                        if (req->reserved[_level] > 0) {
                             auto t_cnt = decBlkCnt(blockIndex);
                             // auto t_cnt = _blkIndex[blockIndex].activeCnt.fetch_sub(1);
                             if (t_cnt == 0) {
@@ -367,7 +470,7 @@ bool BoundedCache<Lock>::writeBlock(Request *req) {
                     blockIndex = getBlockIndex(index, fileIndex);
                     _binLock->writerUnlock(binIndex);
                     if (blockIndex >= 0 && found) {
-                        if (req->reservedMap[this] > 0) {
+                        if (req->reserved[_level] > 0) {
                             auto t_cnt = decBlkCnt(blockIndex);
                             // auto t_cnt = _blkIndex[blockIndex].activeCnt.fetch_sub(1);
                             // log(this) /*std::cout*/ <<   _name << " nowrite: blkIndex: " << blockIndex << " fi: (" << fileIndex + 1 << "," << _blkIndex[blockIndex].fileIndex << ") i: (" << index + 1 << "," << _blkIndex[blockIndex].blockIndex << ") prev cnt: " << t_cnt << " cur cnt: " << _blkIndex[blockIndex].activeCnt.load() << std::endl;
@@ -390,8 +493,9 @@ bool BoundedCache<Lock>::writeBlock(Request *req) {
     }
     else { //we are terminating and this was an 'orphan request' (possibly from bypassing disk to goto network when resource balancing)
         if (req->originating == this) {
-            cleanUpBlockData(req->data);
-            delete req;
+            if (req->data != req->dest) //The caller owns its buffer
+                cleanUpBlockData(req->data);
+            Request::release(req);
             ret = true;
         }
         if (_nextLevel) {
@@ -402,7 +506,143 @@ bool BoundedCache<Lock>::writeBlock(Request *req) {
 }
 
 template <class Lock>
-void BoundedCache<Lock>::readBlock(Request *req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority) {
+uint8_t *BoundedCache<Lock>::readBlockData(uint32_t blockIndex, Request *req) {
+    return getBlockData(blockIndex);
+}
+
+template <class Lock>
+typename BoundedCache<Lock>::BlockWaitWord *BoundedCache<Lock>::blockWaitWord(uint32_t blk) {
+    return NULL;
+}
+
+//Call after the slot is set BLK_AVAIL, the syscall is skipped when nobody sleeps on it
+template <class Lock>
+void BoundedCache<Lock>::publishBlock(uint32_t blk) {
+    BlockWaitWord *word = blockWaitWord(blk);
+    if (word) {
+        word->seq.fetch_add(1);
+        if (word->waiters.load()) {
+            syscall(SYS_futex, (uint32_t *)&word->seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+        }
+    }
+}
+
+//Returns once seq has moved on or timeout (seconds) passes, not private since the word may be in shared memory
+template <class Lock>
+void BoundedCache<Lock>::waitForBlock(BlockWaitWord *word, uint32_t seq, double timeout) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1000000000.0);
+    word->waiters.fetch_add(1);
+    syscall(SYS_futex, (uint32_t *)&word->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+    word->waiters.fetch_sub(1);
+}
+
+template <class Lock>
+void BoundedCache<Lock>::finishRequest(Request *req, int64_t blockIndex) {
+    // log(this) << _name << " read wait: blkIndex: " << blockIndex << " fi: " << req->fileIndex << " i:" << req->blkIndex << std::endl;
+    uint64_t stime = Timer::getCurrentTime();
+    uint8_t waitingTier = 0;
+    uint64_t cnt = 0;
+    bool avail = false;
+    uint8_t *buff = NULL;
+    double curTime = (Timer::getCurrentTime() - stime) / 1000000000.0;
+    double timeout = _lastLevel->getRequestTime() * 10; // exit loop if request is 10x times longer than average network request
+    BlockWaitWord *word = blockWaitWord(blockIndex);
+    while (!avail && curTime < timeout) {
+        uint32_t seq = word ? word->seq.load() : 0;                                      //read before checking so a publish in between is not missed
+        avail = blockAvailable(blockIndex, req->fileIndex, true, cnt, &waitingTier); //captures the originating cache
+        if (!avail) {
+            if (word) {
+                waitForBlock(word, seq, timeout - curTime);
+            }
+            else {
+                sched_yield();
+            }
+        }
+        cnt++;
+        curTime = (Timer::getCurrentTime() - stime) / 1000000000.0;
+    }
+    if (avail) {
+        buff = readBlockData(blockIndex, req);
+        req->data = buff;
+        req->originating = this;
+        req->ready = true;
+        req->time = Timer::getCurrentTime() - req->time;
+        updateRequestTime(req->time);
+        Cache *waiting = waitingTier ? _base->getCacheByTier(waitingTier) : NULL;
+        req->waitingCache = waiting ? waiting : this;
+    }
+    else {
+        double reqTime = (Timer::getCurrentTime() - stime) / 1000000000.0;
+        _lastLevel->readBlock(req, 0); //rerequest block from last level, note this updates the request data structure so we do not need to update it manually;
+        std::cout << "[TAZER] " << Timer::printTime() << " " << _name << " timeout, rereqeusting block " << req->blkIndex << " " << req->fileIndex << " " << getRequestTime() << " " << _lastLevel->getRequestTime() << " " << reqTime << std::endl;
+        req->wait();
+        req->waitingCache = _lastLevel;
+    }
+    // log(this) << _name << " done read wait: blkIndex: " << blockIndex << " fi: " << req->fileIndex << " i:" << req->blkIndex << std::endl;
+}
+
+//Private levels are skipped, only a shared one can hold a block some other process fetched
+template <class Lock>
+bool BoundedCache<Lock>::lookupBlock(Request *req) {
+    if (_shared && req->size <= _blockSize) {
+        auto binIndex = getBinIndex(req->blkIndex, req->fileIndex);
+        _binLock->readerLock(binIndex);
+        int blockIndex = getBlockIndex(req->blkIndex, req->fileIndex);
+        if (blockIndex >= 0) {
+            if (!req->reserved[_level]) { //a reservation we hold from the way down already counts us
+                incBlkCnt(blockIndex);
+                req->reserved[_level] = 1;
+            }
+            req->data = readBlockData(blockIndex, req);
+            req->originating = this;
+            req->waitingCache = this;
+            req->ready = true;
+        }
+        _binLock->readerUnlock(binIndex);
+        if (blockIndex >= 0) {
+            trackBlock(_name, "[BLOCK_READ_HIT]", req->fileIndex, req->blkIndex, 0);
+            stats.addAmt(false, CacheStats::Metric::hits, req->size);
+            return true;
+        }
+    }
+    return Cache::lookupBlock(req);
+}
+
+//Only fills a slot still reserved for the block, writeBlock then finds it available and just drops the reference
+template <class Lock>
+void BoundedCache<Lock>::shareBlock(Request *req) {
+    if (_shared && req->reserved[_level] && req->size <= _blockSize) {
+        auto index = req->blkIndex;
+        auto fileIndex = req->fileIndex;
+        auto binIndex = getBinIndex(index, fileIndex);
+        bool found = false;
+        _binLock->writerLock(binIndex);
+        int blockIndex = oldestBlockIndex(index, fileIndex, found);
+        BlockEntry entry;
+        if (found && blockIndex >= 0) {
+            readBlockEntry(blockIndex, &entry);
+        }
+        if (found && blockIndex >= 0 && (entry.status == BLK_RES || entry.status == BLK_PRE)) {
+            blockSet(blockIndex, fileIndex, index, BLK_WR, entry.prefetched, req->originating->tier());
+            _binLock->writerUnlock(binIndex);
+            setBlockData(req->data, blockIndex, req->size);
+            _binLock->writerLock(binIndex);
+            blockSet(blockIndex, fileIndex, index, BLK_AVAIL, entry.prefetched, req->originating->tier());
+            _binLock->writerUnlock(binIndex);
+            publishBlock(blockIndex);
+            trackBlock(_name, "[BLOCK_SHARE]", fileIndex, index, 0);
+        }
+        else {
+            _binLock->writerUnlock(binIndex);
+        }
+    }
+    Cache::shareBlock(req);
+}
+
+template <class Lock>
+void BoundedCache<Lock>::readBlock(Request *req, uint64_t priority) {
     stats.start(); //read
     stats.start(); //ovh
     bool prefetch = priority != 0;
@@ -413,7 +653,7 @@ void BoundedCache<Lock>::readBlock(Request *req, std::unordered_map<uint32_t, st
         // log(this) << _name << "time: " << getRequestTime()  << " "  << _lastLevel->name() << " time: " << _lastLevel->getRequestTime() << std::endl;
         // log(this) << " skipping: " << _name << std::endl;
         stats.end(prefetch, CacheStats::Metric::ovh);
-        _lastLevel->readBlock(req, reads, priority);
+        _lastLevel->readBlock(req, priority);
         stats.end(prefetch, CacheStats::Metric::read);
         return;
     }
@@ -426,18 +666,21 @@ void BoundedCache<Lock>::readBlock(Request *req, std::unordered_map<uint32_t, st
     auto index = req->blkIndex;
     auto fileIndex = req->fileIndex;
 
-    _localLock->readerLock(); //local lock
-    int tsize = _fileMap[fileIndex].blockSize;
-    _localLock->readerUnlock();
     binIndex = getBinIndex(index, fileIndex);
+    if (_sketch && !prefetch) {
+        _sketch->increment(blockKey(index, fileIndex));
+    }
 
     if (!req->size) {
-        req->size = tsize;
+        _localLock->readerLock(); //local lock
+        req->size = _fileMap[fileIndex].blockSize;
+        _localLock->readerUnlock();
     }
 
     if (req->size <= _blockSize) {
         _binLock->readerLock(binIndex);
         BlockEntry entry;
+        bool touched = false;
         int blockIndex = getBlockIndex(index, fileIndex, &entry);
         if (blockIndex >= 0) { //block is present in cache HIT
             auto t_cnt = incBlkCnt(blockIndex);
@@ -446,26 +689,41 @@ void BoundedCache<Lock>::readBlock(Request *req, std::unordered_map<uint32_t, st
 
             if (entry.prefetched > 0) {
                 stats.addAmt(prefetch, CacheStats::Metric::prefetches, 1);
+                if (!prefetch) {
+                    prefetchUsed(fileIndex);
+                }
                 entry.prefetched = prefetch;
             }
             else {
                 stats.addAmt(prefetch, CacheStats::Metric::hits, req->size);
             }
-            blockSet(blockIndex, fileIndex, index, BLK_AVAIL, entry.prefetched, _name);
+            blockSet(blockIndex, fileIndex, index, BLK_AVAIL, entry.prefetched, _tier);
+            touched = _policy->touch(&entry.eviction);
             stats.end(prefetch, CacheStats::Metric::ovh);
             stats.start(); // hits
-            buff = getBlockData(blockIndex);
+            buff = readBlockData(blockIndex, req);
             stats.end(prefetch, CacheStats::Metric::hits);
             stats.start(); // ovh
             req->data = buff;
             req->originating = this;
-            req->reservedMap[this] = 1;
+            req->reserved[_level] = 1;
             req->ready = true;
             req->time = Timer::getCurrentTime() - req->time;
             updateRequestTime(req->time);
         }
 
         _binLock->readerUnlock(binIndex);
+        if (touched) { //Other hits share the reader lock, so the policy state is written back with the bin to ourselves
+            _binLock->writerLock(binIndex);
+            if (getBlockIndex(index, fileIndex) == blockIndex) { //Unless the block was evicted in between
+                BlockEntry current;
+                readBlockEntry(blockIndex, &current);
+                if (_policy->touch(&current.eviction)) {
+                    writeBlockEntry(blockIndex, &current);
+                }
+            }
+            _binLock->writerUnlock(binIndex);
+        }
         if (!buff) { // data not currently present //miss
             trackBlock(_name, "[BLOCK_READ_MISS_CLIENT]", fileIndex, index, priority);
 
@@ -479,10 +737,10 @@ void BoundedCache<Lock>::readBlock(Request *req, std::unordered_map<uint32_t, st
             }
             if (blockIndex >= 0) {
                 auto t_cnt = incBlkCnt(blockIndex);
-                req->reservedMap[this] = 1; //we will need to decrement active count on the cache entry when we write back
+                req->reserved[_level] = 1; //we will need to decrement active count on the cache entry when we write back
             }
             else {
-                req->reservedMap[this] = 0;
+                req->reserved[_level] = 0;
             }
             _binLock->writerUnlock(binIndex);
 
@@ -491,7 +749,7 @@ void BoundedCache<Lock>::readBlock(Request *req, std::unordered_map<uint32_t, st
                 updateRequestTime(req->time);
                 stats.end(prefetch, CacheStats::Metric::ovh);
                 stats.start(); //miss
-                _nextLevel->readBlock(req, reads, priority);
+                _nextLevel->readBlock(req, priority);
                 stats.end(prefetch, CacheStats::Metric::misses);
                 stats.start(); //ovh
             }
@@ -501,53 +759,15 @@ void BoundedCache<Lock>::readBlock(Request *req, std::unordered_map<uint32_t, st
                     updateRequestTime(req->time);
                     stats.end(prefetch, CacheStats::Metric::ovh);
                     stats.start(); //miss
-                    _nextLevel->readBlock(req, reads, priority);
+                    _nextLevel->readBlock(req, priority);
                     stats.end(prefetch, CacheStats::Metric::misses);
                     stats.start(); //ovh
                 }
                 else { // some else has reserved the block (meaning they are responsible for writing to the cache), we can wait for it to showup
-                    auto fut = std::async(std::launch::deferred, [this, req, blockIndex, prefetch] {
-                        // log(this) << _name << " read wait: blkIndex: " << blockIndex << " fi: " << fileIndex << " i:" << index << std::endl;
-                        uint64_t stime = Timer::getCurrentTime();
-                        char waitingCacheName[MAX_CACHE_NAME_LEN];
-                        waitingCacheName[0] = '\0';
-                        uint64_t cnt = 0;
-                        bool avail = false;
-                        uint8_t *buff = NULL;
-                        double curTime = (Timer::getCurrentTime() - stime) / 1000000000.0;
-                        while (!avail && curTime < _lastLevel->getRequestTime() * 10) {                      // exit loop if request is 10x times longer than average network request
-                            avail = blockAvailable(blockIndex, req->fileIndex, true, cnt, waitingCacheName); //maybe pass in a char* to capture the name of the originating cache?
-                            sched_yield();
-                            cnt++;
-                            curTime = (Timer::getCurrentTime() - stime) / 1000000000.0;
-                        }
-                        if (avail) {
-                            buff = getBlockData(blockIndex);
-                            req->data = buff;
-                            req->originating = this;
-                            req->ready = true;
-                            req->time = Timer::getCurrentTime() - req->time;
-                            updateRequestTime(req->time);
-                        }
-                        else {
-                            std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> reads;
-                            double reqTime = (Timer::getCurrentTime() - stime) / 1000000000.0;
-                            _lastLevel->readBlock(req, reads, 0); //rerequest block from last level, note this updates the request data structure so we do not need to update it manually;
-                            std::cout << "[TAZER] " << Timer::printTime() << " " << _name << " timeout, rereqeusting block " << req->blkIndex << " " << req->fileIndex << " " << getRequestTime() << " " << _lastLevel->getRequestTime() << " " << reqTime << " " << reads.size() << std::endl;
-                            reads[req->blkIndex].get().get();
-                            memset(waitingCacheName, 0, MAX_CACHE_NAME_LEN);
-                            memcpy(waitingCacheName, _lastLevel->name().c_str(), MAX_CACHE_NAME_LEN);
-                        }
-
-                        req->waitingCache = waitingCacheName;
-
-                        std::promise<Request *> prom;
-                        auto fut = prom.get_future();
-                        prom.set_value(req);
-                        // log(this) << _name << " done read wait: blkIndex: " << blockIndex << " fi: " << fileIndex << " i:" << index << std::endl;
-                        return fut.share();
-                    });
-                    reads[index] = fut.share();
+                    if (!prefetch) { //if a queued prefetch holds the reservation don't leave us stuck behind it
+                        _nextLevel->promoteBlock(fileIndex, index);
+                    }
+                    req->defer(this, blockIndex); //the waiting happens on the reader's thread in finishRequest
                     stats.end(prefetch, CacheStats::Metric::misses);
                     stats.start(); //ovh
                 }
@@ -577,9 +797,12 @@ void BoundedCache<Lock>::addFile(uint32_t index, std::string filename, uint64_t
     _localLock->writerLock();
     if (_fileMap.count(index) == 0) {
         std::string hashstr(_name + filename); //should cause each level of the cache to have different indicies for a given file
-        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), filename.size(), 0);
+        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), hashstr.size(), 0);
 
         _fileMap.emplace(index, FileEntry{filename, blockSize, fileSize, hash});
+        if (index < MAX_HASHED_FILES) {
+            _fileHashes[index].store(hash);
+        }
 
         //uint64_t temp = _fileMap[index];
     }
@@ -94,7 +94,7 @@
 #define DPRINTF(...)
 
 //TODO: create version that locks the file when reserved and only releases after it has written it...
-BoundedFilelockCache::BoundedFilelockCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity, std::string cachePath) : BoundedCache(cacheName, cacheSize, blockSize, associativity),
+BoundedFilelockCache::BoundedFilelockCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity, std::string cachePath) : BoundedCache(cacheName, cacheSize, blockSize, associativity, Config::boundedFilelockCacheEviction),
                                                                                                                                                            _open((unixopen_t)dlsym(RTLD_NEXT, "open")),
                                                                                                                                                            _close((unixclose_t)dlsym(RTLD_NEXT, "close")),
                                                                                                                                                            _read((unixread_t)dlsym(RTLD_NEXT, "read")),
@@ -375,7 +375,7 @@ std::vector<std::shared_ptr<BoundedCache<FcntlBoundedReaderWriterLock>::BlockEnt
 }
 
 //Must lock first!
-bool BoundedFilelockCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, char *origCache) {
+bool BoundedFilelockCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, uint8_t *origin) {
 
     bool avail = false;
     if (checkFs && !avail) {
@@ -387,15 +387,14 @@ bool BoundedFilelockCache::blockAvailable(unsigned int index, unsigned int fileI
         preadFromFile(fd, sizeof(entry), (uint8_t *)&entry, index * sizeof(entry));
         auto elapsed = Timer::getCurrentTime() - start;
         if (cnt % 200000 == 0) {
-            log(this) << "going to wait for " << elapsed / 1000000000.0 << " fi: " << fileIndex << " i:" << index << " wait status: " << entry.status << " " << std::string(entry.fileName) << " " << entry.blockIndex << " " << cnt << std::endl;
+            log(this) << "going to wait for " << elapsed / 1000000000.0 << " fi: " << fileIndex << " i:" << index << " wait status: " << (uint32_t)entry.status << " " << std::string(entry.fileName) << " " << entry.blockIndex << " " << cnt << std::endl;
             log(this) << _name << "rate: " << getRequestTime() << " " << _nextLevel->name() << " rate: " << _nextLevel->getRequestTime() << std::endl;
         }
 
         if (entry.status == BLK_AVAIL) {
             avail = true;
-            if (origCache) {
-                memset(origCache, 0, MAX_CACHE_NAME_LEN);
-                memcpy(origCache, entry.origCache, MAX_CACHE_NAME_LEN);
+            if (origin) {
+                *origin = entry.origin;
             }
         }
 
@@ -444,7 +443,7 @@ bool BoundedFilelockCache::anyUsers(uint32_t blk) {
     return _blkLock->lockAvail(blk) == 1;
 }
 
-void BoundedFilelockCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, std::string cacheName) {
+void BoundedFilelockCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, uint8_t origin) {
     FileBlockEntry entry;
     _localLock->readerLock();
     std::string name = _fileMap[fileIndex].name;
@@ -458,11 +457,13 @@ void BoundedFilelockCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t
     entry.blockIndex = blockIndex + 1;
     entry.status = status;
     entry.timeStamp = Timer::getTimestamp();
-    memset(entry.origCache, 0, MAX_CACHE_NAME_LEN);
-    memcpy(entry.origCache, cacheName.c_str(), MAX_CACHE_NAME_LEN);
+    entry.origin = origin;
     if (prefetched >= 0) {
         entry.prefetched = prefetched;
     }
+    BlockEntry current; //replacement state belongs to the slot, not the block
+    readBlockEntry(index, &current);
+    entry.eviction = current.eviction;
     // log(this) << "blkSet: " << entry.fileIndex << " " << entry.blockIndex << " " << entry.fileName << " " << entry.status << std::endl;
     writeFileBlockEntry(index, &entry);
 }
@@ -73,10 +73,19 @@
 //*EndLicense****************************************************************
 
 #include "Cache.h"
+#include "BlockSizeTranslationCache.h"
+#include "BoundedFilelockCache.h"
 #include "Config.h"
+#include "FcntlCache.h"
+#include "FileCache.h"
+#include "FilelockCache.h"
+#include "LocalFileCache.h"
+#include "MemoryCache.h"
+#include "SharedMemoryCache.h"
 #include "ThreadPool.h"
 #include "Timer.h"
 #include "xxhash.h"
+#include <algorithm>
 #include <chrono>
 #include <errno.h>
 #include <fcntl.h>
@@ -93,14 +102,28 @@
 #define DPRINTF(...)
 
 // ThreadPool<std::function<void()>> *Cache::_writePool = NULL;
-// PriorityThreadPool<std::function<void()>> Cache::_prefetchPool(1);
+// WorkStealingThreadPool<std::function<void()>> Cache::_prefetchPool(1);
 // std::mutex Cache::_pMutex;
 // std::unordered_set<std::string> Cache::_prefetches;
 
+//Index + 1 is the tier id, only ever append: ids are stored in caches shared by other processes and nodes
+static const char *const tierNames[] = {BASECACHENAME, MEMORYCACHENAME, SHAREDMEMORYCACHENAME, BURSTBUFFERCACHENAME, FILECACHENAME, BOUNDEDFILELOCKCACHENAME,
+                                        FILELOCKCACHENAME, FCNTLCACHENAME, LOCALFILECACHENAME, NETWORKCACHENAME, BLOCKSIZETRANSLATIONCACHENAME};
+
+uint8_t Cache::tierId(std::string name) {
+    for (uint8_t i = 0; i < sizeof(tierNames) / sizeof(tierNames[0]); i++) {
+        if (name == tierNames[i]) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
 Cache::Cache(std::string name) : Loggable(Config::CacheLog, name),
                                  _ioTime(0),
                                  _ioAmt(0),
                                  _name(name),
+                                 _tier(tierId(name)),
                                  _level(0),
                                  _nextLevel(NULL),
                                  _lastLevel(this),
@@ -115,7 +138,7 @@ Cache::Cache(std::string name) : Loggable(Config::CacheLog, name),
         // _fm_lock = new ReaderWriterLock();
         _writePool = new ThreadPool<std::function<void()>>(Config::numWriteBufferThreads, "write pool");
         _writePool->initiate();
-        _prefetchPool = new PriorityThreadPool<std::function<void()>>(Config::numPrefetchThreads, "prefetch pool");
+        _prefetchPool = new WorkStealingThreadPool<std::function<void()>>(Config::numPrefetchThreads, "prefetch pool");
         _prefetchPool->initiate();
         _base = this;
         _lastLevel = this;
@@ -231,25 +254,53 @@ bool Cache::writeBlock(Request *req) {
     return false;
 }
 
-Request *Cache::requestBlock(uint32_t index, uint64_t &size, uint32_t fileIndex, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority) {
-    Request *req = new Request(index, fileIndex, size, this, NULL);
-    Cache *tmp = this;
-    while (tmp) {
-        req->reservedMap[tmp] = 0;
-        tmp = tmp->getNextLevel();
-    }
-    req->ready = false;
-    log(this) << _name << " " << _nextLevel->name() << std::endl;
+Request *Cache::requestBlock(uint32_t index, uint64_t &size, uint32_t fileIndex, uint64_t priority, uint8_t *dest) {
+    Request *req = Request::allocate(index, fileIndex, size, this, NULL);
+    req->dest = dest;
     if (_nextLevel) {
-        _nextLevel->readBlock(req, reads, priority);
+        _nextLevel->readBlock(req, priority);
     }
     // log(this) << "req: " << (void *)req << std::endl;
     return req;
 }
 
-void Cache::readBlock(Request *req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority) {
+void Cache::readBlock(Request *req, uint64_t priority) {
+    if (_nextLevel) {
+        _nextLevel->readBlock(req, priority);
+    }
+}
+
+void Cache::finishRequest(Request *req, int64_t arg) {
+}
+
+void Cache::promoteBlock(uint32_t fileIndex, uint32_t blkIndex) {
+    if (_nextLevel) {
+        _nextLevel->promoteBlock(fileIndex, blkIndex);
+    }
+}
+
+bool Cache::lookupBlock(Request *req) {
     if (_nextLevel) {
-        _nextLevel->readBlock(req, reads, priority);
+        return _nextLevel->lookupBlock(req);
+    }
+    return false;
+}
+
+void Cache::shareBlock(Request *req) {
+    if (_nextLevel) {
+        _nextLevel->shareBlock(req);
+    }
+}
+
+void Cache::beginRequestBatch() {
+    if (_nextLevel) {
+        _nextLevel->beginRequestBatch();
+    }
+}
+
+void Cache::endRequestBatch() {
+    if (_nextLevel) {
+        _nextLevel->endRequestBatch();
     }
 }
 
@@ -300,6 +351,18 @@ Cache *Cache::getCacheByName(std::string name) {
     }
 }
 
+Cache *Cache::getCacheByTier(uint8_t tier) {
+    if (tier == _tier) {
+        return this;
+    }
+    else if (_nextLevel) {
+        return _nextLevel->getCacheByTier(tier);
+    }
+    else {
+        return NULL;
+    }
+}
+
 Cache *Cache::getNextLevel() {
     return _nextLevel;
 }
@@ -339,6 +402,26 @@ bool Cache::bufferWrite(Request *req) {
     return true;
 }
 
+std::future<bool> Cache::writeBlockAsync(Request *req) {
+    auto prom = std::make_shared<std::promise<bool>>();
+    auto fut = prom->get_future();
+    if (Config::bufferFileCacheWrites) {
+        _outstandingWrites.fetch_add(1);
+        _writePool->addTask([this, req, prom] {
+            bool ret = writeBlock(req);
+            if (!ret) {
+                DPRINTF("FAILED WRITE...\n");
+            }
+            _outstandingWrites.fetch_sub(1);
+            prom->set_value(ret);
+        });
+    }
+    else {
+        prom->set_value(writeBlock(req));
+    }
+    return fut;
+}
+
 void Cache::updateRequestTime(uint64_t time) {
     if (_ioCnt->load() < _ioWinSize) {
         _ioCnt->fetch_add(1);
@@ -368,24 +451,120 @@ void Cache::addFile(uint32_t index, std::string filename, uint64_t blockSize, st
     }
 }
 
+std::atomic<uint32_t> Cache::_prefetchWindows[MAX_PREFETCH_FILES];
+std::atomic<uint32_t> Cache::_prefetchEpochs[MAX_PREFETCH_FILES];
+std::atomic<uint32_t> Cache::_streamEpochs[MAX_PREFETCH_FILES][MAX_PREFETCH_STREAMS];
+
+uint32_t Cache::prefetchWindow(uint32_t fileIndex) {
+    uint32_t window = (fileIndex < MAX_PREFETCH_FILES) ? _prefetchWindows[fileIndex].load() : 0;
+    return window ? window : Config::numPrefetchBlks;
+}
+
+void Cache::prefetchUsed(uint32_t fileIndex) {
+    if (fileIndex >= MAX_PREFETCH_FILES)
+        return;
+    uint32_t window = _prefetchWindows[fileIndex].load();
+    uint32_t grown;
+    do {
+        uint32_t cur = window ? window : Config::numPrefetchBlks;
+        grown = std::min(cur + 1, std::max(Config::prefetchMaxDepth, Config::numPrefetchBlks));
+    } while (!_prefetchWindows[fileIndex].compare_exchange_weak(window, grown));
+}
+
+void Cache::prefetchWasted(uint32_t fileIndex) {
+    if (fileIndex >= MAX_PREFETCH_FILES)
+        return;
+    uint32_t window = _prefetchWindows[fileIndex].load();
+    uint32_t shrunk;
+    do {
+        uint32_t cur = window ? window : Config::numPrefetchBlks;
+        shrunk = std::max(cur / 2, 1u);
+    } while (!_prefetchWindows[fileIndex].compare_exchange_weak(window, shrunk));
+}
+
+uint32_t Cache::prefetchEpoch(uint32_t fileIndex) {
+    return (fileIndex < MAX_PREFETCH_FILES) ? _prefetchEpochs[fileIndex].load() : 0;
+}
+
+uint64_t Cache::prefetchEpoch(uint32_t fileIndex, uint32_t index) {
+    if (fileIndex >= MAX_PREFETCH_FILES)
+        return 0;
+    return ((uint64_t)_prefetchEpochs[fileIndex].load() << 32) | _streamEpochs[fileIndex][index % MAX_PREFETCH_STREAMS].load();
+}
+
+void Cache::cancelPrefetches(uint32_t fileIndex) {
+    if (fileIndex < MAX_PREFETCH_FILES)
+        _prefetchEpochs[fileIndex].fetch_add(1);
+}
+
+void Cache::cancelPrefetches(uint32_t fileIndex, uint32_t index) {
+    if (fileIndex < MAX_PREFETCH_FILES)
+        _streamEpochs[fileIndex][index % MAX_PREFETCH_STREAMS].fetch_add(1);
+}
+
 void Cache::prefetchBlocks(uint32_t index, std::vector<uint64_t> blocks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex) {
-    _prefetchPool->addTask(0, [this, index, blocks, fileSize, blkSize, regFileIndex] {
-        prefetch(index, blocks, fileSize, blkSize, regFileIndex);
+    uint32_t window = prefetchWindow(regFileIndex);
+    if (blocks.size() > window)
+        blocks.resize(window);
+    uint64_t epoch = prefetchEpoch(regFileIndex, index);
+    _prefetchPool->addTask(0, [this, index, blocks, fileSize, blkSize, regFileIndex, epoch] {
+        prefetch(index, blocks, fileSize, blkSize, regFileIndex, epoch);
     });
 }
 
-void Cache::prefetch(uint32_t index, std::vector<uint64_t> blocks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex) {
+//Runs entirely on the prefetch pool, the opener only queues it. Like prefetch, closing the file stops it requesting more blocks
+void Cache::prefetchFile(uint64_t fileSize, uint64_t blkSize, uint32_t regFileIndex) {
+    uint32_t epoch = prefetchEpoch(regFileIndex);
+    _prefetchPool->addTask(1, [this, fileSize, blkSize, regFileIndex, epoch] {
+        uint32_t numBlks = (fileSize + blkSize - 1) / blkSize;
+        std::vector<Request *> pending;
+
+        beginRequestBatch();
+        for (uint32_t blk = 0; blk < numBlks; blk++) {
+            if (prefetchEpoch(regFileIndex) != epoch) {
+                log(this) << _name << " whole file fetch cancelled for file " << regFileIndex << " at block " << blk << std::endl;
+                break;
+            }
+            uint64_t size = blkSize;
+            auto request = requestBlock(blk, size, regFileIndex, 1);
+            if (request->ready) {
+                bufferWrite(request);
+            }
+            else {
+                pending.push_back(request);
+            }
+        }
+        endRequestBatch();
+
+        //Every block is on its way before we wait on the first
+        for (auto request : pending) {
+            request->wait();
+            if (request->data) {
+                bufferWrite(request);
+                request->originating->stats.addAmt(true, CacheStats::Metric::read, blkSize);
+                stats.addAmt(true, CacheStats::Metric::read, blkSize);
+            }
+        }
+    });
+}
+
+//Blocks are only requested while the epoch (the file's and this reader's) is current, once requested they hold reservations in the caches and have to be seen through
+void Cache::prefetch(uint32_t index, std::vector<uint64_t> blocks, uint64_t fileSize, uint64_t blkSize, uint64_t regFileIndex, uint64_t epoch) {
     std::string sIndex = std::to_string(index) + "-";
-    std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> reads;
-    std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> net_reads;
-    std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> local_reads;
+    std::vector<Request *> net_reads;
+    std::vector<Request *> local_reads;
 
     int numBlks = blocks.size();
     uint64_t startBlk = blocks[0];
 
+    beginRequestBatch();
     for (auto blk : blocks) {
-        uint32_t priority = 1 + (blk - startBlk);
-        auto request = requestBlock(blk, blkSize, regFileIndex, reads, priority);
+        if (prefetchEpoch(regFileIndex, index) != epoch) {
+            log(this) << _name << " prefetch cancelled for file " << regFileIndex << " reader " << index << " at block " << blk << std::endl;
+            break;
+        }
+        uint32_t priority = 1 + ((blk > startBlk) ? blk - startBlk : startBlk - blk); //Distance from the first block, stride prefetches can run backwards
+        auto request = requestBlock(blk, blkSize, regFileIndex, priority);
         if (request->ready) { //the block was in a client side cache!!
             //std::cout << "********************Data was on client side!!!" <<std::endl;
             bufferWrite(request);
@@ -395,28 +574,26 @@ void Cache::prefetch(uint32_t index, std::vector<uint64_t> blocks, uint64_t file
             //std::cout << "********************Data prerequested!!!" <<std::endl;
 
             if (request->originating->name() == NETWORKCACHENAME) {
-                net_reads.insert(std::make_pair(blk, reads[blk]));
+                net_reads.push_back(request);
             }
             else {
-                local_reads.insert(std::make_pair(blk, reads[blk]));
+                local_reads.push_back(request);
             }
         }
     }
+    endRequestBatch();
 
-    for (auto it = net_reads.begin(); it != net_reads.end(); ++it) {
-        uint32_t blk = (*it).first;
-        auto request = (*it).second.get().get(); //need to do two gets cause we cant chain futures properly yet (c++ 2x supposedly)
-
+    for (auto request : net_reads) {
+        request->wait();
         if (request->data) { // hmm what does it mean if this is NULL? do we need to catch and report this?
             bufferWrite(request);
             request->originating->stats.addAmt(true, CacheStats::Metric::read, blkSize);
             stats.addAmt(true, CacheStats::Metric::read, blkSize);
         }
     }
-    for (auto it = local_reads.begin(); it != local_reads.end(); ++it) {
-        uint32_t blk = (*it).first;
-        auto request = (*it).second.get().get(); //need to do two gets cause we cant chain futures properly yet (c++ 2x supposedly)
-        if (request->data) {                     // hmm what does it mean if this is NULL? do we need to catch and report this?
+    for (auto request : local_reads) {
+        request->wait();
+        if (request->data) { // hmm what does it mean if this is NULL? do we need to catch and report this?
             bufferWrite(request);
             request->originating->stats.addAmt(true, CacheStats::Metric::read, blkSize);
             stats.addAmt(true, CacheStats::Metric::read, blkSize);
@@ -103,7 +103,10 @@ const char *metricName_cs[] = {
     "write",
     "read",
     "constructor",
-    "destructor"};
+    "destructor",
+    "admitted",
+    "rejected",
+    "wasted"};
 
 CacheStats::CacheStats() {
     for (int i = 0; i < lastMetric; i++) {
@@ -141,6 +144,12 @@ void CacheStats::print(std::string cacheName) {
             std::cout << "[TAZER] " << cacheName << " "
                       << "BW: " << (_amt[i][0] / 1000000.0) / ((_time[i][0] + _time[i][3] + _time[i][4]) / billion) << " effective BW: " << (_amt[i][7] / 1000000.0) / (_time[i][7] / billion) << std::endl;
         }
+        //Blocks prefetched into this level are the prefetch misses, demand hits on them are the request prefetches
+        uint64_t prefetched = _amt[prefetch][misses];
+        if (prefetched) {
+            std::cout << "[TAZER] " << cacheName << " "
+                      << "prefetch accuracy: " << (double)_amt[request][prefetches] / prefetched << " waste: " << (double)_amt[prefetch][wasted] / prefetched << std::endl;
+        }
         std::cout << std::endl;
     }
 
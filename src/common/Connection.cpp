@@ -77,6 +77,7 @@
 //#include "ErrorTester.h"
 #include "Message.h"
 #include "Timer.h"
+#include <algorithm>
 #include <signal.h>
 #include <sstream>
 #include <string.h>
@@ -88,6 +89,7 @@
 
 thread_local int _tlSocket = -1;
 thread_local int _tlSocketsClosed = 0;
+thread_local bool _tlSendOnly = false; //Set on server workers that only send on a socket
 
 thread_local uint64_t _tlSocketTime = 0;
 thread_local uint64_t _tlSocketBytes = 0;
@@ -104,6 +106,7 @@ static thread_local struct TlsCleaner {
 Connection::Connection(std::string hostAddr, int port) : //Client
                                                          Loggable(Config::ClientConLog, "ClientConLog"),
                                                          _numSockets(0),
+                                                         _exclusiveWaiting(0),
                                                          _nextSocket(0),
                                                          _inMsgs(-1),
                                                          _addr(hostAddr),
@@ -116,6 +119,7 @@ Connection::Connection(std::string hostAddr, int port) : //Client
 Connection::Connection(int sock, std::string clientAddr, int port) : //Server
                                                                      Loggable(Config::ServerConLog, "ServerConLog"),
                                                                      _numSockets(0),
+                                                                     _exclusiveWaiting(0),
                                                                      _nextSocket(0),
                                                                      _inMsgs(-1),
                                                                      _addr(clientAddr),
@@ -143,11 +147,16 @@ Connection::~Connection() {
         log(this) << "closed: " << _addr << ":" << _port << " num sockets" << socketsClosed << std::endl;
     }
     else {
+        for (auto &entry : _tagged) { //Replaced sockets whose close was still pending
+            if (entry.second->retired)
+                forceCloseSocket(entry.second->socket);
+        }
+        _tagged.clear();
         while (_numSockets.load() && _sockets.size()) {
             log(this) << _addr << " Client closing " << _numSockets.load() << " " << _sockets.size() << std::endl;
             if (closeSocket(_sockets.front()) == 0)
                 socketsClosed++;
-            _sockets.pop();
+            _sockets.pop_front();
         }
     }
     lock.unlock();
@@ -157,8 +166,10 @@ Connection::~Connection() {
 /*This lock is special and works differently depending on if it is client/server
  * Server: Works like a regular lock
  * Client: Pops a socket and sends thread local _tlSocket for sends and recvs
+ *         A tagged lock takes a socket that still has room for requests in flight,
+ *         otherwise we wait for a socket with nothing outstanding on it
  * */
-void Connection::lock() {
+void Connection::lock(bool tagged) {
 
     if (isServer()) {
         _sMutex.lock();
@@ -166,18 +177,28 @@ void Connection::lock() {
     }
     else {
         _tlSocket = -1;
+        std::unique_lock<std::mutex> lock(_sMutex);
+        if (!tagged)
+            _exclusiveWaiting++;
         while (_tlSocket < 0) {
-            std::unique_lock<std::mutex> lock(_sMutex);
-            if (_sockets.empty()) {
-                _cv.wait(lock);
-            }
-
-            if (!_sockets.empty()) {
-                _tlSocket = _sockets.front();
-                _sockets.pop();
+            //Exclusive users get priority so pipelines drain for them
+            if (!tagged || !_exclusiveWaiting) {
+                for (auto it = _sockets.begin(); it != _sockets.end(); it++) {
+                    auto entry = _tagged.find(*it);
+                    uint32_t inFlight = (entry == _tagged.end()) ? 0 : entry->second->inFlight;
+                    if ((tagged) ? inFlight < Config::maxRequestsInFlight : inFlight == 0) {
+                        _tlSocket = *it;
+                        _sockets.erase(it);
+                        break;
+                    }
+                }
             }
-            lock.unlock();
+            if (_tlSocket < 0)
+                _cv.wait(lock);
         }
+        if (!tagged)
+            _exclusiveWaiting--;
+        lock.unlock();
         TIMEON(_tlSocketBytes = 0);
         TIMEON(_tlSocketTime = Timer::getCurrentTime());
     }
@@ -196,15 +217,158 @@ int Connection::unlock() {
         TIMEON(_tlSocketTime = Timer::getCurrentTime() - _tlSocketTime);
         if (_tlSocket >= 0) {
             std::unique_lock<std::mutex> lock(_sMutex);
-            _sockets.push(_tlSocket);
+            auto entry = _tagged.find(_tlSocket);
+            if (entry != _tagged.end() && entry->second->failed) //A reader lost this socket while we held it
+                replaceSocket(_tlSocket);
+            else
+                _sockets.push_back(_tlSocket);
             lock.unlock();
-            _cv.notify_one();
+            _cv.notify_all();
             _tlSocket = -1;
         }
     }
     return 0;
 }
 
+/*Reserves a request id on the locked socket, call between lock(true) and unlock()
+ * The socket can be unlocked as soon as the request is sent, the response is
+ * collected with recvTagged and the id released with endTagged
+ * */
+std::shared_ptr<TaggedSocket> Connection::beginTagged(uint32_t &id) {
+    std::unique_lock<std::mutex> lock(_sMutex);
+    auto &tagged = _tagged[_tlSocket];
+    if (!tagged)
+        tagged = std::make_shared<TaggedSocket>(_tlSocket);
+    static std::atomic_uint nextId(0);
+    id = nextId.fetch_add(1);
+    tagged->inFlight++;
+    return tagged;
+}
+
+/*Waits for the next message tagged with id. Whoever is free reads the socket
+ * with recvOne and queues what it got for its owner. Returns false once the
+ * socket fails, the caller should re-request on another socket.
+ * */
+bool Connection::recvTagged(std::shared_ptr<TaggedSocket> tagged, uint32_t id, std::function<bool(Connection *, uint32_t &, std::shared_ptr<void> &)> recvOne, std::shared_ptr<void> &msg) {
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_sMutex);
+    while (1) {
+        auto entry = tagged->arrived.find(id);
+        if (entry != tagged->arrived.end()) {
+            msg = entry->second;
+            tagged->arrived.erase(entry);
+            ret = true;
+            break;
+        }
+        if (tagged->failed)
+            break;
+        if (!tagged->reading) {
+            tagged->reading = true;
+            lock.unlock();
+
+            uint32_t recvId = 0;
+            std::shared_ptr<void> recvMsg;
+            int old = _tlSocket;
+            _tlSocket = tagged->socket;
+            bool success = recvOne(this, recvId, recvMsg);
+            _tlSocket = old;
+
+            lock.lock();
+            tagged->reading = false;
+            if (success)
+                tagged->arrived.emplace(recvId, recvMsg);
+            else {
+                log(this) << _addr << " Tagged recv failed on socket " << tagged->socket << std::endl;
+                retireTagged(tagged);
+            }
+            releaseTagged(tagged);
+            tagged->cv.notify_all();
+        }
+        else {
+            tagged->cv.wait(lock);
+        }
+    }
+    lock.unlock();
+    return ret;
+}
+
+void Connection::endTagged(std::shared_ptr<TaggedSocket> tagged) {
+    std::unique_lock<std::mutex> lock(_sMutex);
+    tagged->inFlight--;
+    releaseTagged(tagged);
+    lock.unlock();
+    _cv.notify_all();
+}
+
+//Must lock _sMutex
+void Connection::retireTagged(std::shared_ptr<TaggedSocket> tagged) {
+    if (!tagged->failed) {
+        tagged->failed = true;
+        tagged->cv.notify_all();
+        auto it = std::find(_sockets.begin(), _sockets.end(), tagged->socket);
+        if (it != _sockets.end()) { //Otherwise the holder replaces it on unlock
+            _sockets.erase(it);
+            replaceSocket(tagged->socket);
+        }
+    }
+}
+
+//Must lock _sMutex
+void Connection::replaceSocket(int socket) {
+    log(this) << "Replacing socket: " << socket << std::endl;
+    rshutdown(socket, SHUT_RDWR); //Wakes anyone still blocked reading it
+    _numSockets.fetch_sub(1);
+    auto entry = _tagged.find(socket);
+    if (entry != _tagged.end()) { //Keep the fd open so its number isn't reused under a reader
+        entry->second->retired = true;
+        releaseTagged(entry->second);
+    }
+    else {
+        forceCloseSocket(socket);
+    }
+    addSocket();
+}
+
+//Must lock _sMutex
+void Connection::releaseTagged(std::shared_ptr<TaggedSocket> tagged) {
+    if (tagged->retired && tagged->socket > -1 && !tagged->reading && !tagged->inFlight) {
+        _tagged.erase(tagged->socket);
+        forceCloseSocket(tagged->socket);
+        tagged->socket = -1;
+    }
+}
+
+bool Connection::msgWaiting(int timeout) {
+    struct pollfd pfd;
+    pfd.fd = _tlSocket;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return (_tlSocket > -1 && rpoll(&pfd, 1, timeout) > 0 && (pfd.revents & (POLLIN | POLLERR | POLLHUP))); //Errors count, the next recv reports them
+}
+
+/*Server workers receive on the socket set here without any lock,
+ * the sends (which may race with block tasks) still take lockSocket
+ * */
+void Connection::setSocket(int socket) {
+    _tlSocket = socket;
+    _tlSendOnly = socket > -1;
+}
+
+/*Server workers send through these
+ * so responses on the same socket are not interleaved
+ * */
+void Connection::lockSocket(int socket) {
+    _sendMutex.lock();
+    _tlSocket = socket;
+    _tlSendOnly = true;
+}
+
+void Connection::unlockSocket() {
+    _tlSendOnly = false;
+    _tlSocket = -1;
+    _sendMutex.unlock();
+}
+
 void Connection::incCnt() {
     _consecutiveCnt++;
 }
@@ -243,7 +407,7 @@ bool Connection::addSocket() {
         int sock = initializeSocket();
         if (sock > 0) {
             log(this) << "New Socket: " << sock << std::endl;
-            _sockets.push(sock);
+            _sockets.push_back(sock);
             _numSockets.fetch_add(1);
             ret = true;
         }
@@ -293,6 +457,10 @@ int Connection::closeSocket(int &socket) {
     log(this) << "closing socket? " << localSocket << std::endl;
     int ret = -1;
     if (localSocket != -1) {
+        if (isServer() && _tlSendOnly) { //Workers don't own _pfds, shut it down and let the reactor reap it
+            rshutdown(localSocket, SHUT_RDWR);
+            return -1;
+        }
         if (isServer()) { //Stop polling this socket if on server
             //No need to lock since we already locked in the server!
             for (unsigned int i = 0; i < _pfds.size(); i++) { //Iterate and look for pfd to turn off
@@ -330,14 +498,31 @@ int Connection::closeSocket() {
     return closeSocket(_tlSocket);
 }
 
+/*Returns true if the caller can retry on a new socket. A tagged holder can't,
+ * its request was registered on the old socket, so we fail it there and the
+ * socket is replaced on unlock. The caller has to lock(true) again.
+ * */
 bool Connection::restartSocket() {
     bool ret = false;
     if (_tlSocket > 0) {
         log(this) << "Restarting socket: " << _tlSocket << std::endl;
+        std::unique_lock<std::mutex> lock(_sMutex);
+        auto entry = _tagged.find(_tlSocket);
+        if (entry != _tagged.end()) { //Fail anyone waiting on responses from the old socket
+            if (entry->second->inFlight) {
+                retireTagged(entry->second);
+                rshutdown(_tlSocket, SHUT_RDWR);
+                return ret;
+            }
+            _tagged.erase(entry);
+        }
+        lock.unlock();
         forceCloseSocket(_tlSocket);
         int socket = initializeSocket();
-        if (socket > 0)
+        if (socket > 0) {
             _tlSocket = socket;
+            ret = true;
+        }
         else {
             log(this) << "Failed to restart socket" << std::endl;
         }
@@ -0,0 +1,149 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "EvictionPolicy.h"
+#include "ARCPolicy.h"
+#include "ClockPolicy.h"
+#include "LRUPolicy.h"
+#include "TwoQPolicy.h"
+#include <iostream>
+
+EvictionPolicy::~EvictionPolicy() {
+}
+
+EvictionPolicy *EvictionPolicy::newEvictionPolicy(unsigned int type) {
+    switch (type) {
+    case LRU_EVICTION:
+        return new LRUPolicy();
+    case CLOCK_EVICTION:
+        return new ClockPolicy();
+    case ARC_EVICTION:
+        return new ARCPolicy();
+    case TWOQ_EVICTION:
+        return new TwoQPolicy();
+    default:
+        std::cerr << "[TAZER] "
+                  << "Eviction policy " << type << " doesn't exist, using LRU" << std::endl;
+        return new LRUPolicy();
+    }
+}
+
+//Oldest evictable slot, optionally only from one list
+int EvictionPolicy::oldest(std::vector<EvictionSlot> &bin, int queue, bool byAdmission) {
+    int ret = -1;
+    uint64_t minTime = (uint64_t)-1;
+    for (uint32_t i = 0; i < bin.size(); i++) {
+        if (bin[i].evictable && (queue < 0 || bin[i].state->queue == queue)) {
+            uint64_t time = byAdmission ? bin[i].state->admitted : bin[i].timeStamp;
+            if (ret < 0 || time < minTime) {
+                minTime = time;
+                ret = i;
+            }
+        }
+    }
+    return ret;
+}
+
+int EvictionPolicy::ghost(std::vector<EvictionSlot> &bin, uint32_t fileIndex, uint32_t blockIndex) {
+    for (uint32_t i = 0; i < bin.size(); i++) {
+        if (bin[i].state->ghostFileIndex == fileIndex && bin[i].state->ghostBlockIndex == blockIndex && bin[i].state->ghostQueue != EVICT_NONE) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint32_t EvictionPolicy::count(std::vector<EvictionSlot> &bin, uint8_t queue) {
+    uint32_t cnt = 0;
+    for (auto &slot : bin) {
+        cnt += (slot.valid && slot.state->queue == queue);
+    }
+    return cnt;
+}
+
+uint32_t EvictionPolicy::countGhosts(std::vector<EvictionSlot> &bin, uint8_t queue) {
+    uint32_t cnt = 0;
+    for (auto &slot : bin) {
+        cnt += (slot.state->ghostQueue == queue);
+    }
+    return cnt;
+}
+
+//The slot's occupant is being evicted, it replaces whatever ghost the slot held
+void EvictionPolicy::remember(EvictionSlot &slot) {
+    slot.state->ghostFileIndex = slot.fileIndex;
+    slot.state->ghostBlockIndex = slot.blockIndex;
+    slot.state->ghostQueue = slot.state->queue;
+    slot.dirty = true;
+}
@@ -78,8 +78,10 @@
 #include "Timer.h"
 #include "xxhash.h"
 #include <chrono>
+#include <errno.h>
 #include <experimental/filesystem>
 #include <fcntl.h>
+#include <new>
 #include <string.h>
 #include <string>
 #include <sys/mman.h>
@@ -90,23 +92,39 @@
 //#define DPRINTF(...) fprintf(stderr, __VA_ARGS__)
 #define DPRINTF(...)
 
+//The byte between the block data and the index records whether the index on disk matches the data,
+//bump INDEX_CLEAN whenever MemBlockEntry changes so older indices are not trusted
+#define INDEX_CLEAN 4
+#define INDEX_DIRTY 0
+#define DIRECT_ALIGN 4096
+#define MAX_POOLED_BUFS 64
+
 //this cache exists on a single node
-FileCache::FileCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity, std::string filePath) : BoundedCache(cacheName, cacheSize, blockSize, associativity),
+FileCache::FileCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity, std::string filePath) : BoundedCache(cacheName, cacheSize, blockSize, associativity, (cacheName == FILECACHENAME) ? Config::fileCacheEviction : Config::burstBufferCacheEviction),
                                                                                                                                     _fullFlag(0),
                                                                                                                                     _open((unixopen_t)dlsym(RTLD_NEXT, "open")),
                                                                                                                                     _close((unixclose_t)dlsym(RTLD_NEXT, "close")),
-                                                                                                                                    _read((unixread_t)dlsym(RTLD_NEXT, "read")),
-                                                                                                                                    _write((unixwrite_t)dlsym(RTLD_NEXT, "write")),
-                                                                                                                                    _lseek((unixlseek_t)dlsym(RTLD_NEXT, "lseek")),
-                                                                                                                                    _fsync((unixfdatasync_t)dlsym(RTLD_NEXT, "fsync")) {
+                                                                                                                                    _pread((unixpread_t)dlsym(RTLD_NEXT, "pread")),
+                                                                                                                                    _pwrite((unixpwrite_t)dlsym(RTLD_NEXT, "pwrite")),
+                                                                                                                                    _fdatasync((unixfdatasync_t)dlsym(RTLD_NEXT, "fdatasync")) {
     //_pid = (unsigned int)getpid();
     stats.start();
     _blocksfd = -1;
+    _directfd = -1;
     _blkIndexfd = -1;
+    _indexOffset = _cacheSize + 1;
 
     _filePath = filePath + "/" + Config::tazer_id + "_" + _name + "_" + std::to_string(_cacheSize) + "_" + std::to_string(_blockSize) + "_" + std::to_string(_associativity) + ".tzr";
-    std::string indexPath("/" + Config::tazer_id + "_" + _name + "_" + std::to_string(_cacheSize) + "_" + std::to_string(_blockSize) + "_" + std::to_string(_associativity) + ".idx");
+    std::string indexPath("/" + Config::tazer_id + "_" + _name + "_" + std::to_string(_cacheSize) + "_" + std::to_string(_blockSize) + "_" + std::to_string(_associativity) + "_v" + std::to_string(SHM_LAYOUT_VERSION) + ".idx");
 
+    //init flag, then the index and bin keys from cache line boundaries, then the bin locks, admission sketch and index state.
+    //The extra bin lock guards checkpoints, block writes take it shared
+    bool admission = (cacheName == FILECACHENAME) ? Config::fileCacheAdmission : Config::burstBufferCacheAdmission;
+    uint64_t keysOffset = INDEX_ALIGN + ((_numBlocks * sizeof(MemBlockEntry) + INDEX_ALIGN - 1) / INDEX_ALIGN) * INDEX_ALIGN;
+    uint64_t lockOffset = keysOffset + _numBlocks * sizeof(uint64_t);
+    uint64_t sketchOffset = lockOffset + MultiReaderWriterLock::getDataSize(_numBins + 1);
+    uint64_t stateOffset = sketchOffset + FrequencySketch::getDataSize(_numBlocks);
+    uint64_t shmSize = stateOffset + sizeof(IndexState) + sizeof(bool);
     bool *indexInit;
     if (Config::enableSharedMem) {
         _blkIndexfd = shm_open(indexPath.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
@@ -115,16 +133,20 @@ FileCache::FileCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSi
             log(this) << _name << "reusing shared memory" << std::endl;
             _blkIndexfd = shm_open(indexPath.c_str(), O_RDWR, 0644);
             if (_blkIndexfd != -1) {
-                ftruncate(_blkIndexfd, sizeof(uint32_t) + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins) + sizeof(bool));
-                void *ptr = mmap(NULL, sizeof(uint32_t) + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins) + sizeof(bool), PROT_READ | PROT_WRITE, MAP_SHARED, _blkIndexfd, 0);
+                ftruncate(_blkIndexfd, shmSize);
+                void *ptr = mmap(NULL, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, _blkIndexfd, 0);
                 uint32_t *init = (uint32_t *)ptr;
                 while (!*init) {
                     sched_yield();
                 }
-                _blkIndex = (MemBlockEntry *)((uint8_t *)init + sizeof(uint32_t));
-                auto binLockDataAddr = (uint8_t *)_blkIndex + _numBlocks * sizeof(MemBlockEntry);
-                _binLock = new MultiReaderWriterLock(_numBins, binLockDataAddr);
-                indexInit = (bool *)((uint8_t *)binLockDataAddr + MultiReaderWriterLock::getDataSize(_numBins));
+                _blkIndex = (MemBlockEntry *)((uint8_t *)ptr + INDEX_ALIGN);
+                _blkKeys = (uint64_t *)((uint8_t *)ptr + keysOffset);
+                _binLock = new MultiReaderWriterLock(_numBins + 1, (uint8_t *)ptr + lockOffset);
+                if (admission) {
+                    _sketch = new FrequencySketch(_numBlocks, (uint8_t *)ptr + sketchOffset);
+                }
+                _indexState = (IndexState *)((uint8_t *)ptr + stateOffset);
+                indexInit = (bool *)(_indexState + 1);
             }
             else {
                 std::cerr << "[TAZER]"
@@ -134,28 +156,40 @@ FileCache::FileCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSi
         else {
             DPRINTF("Created shared memory\n");
             log(this) << _name << "created shared memory" << std::endl;
-            ftruncate(_blkIndexfd, sizeof(uint32_t) + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins) + sizeof(bool));
-            void *ptr = mmap(NULL, sizeof(uint32_t) + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins) + sizeof(bool), PROT_READ | PROT_WRITE, MAP_SHARED, _blkIndexfd, 0);
+            ftruncate(_blkIndexfd, shmSize);
+            void *ptr = mmap(NULL, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, _blkIndexfd, 0);
 
             uint32_t *init = (uint32_t *)ptr;
             *init = 0;
-            _blkIndex = (MemBlockEntry *)((uint8_t *)init + sizeof(uint32_t));
+            _blkIndex = (MemBlockEntry *)((uint8_t *)ptr + INDEX_ALIGN);
+            _blkKeys = (uint64_t *)((uint8_t *)ptr + keysOffset);
             // _lock = new ((uint8_t *)_blkIndex + _numBlocks * sizeof(MemBlockEntry)) ReaderWriterLock();
-            auto binLockDataAddr = (uint8_t *)_blkIndex + _numBlocks * sizeof(MemBlockEntry);
-            _binLock = new MultiReaderWriterLock(_numBins, binLockDataAddr, true);
-            indexInit = (bool *)((uint8_t *)binLockDataAddr + MultiReaderWriterLock::getDataSize(_numBins));
+            _binLock = new MultiReaderWriterLock(_numBins + 1, (uint8_t *)ptr + lockOffset, true);
+            if (admission) {
+                _sketch = new FrequencySketch(_numBlocks, (uint8_t *)ptr + sketchOffset, true);
+            }
+            _indexState = new ((uint8_t *)ptr + stateOffset) IndexState();
+            indexInit = (bool *)(_indexState + 1);
             _binLock->writerLock(0);
             memset(_blkIndex, 0, _numBlocks * sizeof(MemBlockEntry));
+            memset(_blkKeys, 0, _numBlocks * sizeof(uint64_t));
             *indexInit = false;
             _binLock->writerUnlock(0);
             *init = 1;
         }
     }
     else {
-        _blkIndex = new MemBlockEntry[_numBlocks];
-        auto binLockDataAddr = new uint8_t[MultiReaderWriterLock::getDataSize(_numBins)];
+        posix_memalign((void **)&_blkIndex, INDEX_ALIGN, _numBlocks * sizeof(MemBlockEntry));
+        posix_memalign((void **)&_blkKeys, INDEX_ALIGN, _numBlocks * sizeof(uint64_t));
+        _binLock = new MultiReaderWriterLock(_numBins + 1);
+        if (admission) {
+            _sketch = new FrequencySketch(_numBlocks);
+        }
+        _indexState = new IndexState();
+        indexInit = new bool(false);
         _binLock->writerLock(0);
         memset(_blkIndex, 0, _numBlocks * sizeof(MemBlockEntry));
+        memset(_blkKeys, 0, _numBlocks * sizeof(uint64_t));
         _binLock->writerUnlock(0);
     }
 
@@ -174,16 +208,8 @@ FileCache::FileCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSi
         std::experimental::filesystem::create_directories(filePath, err);
         _blocksfd = (*_open)(_filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644); //Open file for writing
         if (_blocksfd > -1) {
-            (*_lseek)(_blocksfd, _cacheSize, SEEK_SET);
-            //This is so we can read cat the data...
-            uint8_t byte = '\0';
-            writeToFile(sizeof(uint8_t), &byte);
-            MemBlockEntry tmp = {};
-            for (uint32_t i = 0; i < _numBlocks; i++) {
-                writeToFile(sizeof(MemBlockEntry), (uint8_t *)&tmp);
-            }
-            (*_fsync)(_blocksfd); //flush changes
-            (*_lseek)(_blocksfd, 0, SEEK_SET);
+            //Sized up front (reads back as zeros) so we can cat the data and an empty index...
+            ftruncate(_blocksfd, _indexOffset + _numBlocks * sizeof(MemBlockEntry));
             DPRINTF("Created file %s fileName: %s\n", _filePath.c_str(), _fileName.c_str());
         }
         else {
@@ -191,9 +217,30 @@ FileCache::FileCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSi
                       << "Failed to open file cache: " << _filePath << " " << strerror(errno) << std::endl;
         }
     }
+    if (_blocksfd > -1 && Config::fileCacheDirectIO) {
+        if (_blockSize % DIRECT_ALIGN == 0) {
+            _directfd = (*_open)(_filePath.c_str(), O_RDWR | O_DIRECT);
+        }
+        if (_directfd == -1) {
+            log(this) << _name << " direct io unavailable, using the page cache " << strerror(errno) << std::endl;
+        }
+    }
     if (!(*indexInit)) {
-        (*_lseek)(_blocksfd, _cacheSize + 1, SEEK_SET);
-        readFromFile(_numBlocks * sizeof(MemBlockEntry), (uint8_t *)_blkIndex);
+        //Only trust an index that was checkpointed after the last block write
+        uint8_t state = INDEX_DIRTY;
+        if (_blocksfd > -1) {
+            readFromFile(sizeof(uint8_t), &state, _cacheSize);
+        }
+        if (state == INDEX_CLEAN) {
+            readFromFile(_numBlocks * sizeof(MemBlockEntry), (uint8_t *)_blkIndex, _indexOffset);
+            for (uint32_t i = 0; i < _numBlocks; i++) {
+                setBlockKey(i, _blkIndex[i].fileIndex, _blkIndex[i].blockIndex);
+            }
+        }
+        else {
+            log(this) << _name << " index was not checkpointed, starting empty" << std::endl;
+        }
+        _indexState->dirty.store(state != INDEX_CLEAN);
         *indexInit = true;
     }
     _binLock->writerUnlock(0);
@@ -206,43 +253,76 @@ FileCache::~FileCache() {
         << "[TAZER] " << _name << " deleting" << std::endl;
     for (size_t i = 0; i < _numBlocks; i++) {
         if (_blkIndex[i].activeCnt > 0) {
-            std::cout << "[TAZER] " << _name << " " << i << " " << _numBlocks << " " << _blkIndex[i].activeCnt << " " << _blkIndex[i].fileIndex << " " << _blkIndex[i].blockIndex << " prefetched: " << _blkIndex[i].prefetched << std::endl;
+            std::cout << "[TAZER] " << _name << " " << i << " " << _numBlocks << " " << _blkIndex[i].activeCnt << " " << _blkIndex[i].fileIndex << " " << _blkIndex[i].blockIndex << " prefetched: " << (uint32_t)_blkIndex[i].prefetched << std::endl;
         }
     }
 
-    _binLock->writerLock(0);
-    (*_lseek)(_blocksfd, _cacheSize + 1, SEEK_SET);
-    writeToFile(_numBlocks * sizeof(MemBlockEntry), (uint8_t *)_blkIndex);
-    (*fsync)(_blocksfd);
-    _binLock->writerUnlock(0);
-    std::string cacheName("/" + Config::tazer_id + "_" + _name + "_" + std::to_string(_cacheSize) + "_" + std::to_string(_blockSize) + "_" + std::to_string(_associativity) + ".idx");
+    checkpoint();
+    std::string cacheName("/" + Config::tazer_id + "_" + _name + "_" + std::to_string(_cacheSize) + "_" + std::to_string(_blockSize) + "_" + std::to_string(_associativity) + "_v" + std::to_string(SHM_LAYOUT_VERSION) + ".idx");
     shm_unlink(cacheName.c_str());
     _blkIndexfd = -1;
+    if (_directfd > -1) {
+        (*_close)(_directfd);
+        _directfd = -1;
+    }
     (*_close)(_blocksfd);
     _blocksfd = -1;
+    for (auto buf : _bufs) {
+        free(buf);
+    }
     stats.end(false, CacheStats::Metric::destructor);
     stats.print(_name);
     std::cout << std::endl;
 }
 
+//Block writes only wait on a sync when they are the first since a checkpoint, to mark the index on disk stale
 void FileCache::setBlockData(uint8_t *data, unsigned int blockIndex, uint64_t size) {
-    (*_lseek)(_blocksfd, blockIndex * _blockSize, SEEK_SET);
-    writeToFile(size, data);
-    (*fsync)(_blocksfd);
+    _binLock->readerLock(_numBins);
+    while (!_indexState->dirty.load()) {
+        _binLock->readerUnlock(_numBins);
+        _binLock->writerLock(_numBins);
+        if (!_indexState->dirty.load()) {
+            uint8_t state = INDEX_DIRTY;
+            writeToFile(sizeof(uint8_t), &state, _cacheSize);
+            (*_fdatasync)(_blocksfd);
+            _indexState->dirty.store(true);
+        }
+        _binLock->writerUnlock(_numBins);
+        _binLock->readerLock(_numBins);
+    }
+    writeBlockFile(size, data, (uint64_t)blockIndex * _blockSize);
+    _binLock->readerUnlock(_numBins);
+
+    if (Config::fileCacheCheckpointBlocks && (_indexState->written.fetch_add(1) + 1) % Config::fileCacheCheckpointBlocks == 0) {
+        checkpoint();
+    }
 }
 
 uint8_t *FileCache::getBlockData(unsigned int blockIndex) {
     uint64_t dstart = Timer::getCurrentTime();
-    uint8_t *buff = new uint8_t[_blockSize];
-    (*_lseek)(_blocksfd, blockIndex * _blockSize, SEEK_SET);
-    readFromFile(_blockSize, buff);
+    uint8_t *buff = allocBuffer();
+    readBlockFile(_blockSize, buff, (uint64_t)blockIndex * _blockSize);
     //_dataTime += Timer::getCurrentTime() - dstart;
     //_dataAmt += _blockSize;
     return buff;
 }
 
+uint8_t *FileCache::readBlockData(uint32_t blockIndex, Request *req) {
+    if (req->dest && req->size <= _blockSize) {
+        readBlockFile(req->size, req->dest, (uint64_t)blockIndex * _blockSize);
+        return req->dest;
+    }
+    return getBlockData(blockIndex);
+}
+
 void FileCache::cleanUpBlockData(uint8_t *data) {
-    delete[] data;
+    std::unique_lock<std::mutex> lock(_bufLock);
+    if (_bufs.size() < MAX_POOLED_BUFS) {
+        _bufs.push_back(data);
+    }
+    else {
+        free(data);
+    }
 }
 
 Cache *FileCache::addNewFileCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity, std::string filePath) {
@@ -254,55 +334,157 @@ Cache *FileCache::addNewFileCache(std::string cacheName, uint64_t cacheSize, uin
         });
 }
 
-void FileCache::writeToFile(uint64_t size, uint8_t *buff) {
+//Block buffers are aligned so they can go straight to an O_DIRECT fd
+uint8_t *FileCache::allocBuffer() {
+    {
+        std::unique_lock<std::mutex> lock(_bufLock);
+        if (!_bufs.empty()) {
+            uint8_t *buff = _bufs.back();
+            _bufs.pop_back();
+            return buff;
+        }
+    }
+    void *buff = NULL;
+    if (posix_memalign(&buff, DIRECT_ALIGN, _blockSize)) {
+        buff = NULL;
+    }
+    return (uint8_t *)buff;
+}
+
+//Snapshot the index and mark it clean on disk, once every block it calls available is durable
+void FileCache::checkpoint() {
+    if (_blocksfd < 0) {
+        return;
+    }
+    _binLock->writerLock(_numBins); //no block writes in flight
+    MemBlockEntry *snapshot = new MemBlockEntry[_numBlocks]();
+    for (uint32_t bin = 0; bin < _numBins; bin++) {
+        _binLock->readerLock(bin);
+        for (uint32_t i = bin * _associativity; i < (bin + 1) * _associativity; i++) {
+            if (_blkIndex[i].status == BLK_AVAIL) {
+                *(BlockEntry *)&snapshot[i] = *(BlockEntry *)&_blkIndex[i];
+            }
+            else {
+                memset((BlockEntry *)&snapshot[i], 0, sizeof(BlockEntry));
+            }
+            snapshot[i].activeCnt = 0;
+        }
+        _binLock->readerUnlock(bin);
+    }
+    (*_fdatasync)(_blocksfd);
+    writeToFile(_numBlocks * sizeof(MemBlockEntry), (uint8_t *)snapshot, _indexOffset);
+    uint8_t state = INDEX_CLEAN;
+    writeToFile(sizeof(uint8_t), &state, _cacheSize);
+    (*_fdatasync)(_blocksfd);
+    _indexState->dirty.store(false);
+    _binLock->writerUnlock(_numBins);
+    delete[] snapshot;
+}
+
+void FileCache::writeToFile(uint64_t size, uint8_t *buff, uint64_t offset) {
     uint8_t *local = buff;
     while (size) {
-        int bytes = (*_write)(_blocksfd, local, size);
+        ssize_t bytes = (*_pwrite)(_blocksfd, local, size, offset);
         if (bytes >= 0) {
             local += bytes;
             size -= bytes;
+            offset += bytes;
         }
-        else {
-            *this << "Failed a write " << _blocksfd << " " << size << std::endl;
+        else if (errno != EINTR) {
+            *this << "Failed a write " << _blocksfd << " " << size << " " << strerror(errno) << std::endl;
+            return;
         }
     }
 }
 
-void FileCache::readFromFile(uint64_t size, uint8_t *buff) {
+void FileCache::readFromFile(uint64_t size, uint8_t *buff, uint64_t offset) {
     uint8_t *local = buff;
     while (size) {
         //uint64_t t = Timer::getCurrentTime();
-        int bytes = (*_read)(_blocksfd, local, size);
+        ssize_t bytes = (*_pread)(_blocksfd, local, size, offset);
         //readTime.fetch_add(Timer::getCurrentTime() - t);
 
-        if (bytes >= 0) {
+        if (bytes > 0) {
             local += bytes;
             size -= bytes;
+            offset += bytes;
         }
-        else {
-            *this << "Failed a read " << _blocksfd << " " << size << std::endl;
+        else if (bytes == 0 || errno != EINTR) {
+            *this << "Failed a read " << _blocksfd << " " << size << " " << strerror(errno) << std::endl;
+            return;
         }
     }
 }
 
-void FileCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, std::string cacheName) {
+//O_DIRECT needs aligned memory and lengths, anything else is staged through a pooled block buffer
+void FileCache::writeBlockFile(uint64_t size, uint8_t *buff, uint64_t offset) {
+    if (_directfd < 0) {
+        writeToFile(size, buff, offset);
+        return;
+    }
+    uint64_t alignedSize = (size + DIRECT_ALIGN - 1) & ~(uint64_t)(DIRECT_ALIGN - 1);
+    uint8_t *staged = buff;
+    if ((uint64_t)buff % DIRECT_ALIGN || alignedSize != size) {
+        staged = allocBuffer();
+        memcpy(staged, buff, size);
+        memset(staged + size, 0, alignedSize - size);
+    }
+    uint64_t done = 0;
+    while (done < alignedSize) {
+        ssize_t bytes = (*_pwrite)(_directfd, staged + done, alignedSize - done, offset + done);
+        if (bytes > 0) {
+            done += bytes;
+        }
+        else if (bytes == 0 || errno != EINTR) {
+            *this << "Failed a direct write " << _directfd << " " << alignedSize - done << " " << strerror(errno) << std::endl;
+            break;
+        }
+    }
+    if (staged != buff) {
+        cleanUpBlockData(staged);
+    }
+}
+
+void FileCache::readBlockFile(uint64_t size, uint8_t *buff, uint64_t offset) {
+    if (_directfd < 0) {
+        readFromFile(size, buff, offset);
+        return;
+    }
+    uint64_t alignedSize = (size + DIRECT_ALIGN - 1) & ~(uint64_t)(DIRECT_ALIGN - 1);
+    uint8_t *staged = ((uint64_t)buff % DIRECT_ALIGN || alignedSize != size) ? allocBuffer() : buff;
+    uint64_t done = 0;
+    while (done < alignedSize) {
+        ssize_t bytes = (*_pread)(_directfd, staged + done, alignedSize - done, offset + done);
+        if (bytes > 0) {
+            done += bytes;
+        }
+        else if (bytes == 0 || errno != EINTR) {
+            *this << "Failed a direct read " << _directfd << " " << alignedSize - done << " " << strerror(errno) << std::endl;
+            break;
+        }
+    }
+    if (staged != buff) {
+        memcpy(buff, staged, size);
+        cleanUpBlockData(staged);
+    }
+}
+
+void FileCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, uint8_t origin) {
     _blkIndex[index].fileIndex = fileIndex + 1;
     _blkIndex[index].blockIndex = blockIndex + 1;
+    setBlockKey(index, fileIndex + 1, blockIndex + 1);
     _blkIndex[index].timeStamp = Timer::getCurrentTime();
     if (prefetched >= 0) {
         _blkIndex[index].prefetched = prefetched;
     }
-    memset(_blkIndex[index].origCache, 0, MAX_CACHE_NAME_LEN);
-    memcpy(_blkIndex[index].origCache, cacheName.c_str(), MAX_CACHE_NAME_LEN);
+    _blkIndex[index].origin = origin;
     _blkIndex[index].status = status;
 }
 
-bool FileCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, char *origCache) {
+bool FileCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, uint8_t *origin) {
     bool avail = _blkIndex[index].status == BLK_AVAIL;
-    if (origCache && avail) {
-        memset(origCache, 0, MAX_CACHE_NAME_LEN);
-        memcpy(origCache, _blkIndex[index].origCache, MAX_CACHE_NAME_LEN);
-        std::cout << _name << " " << _blkIndex[index].origCache << std::endl;
+    if (origin && avail) {
+        *origin = _blkIndex[index].origin;
         return true;
     }
     return avail;
@@ -317,6 +499,7 @@ void FileCache::writeBlockEntry(uint32_t blockIndex, BlockEntry *entry) {
 
     //MemBlockEntry* mentry = (MemBlockEntry*)entry;
     *(BlockEntry *)&_blkIndex[blockIndex] = *entry;
+    setBlockKey(blockIndex, entry->fileIndex, entry->blockIndex);
     //memcpy(&_blkIndex[blockIndex], entry, sizeof(BlockEntry));
 }
 
@@ -353,6 +536,10 @@ bool FileCache::anyUsers(uint32_t blk) {
     return _blkIndex[blk].activeCnt;
 }
 
+BoundedCache<MultiReaderWriterLock>::BlockWaitWord *FileCache::blockWaitWord(uint32_t blk) {
+    return &_blkIndex[blk].wait;
+}
+
 // TODO: reimplement this for current cache structure (note the below code was for the old structure)
 
 // void FileCache::cleanReservation() {
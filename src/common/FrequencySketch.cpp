@@ -0,0 +1,176 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "FrequencySketch.h"
+#include <string.h>
+
+#define COUNTER_MAX 15
+#define HALF_MASK 0x7777777777777777ULL //clears the bit shifted in from the neighbouring counter
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//At least one counter per block, so a cache full of distinct blocks rarely shares a counter in every row
+uint64_t FrequencySketch::rowWidth(uint32_t numBlocks) {
+    uint64_t width = 16;
+    while (width < numBlocks) {
+        width <<= 1;
+    }
+    return width;
+}
+
+uint64_t FrequencySketch::getDataSize(uint32_t numBlocks) {
+    return sizeof(std::atomic<uint64_t>) + (SKETCH_DEPTH * rowWidth(numBlocks) / 16) * sizeof(std::atomic<uint64_t>);
+}
+
+FrequencySketch::FrequencySketch(uint32_t numBlocks) : _width(rowWidth(numBlocks)),
+                                                       _sampleSize(10 * (uint64_t)numBlocks),
+                                                       _dataAddr(NULL) {
+    uint64_t size = getDataSize(numBlocks);
+    uint8_t *data = new uint8_t[size];
+    memset(data, 0, size);
+    _samples = (std::atomic<uint64_t> *)data;
+    _table = _samples + 1;
+}
+
+FrequencySketch::FrequencySketch(uint32_t numBlocks, uint8_t *dataAddr, bool init) : _width(rowWidth(numBlocks)),
+                                                                                     _sampleSize(10 * (uint64_t)numBlocks),
+                                                                                     _dataAddr(dataAddr) {
+    _samples = (std::atomic<uint64_t> *)_dataAddr;
+    _table = _samples + 1;
+    if (init) {
+        memset(_dataAddr, 0, getDataSize(numBlocks));
+    }
+}
+
+FrequencySketch::~FrequencySketch() {
+    if (!_dataAddr) {
+        delete[](uint8_t *) _samples;
+    }
+}
+
+void FrequencySketch::counter(uint64_t hash, uint32_t row, uint64_t &word, uint32_t &shift) {
+    uint64_t index = row * _width + (((hash >> 32) + row * (hash & 0xffffffff)) & (_width - 1));
+    word = index / 16;
+    shift = (index % 16) * 4;
+}
+
+void FrequencySketch::increment(uint64_t key) {
+    uint64_t hash = mix(key);
+    for (uint32_t row = 0; row < SKETCH_DEPTH; row++) {
+        uint64_t word;
+        uint32_t shift;
+        counter(hash, row, word, shift);
+        uint64_t cur = _table[word].load();
+        while (((cur >> shift) & COUNTER_MAX) < COUNTER_MAX && !_table[word].compare_exchange_weak(cur, cur + (1ULL << shift))) {
+        }
+    }
+    //exactly one caller sees the count reach the period and does the halving
+    if (_samples->fetch_add(1) + 1 == _sampleSize) {
+        halve();
+        _samples->fetch_sub(_sampleSize / 2);
+    }
+}
+
+uint32_t FrequencySketch::frequency(uint64_t key) {
+    uint64_t hash = mix(key);
+    uint32_t freq = COUNTER_MAX;
+    for (uint32_t row = 0; row < SKETCH_DEPTH; row++) {
+        uint64_t word;
+        uint32_t shift;
+        counter(hash, row, word, shift);
+        uint32_t count = (_table[word].load() >> shift) & COUNTER_MAX;
+        if (count < freq) {
+            freq = count;
+        }
+    }
+    return freq;
+}
+
+bool FrequencySketch::admit(uint64_t candidate, uint64_t victim) {
+    return frequency(candidate) > frequency(victim);
+}
+
+void FrequencySketch::halve() {
+    uint64_t words = SKETCH_DEPTH * _width / 16;
+    for (uint64_t i = 0; i < words; i++) {
+        uint64_t cur = _table[i].load();
+        while (!_table[i].compare_exchange_weak(cur, (cur >> 1) & HALF_MASK)) {
+        }
+    }
+}
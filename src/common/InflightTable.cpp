@@ -0,0 +1,219 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+
+#include "InflightTable.h"
+#include "Config.h"
+#include "Timer.h"
+#include "xxhash.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+InflightTable::InflightTable(uint32_t numSlots) : _numSlots(numSlots),
+                                                  _size((uint64_t)numSlots * sizeof(Slot)),
+                                                  _slots(NULL) {
+    std::string filePath("/" + Config::tazer_id + "_inflight_" + std::to_string(_numSlots));
+    int fd = shm_open(filePath.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+        std::cerr << "[TAZER] "
+                  << "Error opening in flight table " << strerror(errno) << std::endl;
+        return;
+    }
+    ftruncate(fd, _size); //a new segment reads as zeros, i.e. every slot free, so whoever gets here first needs no init
+    void *ptr = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr != MAP_FAILED) {
+        _slots = (Slot *)ptr;
+    }
+}
+
+InflightTable::~InflightTable() {
+    if (_slots) {
+        munmap(_slots, _size);
+    }
+}
+
+InflightTable *InflightTable::openInflightTable() {
+    if (!Config::inflightTableSize || !Config::enableSharedMem) {
+        return NULL;
+    }
+    InflightTable *table = new InflightTable(Config::inflightTableSize);
+    if (!table->_slots) {
+        delete table;
+        table = NULL;
+    }
+    return table;
+}
+
+uint64_t InflightTable::blockKey(uint32_t fileIndex, uint32_t blkIndex) {
+    return ((uint64_t)(fileIndex + 1) << 32) | (blkIndex + 1);
+}
+
+uint32_t InflightTable::slotIndex(uint64_t key) {
+    return XXH64(&key, sizeof(key), 0) % _numSlots;
+}
+
+//The owner's process is gone, or it has held the block so long its claim was most likely leaked. Without an
+//owner the claim is still being filled in, that only counts once the caller has seen it that way (since) too long.
+bool InflightTable::abandoned(Slot &slot, uint32_t owner, uint64_t since) {
+    uint64_t timeout = Config::inflightTimeout * 1000000000.0;
+    if (!owner) {
+        return Timer::getCurrentTime() - since > timeout;
+    }
+    uint64_t claimTime = slot.claimTime.load();
+    if (!claimTime) { //being released
+        return false;
+    }
+    if (kill(owner, 0) == -1 && errno == ESRCH) {
+        return true;
+    }
+    return Timer::getCurrentTime() - claimTime > timeout;
+}
+
+//The time goes in first, an owner is never seen next to a stale time
+void InflightTable::take(Slot &slot) {
+    slot.claimTime.store(Timer::getCurrentTime());
+    slot.owner.store(getpid());
+}
+
+InflightTable::Claim InflightTable::claim(uint32_t fileIndex, uint32_t blkIndex, uint32_t &slot) {
+    uint64_t key = blockKey(fileIndex, blkIndex);
+    slot = slotIndex(key);
+    Slot &s = _slots[slot];
+    uint64_t cur = s.key.load();
+    while (cur != key) {
+        if (cur && !abandoned(s, s.owner.load(), Timer::getCurrentTime())) {
+            return UNTRACKED;
+        }
+        if (s.key.compare_exchange_weak(cur, key)) { //free, or left behind by a dead process
+            take(s);
+            return OWNER;
+        }
+    }
+    return WAIT;
+}
+
+void InflightTable::release(uint32_t fileIndex, uint32_t blkIndex) {
+    uint64_t key = blockKey(fileIndex, blkIndex);
+    Slot &s = _slots[slotIndex(key)];
+    if (s.key.load() != key) {
+        return;
+    }
+    //Clear the owner before the key so the next claim of the slot never starts out with our pid and time
+    s.owner.store(0);
+    s.claimTime.store(0);
+    if (s.key.compare_exchange_strong(key, 0)) { //whoever releases has the block in place, even an owner that was given up on
+        s.seq.fetch_add(1);
+        if (s.waiters.load()) {
+            syscall(SYS_futex, (uint32_t *)&s.seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+        }
+    }
+}
+
+//Not a private futex, the word is shared with the other processes on the node
+bool InflightTable::wait(uint32_t slot, uint32_t fileIndex, uint32_t blkIndex) {
+    uint64_t key = blockKey(fileIndex, blkIndex);
+    Slot &s = _slots[slot];
+    struct timespec ts;
+    ts.tv_sec = (time_t)INFLIGHT_POLL_INTERVAL;
+    ts.tv_nsec = (long)((INFLIGHT_POLL_INTERVAL - ts.tv_sec) * 1000000000.0);
+    uint64_t since = Timer::getCurrentTime();
+    while (true) {
+        uint32_t seq = s.seq.load(); //read before checking so a release in between is not missed
+        if (s.key.load() != key) {
+            return true;
+        }
+        uint32_t owner = s.owner.load();
+        if (abandoned(s, owner, since)) {
+            if (s.owner.compare_exchange_strong(owner, getpid())) { //only one waiter inherits the fetch
+                s.claimTime.store(Timer::getCurrentTime());
+                return s.key.load() != key; //released and reclaimed while we looked, nothing to inherit
+            }
+            continue;
+        }
+        s.waiters.fetch_add(1);
+        syscall(SYS_futex, (uint32_t *)&s.seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+        s.waiters.fetch_sub(1);
+    }
+}
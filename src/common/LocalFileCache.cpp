@@ -126,7 +126,7 @@ bool LocalFileCache::writeBlock(Request *req) {
     // //log(this) /*std::cout*/<<"[TAZER] "<<_name<<" writeblock "<<std::hex<<(void*)buffer<<std::dec<<std::endl;
     if (req->originating == this) {
         delete[] req->data;
-        delete req;
+        Request::release(req);
     }
     else if (_nextLevel) {
         ret &= _nextLevel->writeBlock(req);
@@ -134,7 +134,7 @@ bool LocalFileCache::writeBlock(Request *req) {
     return ret;
 }
 
-void LocalFileCache::readBlock(Request *req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority) {
+void LocalFileCache::readBlock(Request *req, uint64_t priority) {
     stats.start(); //read
     stats.start(); //ovh
     log(this) << _name << " entering read " << req->blkIndex << " " << req->fileIndex << " " << priority << std::endl;
@@ -170,7 +170,7 @@ void LocalFileCache::readBlock(Request *req, std::unordered_map<uint32_t, std::s
         stats.start(); //ovh
         req->data = buff;
         req->originating = this;
-        req->reservedMap[this] = 1;
+        req->reserved[_level] = 1;
         req->ready = true;
         req->time = Timer::getCurrentTime() - req->time;
         updateRequestTime(req->time);
@@ -182,7 +182,7 @@ void LocalFileCache::readBlock(Request *req, std::unordered_map<uint32_t, std::s
         updateRequestTime(req->time);
         stats.end(prefetch, CacheStats::Metric::ovh);
         stats.start(); //misses
-        _nextLevel->readBlock(req, reads, priority);
+        _nextLevel->readBlock(req, priority);
         stats.end(prefetch, CacheStats::Metric::misses);
         stats.start(); //ovh
     }
@@ -204,7 +204,7 @@ void LocalFileCache::addFile(uint32_t index, std::string filename, uint64_t bloc
     _lock->writerLock();
     if (_fileMap.count(index) == 0) {
         std::string hashstr(_name + filename); //should cause each level of the cache to have different indicies for a given file
-        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), filename.size(), 0);
+        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), hashstr.size(), 0);
         bool compress = false;
 
         _fileMap.emplace(index, FileEntry{filename, blockSize, fileSize, hash});
@@ -0,0 +1,274 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "MarkovPrefetcher.h"
+#include "Config.h"
+#include "Loggable.h"
+#include "xxhash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <experimental/filesystem>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/file.h>
+#include <unistd.h>
+
+std::mutex *MarkovPrefetcher::_instancesMutex = new std::mutex;
+std::unordered_set<MarkovPrefetcher *> *MarkovPrefetcher::_instances = new std::unordered_set<MarkovPrefetcher *>;
+
+MarkovPrefetcher::MarkovPrefetcher(std::string name, std::string fileName) : Prefetcher(name) {
+    std::stringstream ss;
+    ss << Config::markovModelPath << "/" << std::hex << XXH64(fileName.c_str(), fileName.size(), 0) << ".markov";
+    _path = ss.str();
+    bool loaded = load(_path, _model);
+    *this << "[TAZER] " << _name << " Constructing " << _name << " model " << _path << " loaded: " << loaded << " blocks: " << _model.size() << std::endl;
+
+    std::unique_lock<std::mutex> lock(*_instancesMutex);
+    _instances->insert(this);
+}
+
+MarkovPrefetcher::~MarkovPrefetcher() {
+    std::unique_lock<std::mutex> lock(*_instancesMutex);
+    _instances->erase(this);
+    lock.unlock();
+
+    std::unique_lock<std::mutex> modelLock(_lock);
+    bool saved = save();
+    *this << "[TAZER] " << _name << " Ending " << _name << " saved: " << saved << std::endl;
+}
+
+void MarkovPrefetcher::saveAll() {
+    std::unique_lock<std::mutex> lock(*_instancesMutex);
+    for (auto prefetcher : *_instances) {
+        std::unique_lock<std::mutex> modelLock(prefetcher->_lock);
+        prefetcher->save();
+    }
+}
+
+//Counts saturate by halving the node, and a successor that isn't tracked wears down the least frequent one until it can take its place
+void MarkovPrefetcher::addTransition(Model &model, uint32_t from, uint32_t to, uint16_t cnt) {
+    Node &node = model[from];
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < MARKOV_SUCCESSORS; i++) {
+        if (node.count[i] && node.next[i] == to) {
+            slot = i;
+            break;
+        }
+        if (node.count[i] < node.count[slot])
+            slot = i;
+    }
+
+    if (node.count[slot] && node.next[slot] == to) {
+        if ((uint32_t)node.count[slot] + cnt > UINT16_MAX) {
+            for (uint32_t i = 0; i < MARKOV_SUCCESSORS; i++)
+                node.count[i] /= 2;
+        }
+        node.count[slot] = std::min((uint32_t)node.count[slot] + cnt, (uint32_t)UINT16_MAX);
+    }
+    else if (node.count[slot] <= cnt) {
+        node.next[slot] = to;
+        node.count[slot] = cnt;
+    }
+    else {
+        node.count[slot] -= cnt;
+    }
+}
+
+bool MarkovPrefetcher::load(std::string path, Model &model) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    uint32_t magic = 0, version = 0;
+    uint64_t numNodes = 0;
+    file.read((char *)&magic, sizeof(magic));
+    file.read((char *)&version, sizeof(version));
+    file.read((char *)&numNodes, sizeof(numNodes));
+    if (!file || magic != MARKOV_MAGIC || version != MARKOV_VERSION)
+        return false;
+
+    for (uint64_t i = 0; i < numNodes; i++) {
+        uint32_t from;
+        Node node;
+        file.read((char *)&from, sizeof(from));
+        file.read((char *)&node, sizeof(node));
+        if (!file)
+            return false;
+        model[from] = node;
+    }
+    return true;
+}
+
+//Other tasks may have saved since we loaded, so merge what we learned into the current model and swap it in with a rename.
+//Caller holds _lock.
+bool MarkovPrefetcher::save() {
+    if (_learned.empty())
+        return false;
+
+    std::error_code err;
+    std::experimental::filesystem::create_directories(Config::markovModelPath, err);
+    //Other processes save to the same model, hold its lock from the load to the rename so none of their transitions get dropped
+    int lockFd = open((_path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (lockFd < 0)
+        return false;
+    flock(lockFd, LOCK_EX);
+
+    Model merged;
+    load(_path, merged);
+    for (auto &entry : _learned) {
+        for (uint32_t i = 0; i < MARKOV_SUCCESSORS; i++) {
+            if (entry.second.count[i])
+                addTransition(merged, entry.first, entry.second.next[i], entry.second.count[i]);
+        }
+    }
+
+    bool ret = false;
+    std::string tmpPath = _path + ".tmp" + std::to_string(getpid());
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+        uint32_t magic = MARKOV_MAGIC, version = MARKOV_VERSION;
+        uint64_t numNodes = merged.size();
+        file.write((char *)&magic, sizeof(magic));
+        file.write((char *)&version, sizeof(version));
+        file.write((char *)&numNodes, sizeof(numNodes));
+        for (auto &entry : merged) {
+            file.write((char *)&entry.first, sizeof(entry.first));
+            file.write((char *)&entry.second, sizeof(entry.second));
+        }
+        file.close();
+        ret = file && !rename(tmpPath.c_str(), _path.c_str());
+        if (!ret)
+            unlink(tmpPath.c_str());
+    }
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+    if (ret)
+        _learned.clear(); //It is on disk now, don't merge it in twice
+    return ret;
+}
+
+std::vector<uint64_t> MarkovPrefetcher::getBlocks(uint32_t fileIndex, uint64_t startBlk, uint64_t endBlk, uint64_t numBlocks, uint64_t blkSize, uint64_t fileSize) {
+    std::vector<uint64_t> blocks;
+    uint32_t cur = startBlk;
+
+    std::unique_lock<std::mutex> lock(_lock);
+    auto last = _lastBlk.find(fileIndex);
+    if (last != _lastBlk.end()) {
+        if (last->second == cur) //Still inside the same block, nothing new to learn or predict
+            return blocks;
+        addTransition(_model, last->second, cur, 1);
+        addTransition(_learned, last->second, cur, 1);
+    }
+    _lastBlk[fileIndex] = cur;
+
+    //Assume the next access is about as long as this one
+    uint64_t numFileBlks = (fileSize + blkSize - 1) / blkSize;
+    uint64_t blksPerAccess = (endBlk > startBlk) ? endBlk - startBlk : 1;
+
+    //Every successor likely enough on the first step, then the most likely path for the rest
+    for (uint64_t step = 0; step < std::max(numBlocks, (uint64_t)1); step++) {
+        auto it = _model.find(cur);
+        if (it == _model.end())
+            break;
+        Node &node = it->second;
+
+        uint32_t order[MARKOV_SUCCESSORS];
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < MARKOV_SUCCESSORS; i++) {
+            order[i] = i;
+            total += node.count[i];
+        }
+        std::sort(order, order + MARKOV_SUCCESSORS, [&node](uint32_t a, uint32_t b) { return node.count[a] > node.count[b]; });
+
+        for (uint32_t i = 0; i < MARKOV_SUCCESSORS && (i == 0 || step == 0); i++) {
+            uint32_t s = order[i];
+            if (!node.count[s] || node.count[s] * 100 < total * Config::markovThreshold)
+                break;
+            for (uint64_t blk = node.next[s]; blk < node.next[s] + blksPerAccess && blk < numFileBlks; blk++) {
+                if ((blk < startBlk || blk >= endBlk) && std::find(blocks.begin(), blocks.end(), blk) == blocks.end())
+                    blocks.push_back(blk);
+            }
+        }
+
+        uint32_t best = order[0];
+        if (!node.count[best] || node.count[best] * 100 < total * Config::markovThreshold)
+            break;
+        cur = node.next[best];
+    }
+
+    *this << "[TAZER] " << _name << " Getting list of blocks to prefetch --> " << blocks2String(blocks) << std::endl;
+    return blocks;
+}
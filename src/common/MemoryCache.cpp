@@ -86,6 +86,7 @@
 #include <csignal>
 #include <fcntl.h>
 #include <future>
+#include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <sys/mman.h>
@@ -97,16 +98,21 @@
 #define DPRINTF(...)
 
 //single process, but shared across threads
-MemoryCache::MemoryCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity) : BoundedCache(cacheName, cacheSize, blockSize, associativity) {
+MemoryCache::MemoryCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity) : BoundedCache(cacheName, cacheSize, blockSize, associativity, Config::memoryCacheEviction) {
     std::cout << "[TAZER] "
               << "Constructing " << _name << " in memory cache" << std::endl;
     stats.start();
     _binLock = new MultiReaderWriterLock(_numBins);
     _binLock->writerLock(0);
     _blocks = new uint8_t[_cacheSize];
-    _blkIndex = new MemBlockEntry[_numBlocks];
+    posix_memalign((void **)&_blkIndex, INDEX_ALIGN, _numBlocks * sizeof(MemBlockEntry));
+    posix_memalign((void **)&_blkKeys, INDEX_ALIGN, _numBlocks * sizeof(uint64_t));
     memset(_blocks, 0, _cacheSize);
     memset(_blkIndex, 0, _numBlocks * sizeof(MemBlockEntry));
+    memset(_blkKeys, 0, _numBlocks * sizeof(uint64_t));
+    if (Config::memoryCacheAdmission) {
+        _sketch = new FrequencySketch(_numBlocks);
+    }
     // log(this) << (void *)_blkIndex << " " << (void *)((uint8_t *)_blkIndex + (_numBlocks * sizeof(BlockEntry))) << std::endl;
     _binLock->writerUnlock(0);
     stats.end(false, CacheStats::Metric::constructor);
@@ -119,11 +125,12 @@ MemoryCache::~MemoryCache() {
     for (size_t i = 0; i < _numBlocks; i++) {
         if (_blkIndex[i].activeCnt > 0) { // this typically means we reserved a block via prefetching but never honored the reservation, so try to prefetch again... this should probably be read?
             std::cout
-                << "[TAZER] " << _name << " " << i << " " << _numBlocks << " " << _blkIndex[i].activeCnt << " " << _blkIndex[i].fileIndex << " " << _blkIndex[i].blockIndex << " prefetched: " << _blkIndex[i].prefetched << std::endl;
+                << "[TAZER] " << _name << " " << i << " " << _numBlocks << " " << _blkIndex[i].activeCnt << " " << _blkIndex[i].fileIndex << " " << _blkIndex[i].blockIndex << " prefetched: " << (uint32_t)_blkIndex[i].prefetched << std::endl;
         }
     }
     delete[] _blocks;
-    delete[] _blkIndex;
+    free(_blkIndex);
+    free(_blkKeys);
     delete _binLock;
     stats.end(false, CacheStats::Metric::destructor);
     stats.print(_name);
@@ -155,27 +162,25 @@ uint8_t *MemoryCache::getBlockData(unsigned int blockIndex) {
 //Must lock first!
 //This uses the actual index (it does not do a search)
 
-void MemoryCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, std::string cacheName) {
+void MemoryCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, uint8_t origin) {
     _blkIndex[index].fileIndex = fileIndex + 1;
     _blkIndex[index].blockIndex = blockIndex + 1;
+    setBlockKey(index, fileIndex + 1, blockIndex + 1);
     _blkIndex[index].timeStamp = Timer::getCurrentTime();
     if (prefetched >= 0) {
         _blkIndex[index].prefetched = prefetched;
     }
     // if (status == BLK_AVAIL) {
-    //     std::cout << "setting block " << _name << " was: " << _blkIndex[index].origCache << " now: " << cacheName << std::endl;
+    //     std::cout << "setting block " << _name << " was: " << (uint32_t)_blkIndex[index].origin << " now: " << (uint32_t)origin << std::endl;
     // }
-    memset(_blkIndex[index].origCache, 0, MAX_CACHE_NAME_LEN);
-    memcpy(_blkIndex[index].origCache, cacheName.c_str(), MAX_CACHE_NAME_LEN);
+    _blkIndex[index].origin = origin;
     _blkIndex[index].status = status;
 }
 
-bool MemoryCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, char *origCache) {
+bool MemoryCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, uint8_t *origin) {
     bool avail = _blkIndex[index].status == BLK_AVAIL;
-    if (origCache && avail) {
-        memset(origCache, 0, MAX_CACHE_NAME_LEN);
-        memcpy(origCache, _blkIndex[index].origCache, MAX_CACHE_NAME_LEN);
-        // std::cout << _name << " " << _blkIndex[index].origCache << std::endl;
+    if (origin && avail) {
+        *origin = _blkIndex[index].origin;
         return true;
     }
     return avail;
@@ -187,6 +192,7 @@ void MemoryCache::readBlockEntry(uint32_t blockIndex, BlockEntry *entry) {
 }
 void MemoryCache::writeBlockEntry(uint32_t blockIndex, BlockEntry *entry) {
     *(BlockEntry *)&_blkIndex[blockIndex] = *entry;
+    setBlockKey(blockIndex, entry->fileIndex, entry->blockIndex);
     // memcpy(&_blkIndex[blockIndex], entry, sizeof(BlockEntry));
 }
 
@@ -222,6 +228,10 @@ bool MemoryCache::anyUsers(uint32_t blk) {
     return _blkIndex[blk].activeCnt;
 }
 
+BoundedCache<MultiReaderWriterLock>::BlockWaitWord *MemoryCache::blockWaitWord(uint32_t blk) {
+    return &_blkIndex[blk].wait;
+}
+
 Cache *MemoryCache::addNewMemoryCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity) {
     // std::string newFileName("MemoryCache");
     return Trackable<std::string, Cache *>::AddTrackable(
@@ -152,7 +152,7 @@ bool checkMsg(char *pkt, unsigned int size) {
                     break;
                 case WRITE_MSG: {
                     writeMsg *packet = (writeMsg *)pkt;
-                    checkSize += sizeof(writeMsg) + packet->dataSize;
+                    checkSize += sizeof(writeMsg) + packet->compSize;
                     //                        PRINTF("sizeof(writeMsg): %u packet->dataSize %u recSize: %u\n", sizeof(writeMsg), packet->dataSize, checkSize);
                     break;
                 }
@@ -200,9 +200,8 @@ bool clientSendRetry(Connection *connection, char *buff, unsigned int size) {
         ret = (size == connection->sendMsg(buff, size));
         if (ret)
             break;
-        else {
-            connection->restartSocket();
-        }
+        else if (!connection->restartSocket()) //Tagged requests are resent by the caller on another socket
+            break;
     }
     return ret;
 }
@@ -284,7 +283,7 @@ std::string parseOpenFileMsg(char *pkt, unsigned int &blkSize, bool &compress, b
     return name;
 }
 //-------------Request a block
-bool sendRequestBlkMsg(Connection *connection, std::string name, unsigned int start, unsigned int end) {
+bool sendRequestBlkMsg(Connection *connection, std::string name, unsigned int start, unsigned int end, unsigned int id) {
     unsigned int fileNameSize = name.size() + 1;
     unsigned int size = sizeof(requestBlkMsg) + fileNameSize;
     char *buff = new char[size];
@@ -292,6 +291,7 @@ bool sendRequestBlkMsg(Connection *connection, std::string name, unsigned int st
     requestBlkMsg *packet = (requestBlkMsg *)buff;
     packet->start = start;
     packet->end = end;
+    packet->id = id;
     name.copy((char *)(packet + 1), name.size());
     buff[size - 1] = '\0';
     //    bool ret = (size == connection->sendMsg(buff, size));
@@ -300,10 +300,11 @@ bool sendRequestBlkMsg(Connection *connection, std::string name, unsigned int st
     return ret;
 }
 
-std::string parseRequestBlkMsg(char *pkt, unsigned int &start, unsigned int &end) {
+std::string parseRequestBlkMsg(char *pkt, unsigned int &start, unsigned int &end, unsigned int &id) {
     requestBlkMsg *packet = (requestBlkMsg *)pkt;
     start = packet->start;
     end = packet->end;
+    id = packet->id;
     std::string name(packet->name);
     return name;
 }
@@ -375,7 +376,7 @@ bool sendPingMsg(Connection *connection) {
 
 bool sendWriteMsg(Connection *connection, std::string name, char *pkt, unsigned int dataSize, unsigned int compSize, uint64_t fp, unsigned int sn) {
     unsigned int fileNameSize = name.size() + 1;
-    unsigned int size = sizeof(writeMsg) + fileNameSize + dataSize;
+    unsigned int size = sizeof(writeMsg) + fileNameSize + compSize; //compSize == dataSize when not compressed
     fillMsgHeader(pkt, WRITE_MSG, fileNameSize, size);
     writeMsg *packet = (writeMsg *)pkt;
     packet->dataSize = dataSize;
@@ -384,20 +385,21 @@ bool sendWriteMsg(Connection *connection, std::string name, char *pkt, unsigned
     packet->sn = sn;
     PRINTF("Send fp size: %lu sn: %u\n", packet->fp, sn);
     name.copy((char *)(packet + 1), name.size());
-    packet->data[fileNameSize - 1] = '\0';
+    ((char *)(packet + 1))[fileNameSize - 1] = '\0'; //data is only a placeholder, the name and data follow the struct
     bool ret = clientSendRetry(connection, (char *)packet, size);
     delete[] pkt;
     return ret;
 }
 
-std::string parseWriteMsg(char *pkt, char **data, unsigned int &dataSize, unsigned int &compSize, uint64_t &fp) {
+std::string parseWriteMsg(char *pkt, char **data, unsigned int &dataSize, unsigned int &compSize, uint64_t &fp, unsigned int &sn) {
     writeMsg *packet = (writeMsg *)pkt;
     dataSize = packet->dataSize;
     compSize = packet->compSize;
     fp = packet->fp;
+    sn = packet->sn;
     PRINTF("Rec fp size: %lu vs %lu %u\n", fp, packet->fp, packet->sn);
-    (*data) = &packet->data[packet->header.fileNameSize];
-    std::string name(packet->data);
+    (*data) = (char *)(packet + 1) + packet->header.fileNameSize;
+    std::string name((char *)(packet + 1));
     return name;
 }
 
@@ -469,19 +471,19 @@ bool sendSendBlkMsg(Connection *connection, std::string name, unsigned int blk,
 }
 
 //This is a special one that should eliminate an extra memcpy
-std::string recSendBlkMsg(Connection *connection, char **data, unsigned int &blk, unsigned int &dataSize, unsigned int dataBufSize) {
+//No retry here, other requests are in flight on this socket so the caller has to fail them all
+std::string recSendBlkMsg(Connection *connection, char **data, unsigned int &blk, unsigned int &dataSize, unsigned int &id, unsigned int dataBufSize, blkDestFunc dest) {
     blk = 0;
     dataSize = 0;
+    id = 0;
     sendBlkMsg msg;
-    //    int64_t retMsgSize = connection->recvMsg((char*)&msg, sizeof(sendBlkMsg));
-    int64_t retMsgSize = clientRecRetryCount(connection, (char *)&msg, sizeof(sendBlkMsg));
+    int64_t retMsgSize = connection->recvMsg((char *)&msg, sizeof(sendBlkMsg));
     //    std::cout<<"[TAZER] " << "Msg Size: " << retMsgSize << std::endl;
-    if (retMsgSize < 0) //Make sure rec was successful
+    if (retMsgSize != (int64_t)sizeof(sendBlkMsg) || msg.header.magic != MAGIC || msg.header.type != SEND_BLK_MSG) //Make sure rec was successful
         return std::string();
 
     char *namebuf = new char[msg.header.fileNameSize];
-    //    int retFileNameSize = connection->recvMsg(namebuf, msg.header.fileNameSize);
-    int64_t retFileNameSize = clientRecRetryCount(connection, namebuf, msg.header.fileNameSize);
+    int64_t retFileNameSize = connection->recvMsg(namebuf, msg.header.fileNameSize);
     //    std::cout<<"[TAZER] " << "File Name Size: " << retFileNameSize << std::endl;
     if (retFileNameSize < 0) {
         delete[] namebuf;
@@ -490,16 +492,18 @@ std::string recSendBlkMsg(Connection *connection, char **data, unsigned int &blk
     std::string fileName(namebuf, msg.header.fileNameSize);
     delete[] namebuf;
 
+    if (*data == NULL && dest) {
+        *data = dest(msg.id, msg.blk, msg.dataSize);
+    }
     bool created = (*data == NULL);
     if (created) {
-        if (dataBufSize == 0) {
+        if (dataBufSize < msg.dataSize) { //Incompressible blocks come back bigger than a block
             dataBufSize = msg.dataSize;
         }
         *data = new char[dataBufSize];
     }
 
-    //    int retDataSize = connection->recvMsg(*data, msg.dataSize);
-    int64_t retDataSize = clientRecRetryCount(connection, *data, msg.dataSize);
+    int64_t retDataSize = connection->recvMsg(*data, msg.dataSize);
     //    std::cout<<"[TAZER] " << "Data Size: " << retDataSize << std::endl;
     if (retDataSize < 0) {
         if (created) {
@@ -514,6 +518,7 @@ std::string recSendBlkMsg(Connection *connection, char **data, unsigned int &blk
         retDataSize == (int64_t)msg.dataSize) {
         dataSize = msg.dataSize;
         blk = msg.blk;
+        id = msg.id;
         return fileName;
     }
 
@@ -521,15 +526,29 @@ std::string recSendBlkMsg(Connection *connection, char **data, unsigned int &blk
         delete[] * data;
         *data = NULL;
     }
-    return fileName;
+    return std::string(); //A borrowed buffer is only partly filled, the name is all the caller can tell failure by
+}
+//Reads whatever block arrives next on a pipelined socket, used with Connection::recvTagged
+bool recTaggedBlkMsg(Connection *connection, uint32_t &id, std::shared_ptr<void> &msg, unsigned int dataBufSize, blkDestFunc dest) {
+    auto blkMsg = std::make_shared<taggedBlk>();
+    auto borrow = [&blkMsg, dest](unsigned int id, unsigned int blk, unsigned int dataSize) {
+        char *buf = dest(id, blk, dataSize);
+        blkMsg->borrowed = (buf != NULL);
+        return buf;
+    };
+    blkMsg->name = recSendBlkMsg(connection, &blkMsg->data, blkMsg->blk, blkMsg->dataSize, id, dataBufSize, (dest) ? blkDestFunc(borrow) : NULL);
+    msg = blkMsg;
+    return (!blkMsg->name.empty() && blkMsg->data != NULL);
 }
 //-------------Send an ack msg
-bool sendAckMsg(Connection *connection, msgType ackType) {
+bool sendAckMsg(Connection *connection, msgType ackType, unsigned int sn, bool failed) {
     unsigned int size = sizeof(ackMsg);
     char *buff = new char[size];
     fillMsgHeader(buff, ACK_MSG, 0, size);
     ackMsg *packet = (ackMsg *)buff;
     packet->ackType = ackType;
+    packet->sn = sn;
+    packet->failed = failed;
     //    bool ret = (size == connection->sendMsg(buff, size));
     bool ret = serverSendClose(connection, buff, size);
     delete[] buff;
@@ -537,8 +556,21 @@ bool sendAckMsg(Connection *connection, msgType ackType) {
 }
 
 bool recAckMsg(Connection *connection, msgType expMstType) {
-    ackMsg msg;
+    unsigned int sn;
+    return recAckMsg(connection, expMstType, sn);
+}
+
+bool recAckMsg(Connection *connection, msgType expMstType, unsigned int &sn) {
+    bool failed;
+    return recAckMsg(connection, expMstType, sn, failed);
+}
+
+//Returns whether an ack arrived, failed is set if it reports the server could not do what it acks
+bool recAckMsg(Connection *connection, msgType expMstType, unsigned int &sn, bool &failed) {
+    ackMsg msg = {};
     int64_t retMsgSize = connection->recvMsg((char *)&msg, sizeof(ackMsg));
+    sn = msg.sn;
+    failed = msg.failed;
     return (retMsgSize == sizeof(ackMsg) && expMstType == msg.ackType);
 }
 
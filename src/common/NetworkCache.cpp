@@ -82,6 +82,7 @@
 #include "lz4.h"
 #include "xxhash.h"
 
+#include <algorithm>
 #include <chrono>
 #include <fcntl.h>
 #include <future>
@@ -96,11 +97,12 @@
 //#define DPRINTF(...) fprintf(stderr, __VA_ARGS__)
 #define DPRINTF(...)
 
-NetworkCache::NetworkCache(std::string cacheName, PriorityThreadPool<std::packaged_task<std::shared_future<Request *>()>> &txPool, PriorityThreadPool<std::packaged_task<Request *()>> &decompPool) : Cache(cacheName),
+NetworkCache::NetworkCache(std::string cacheName, WorkStealingThreadPool<std::function<void()>> &txPool, WorkStealingThreadPool<std::function<void()>> &decompPool) : Cache(cacheName),
                                                                                                                                                                                                       _transferPool(txPool),
                                                                                                                                                                                                       _decompPool(decompPool) {
     stats.start();
     _lock = new ReaderWriterLock();
+    _inflight = NULL;
     stats.end(false, CacheStats::Metric::constructor);
     // //log(this) /*std::cout*/<<"[TAZER] " << "Constructing " << _name << " in network cache" << std::endl;
 }
@@ -109,18 +111,33 @@ NetworkCache::~NetworkCache() {
     ////log(this) /*std::cout*/<<"[TAZER] " << "deleting " << _name << " in network cache" << std::endl;
     stats.start();
     delete _lock;
+    delete _inflight;
     stats.end(false, CacheStats::Metric::destructor);
     stats.print(_name);
     std::cout << std::endl;
 }
 
+//Called once the levels above us are in place. Waiting on another process's fetch only pays off
+//when there is a shared level for it to land in, otherwise every process fetches its own misses.
+void NetworkCache::setBase(Cache *base) {
+    Cache::setBase(base);
+    bool sharedLevel = false;
+    for (Cache *level = base; level && level != this; level = level->getNextLevel()) {
+        sharedLevel |= level->shared();
+    }
+    if (sharedLevel && !_inflight) {
+        _inflight = InflightTable::openInflightTable();
+    }
+}
+
 bool NetworkCache::writeBlock(Request *req) {
     bool ret = true;
     // //log(this) /*std::cout*/<<"[TAZER] " << _name << " netcache writing: " << index << " " << (void *)originating << std::endl;
     // //log(this) /*std::cout*/<<"[TAZER] "<<_name<<" writeblock "<<std::hex<<(void*)buffer<<std::dec<<std::endl;
     if (req->originating == this) {
-        delete[] req->data;
-        delete req;
+        if (req->data != req->dest) //The caller owns its buffer
+            delete[] req->data;
+        Request::release(req);
     }
     else if (_nextLevel) { // currentlty this should be the last level....but it could be possible to do something like a level for site level servers and then a level for remote site servers...
         ret &= _nextLevel->writeBlock(req);
@@ -129,115 +146,229 @@ bool NetworkCache::writeBlock(Request *req) {
 }
 
 Request *NetworkCache::decompress(Request *req, char *compBuf, uint32_t compBufSize, uint32_t blkBufSize, uint32_t blk) {
-    char *blkBuf = new char[blkBufSize];
+    char *blkBuf = (req->dest) ? (char *)req->dest : new char[blkBufSize];
     int64_t ret = LZ4_decompress_safe(compBuf, blkBuf, compBufSize, blkBufSize);
     if (ret < 0) {
         //*this << "A negative result from LZ4_decompress_fast indicates a failure trying to decompress the data.  See exit code (echo $?) for value returned. " << ret << std::endl;
-        delete blkBuf;
+        if (!req->dest)
+            delete[] blkBuf;
         blkBuf = NULL;
     }
-    delete compBuf;
+    delete[] compBuf;
     req->data = (uint8_t *)blkBuf;
     req->originating = this;
-    req->reservedMap[this] = 1;
     req->ready = true;
     req->time = Timer::getCurrentTime() - req->time;
-    req->waitingCache = NETWORKCACHENAME;
+    req->waitingCache = this;
     updateRequestTime(req->time);
     return req;
 }
 
-// std::future<Request*> NetworkCache::requestBlk(Connection *server, uint32_t blkStart, uint32_t blkEnd, uint32_t fileIndex, uint32_t priority) {
-std::future<Request *> NetworkCache::requestBlk(Connection *server, Request *req, uint32_t priority) {
-    auto fileIndex = req->fileIndex;
-    auto blkStart = req->blkIndex;
-    auto blkEnd = blkStart;
-    // std::cerr << "[TAZER] " << fileIndex << " " << _fileMap[fileIndex].name << " Requesting blks: " << blkStart << " " << blkEnd << " " << Config::networkBlockSize << std::dec << std::endl;
-    bool success = false;
-    server->lock();
-    //Currently we are only ever getting a single block at a time (blkStart == blkEnd)
-    //That makes this reasonable... A better idea is to keep track of what block succeeded
-    //And only re-request those that failed...
+//Misses reaching this level between beginRequestBatch and endRequestBatch are held here
+//so contiguous blocks of a file go out as one range request
+static thread_local unsigned int _batchDepth = 0;
+static thread_local std::vector<NetworkCache::PendingBlk> _batch;
+
+void NetworkCache::deliverBlk(PendingBlk &blk, char *data, uint32_t dataSize, uint32_t priority) {
+    Request *req = blk.req;
+    if (_compressMap[req->fileIndex]) {
+        std::uint64_t size = (req->dest) ? req->size : Config::networkBlockSize;
+        uint32_t blkIndex = req->blkIndex;
+        _decompPool.addTask(priority, [this, req, data, dataSize, size, blkIndex, priority]() {
+            stats.start();
+            decompress(req, data, dataSize, size, blkIndex);
+            stats.end(priority != 0, CacheStats::Metric::hits);
+            releaseBlk(req);
+            req->complete();
+        });
+    }
+    else {
+        // log(this) << _name << " received block " << blk << std::endl; // << " " << std::hex << (void *)data << " " << dataSize << " " << (void *)(data + dataSize) << " " << std::dec << XXH64(data, dataSize, 0) << std::dec << std::endl;
+        req->data = (uint8_t *)data;
+        req->originating = this;
+        req->ready = true;
+        req->time = Timer::getCurrentTime() - req->time;
+        req->waitingCache = this;
+        updateRequestTime(req->time);
+        releaseBlk(req);
+        req->complete();
+    }
+}
+
+//Hands a block we own the in flight claim for to the shared levels and lets the other processes waiting on it go.
+//Waiting for the reader to write it back could deadlock two readers each holding one block the other needs.
+void NetworkCache::releaseBlk(Request *req) {
+    if (req->reserved[_level]) {
+        if (req->data) {
+            _base->shareBlock(req);
+        }
+        _inflight->release(req->fileIndex, req->blkIndex);
+        req->reserved[_level] = 0;
+    }
+}
+
+//blks are contiguous blocks of one file, they are requested as a single range and
+//each one is handed off as soon as it arrives so callers can start copying the burst
+bool NetworkCache::requestBlks(Connection *server, std::vector<PendingBlk> &blks, uint32_t priority) {
+    auto fileIndex = blks.front().req->fileIndex;
+    uint32_t first = blks.front().req->blkIndex;
     std::uint64_t _blkSize = Config::networkBlockSize; //_fileMap[fileIndex].blockSize;
     _lock->readerLock();
-    std::uint64_t _fileSize = _fileMap[fileIndex].fileSize;
-
     std::string name = _fileMap[fileIndex].name;
     _lock->readerUnlock();
-    std::future<Request *> fut;
-    // auto start = Timer::getCurrentTime();
-    // uint64_t sizeSum = 0;
-    for (uint32_t j = 0; j < Config::socketRetry; j++) {
-        if (sendRequestBlkMsg(server, name, blkStart, blkEnd)) {
-            for (uint32_t i = blkStart; i <= blkEnd; i++) {
-                // log(this) << _name << " requesting block " << i << std::endl;
-                uint64_t start = blkStart * _blkSize;
-                uint64_t end;
-                if (blkEnd * _blkSize > _fileSize) {
-                    end = _fileSize;
-                }
-                else {
-                    end = start + _blkSize;
-                }
-                uint64_t size = end - start;
 
+    auto recvBlk = [this, _blkSize](Connection *con, uint32_t &id, std::shared_ptr<void> &msg) {
+        return recTaggedBlkMsg(con, id, msg, _blkSize, [this](uint32_t id, uint32_t blk, uint32_t dataSize) {
+            return claimDest(id, blk, dataSize);
+        });
+    };
+    bool compressed = _compressMap[fileIndex];
+
+    std::vector<bool> delivered(blks.size(), false);
+    uint32_t remaining = blks.size();
+    for (uint32_t j = 0; j < Config::socketRetry && remaining; j++) {
+        //Only ask again for what we have not gotten yet
+        uint32_t blkStart = ~0, blkEnd = 0;
+        for (uint32_t i = 0; i < blks.size(); i++) {
+            if (!delivered[i]) {
+                blkStart = std::min(blkStart, first + i);
+                blkEnd = std::max(blkEnd, first + i);
+            }
+        }
+        // std::cerr << "[TAZER] " << fileIndex << " " << name << " Requesting blks: " << blkStart << " " << blkEnd << " " << Config::networkBlockSize << std::dec << std::endl;
+
+        //Only hold the socket long enough to send, other threads pipeline their requests behind ours
+        uint32_t id = 0;
+        server->lock(true);
+        auto tagged = server->beginTagged(id);
+        if (!compressed) { //Compressed blocks are decompressed into the caller's buffer instead
+            std::unique_lock<std::mutex> lock(_destMutex);
+            for (uint32_t i = blkStart; i <= blkEnd; i++) {
+                if (!delivered[i - first] && blks[i - first].req->dest)
+                    _dests[((uint64_t)id << 32) | i] = blks[i - first].req;
+            }
+        }
+        bool sent = sendRequestBlkMsg(server, name, blkStart, blkEnd, id);
+        server->unlock();
+        if (sent) {
+            for (uint32_t i = blkStart; i <= blkEnd; i++) {
                 /*Rec a block is currently a blocking call so the client will hang
                  * until it gets something*/
-                //                char * data = (_compress) ? NULL : _fileContent.data() + start;
-                char *data = NULL;
-                uint32_t blk = 0, dataSize = 0;
-                std::string fileName = recSendBlkMsg(server, &data, blk, dataSize, _blkSize);
-                log(this) << fileName << " " << dataSize << " " << blk << std::endl;
-                if (data == NULL) {
-                    //raise(SIGSEGV);
-                    exit(0);
+                std::shared_ptr<void> msg;
+                if (!server->recvTagged(tagged, id, recvBlk, msg)) {
+                    log(this) << "failed to get block: " << i << std::endl;
+                    break;
                 }
-                if (!fileName.empty() && dataSize && blk == i) { //Got a block
-                    // sizeSum += dataSize;
-                    // log(this) << _name<< "Received " << fileName << " " << blk << " " << dataSize << " allocSize " << size << std::endl;
-                    if (_compressMap[fileIndex]) {
-
-                        auto task = std::packaged_task<Request *()>([this, req, data, dataSize, size, blk, priority]() {
-                            stats.start();
-                            return decompress(req, data, dataSize, size, blk);
-                            stats.end(priority != 0, CacheStats::Metric::hits);
-                        });
-                        fut = task.get_future();
-                        _decompPool.addTask(priority, std::move(task));
+                auto blkMsg = std::static_pointer_cast<taggedBlk>(msg);
+                uint32_t blk = blkMsg->blk;
+                log(this) << blkMsg->name << " " << blkMsg->dataSize << " " << blk << std::endl;
+                if (blkMsg->dataSize && blk >= blkStart && blk <= blkEnd) { //Got a block
+                    if (!delivered[blk - first]) {
+                        char *data = blkMsg->data;
+                        blkMsg->data = NULL; //We own the data now
+                        delivered[blk - first] = true;
+                        remaining--;
+                        deliverBlk(blks[blk - first], data, blkMsg->dataSize, priority);
                     }
-                    else {
-                        // log(this) << _name << " received block " << blk << std::endl; // << " " << std::hex << (void *)data << " " << dataSize << " " << (void *)(data + dataSize) << " " << std::dec << XXH64(data, dataSize, 0) << std::dec << std::endl;
-                        std::promise<Request *> prom;
-                        fut = prom.get_future();
-                        req->data = (uint8_t *)data;
-                        req->originating = this;
-                        req->reservedMap[this] = 1;
-                        req->ready = true;
-                        req->time = Timer::getCurrentTime() - req->time;
-                        req->waitingCache = NETWORKCACHENAME;
-                        updateRequestTime(req->time);
-                        prom.set_value(req);
-                    }
-                    success = true;
                 }
-                else { //Failed to get a block
+                else { //Failed to get a block, keep draining so nothing is left to land in a caller's buffer later
                     log(this) << "failed to get block: " << blk << std::endl;
-                    success = false;
-                    break;
                 }
             }
-            if (success) { //We got all the blocks
-                break;
-            }
         }
+        server->endTagged(tagged);
+        if (!compressed) {
+            std::unique_lock<std::mutex> lock(_destMutex);
+            for (uint32_t i = blkStart; i <= blkEnd; i++)
+                _dests.erase(((uint64_t)id << 32) | i);
+        }
+    }
+    return (remaining == 0);
+}
+
+//Called by whoever is reading the socket once it knows which block is coming
+char *NetworkCache::claimDest(uint32_t id, uint32_t blk, uint32_t dataSize) {
+    char *dest = NULL;
+    std::unique_lock<std::mutex> lock(_destMutex);
+    auto entry = _dests.find(((uint64_t)id << 32) | blk);
+    if (entry != _dests.end()) {
+        if (dataSize <= entry->second->size)
+            dest = (char *)entry->second->dest;
+        _dests.erase(entry);
+    }
+    return dest;
+}
+
+void NetworkCache::transferBlks(std::vector<PendingBlk> blks) {
+    uint64_t priority = blks.front().priority;
+    for (auto &blk : blks) {
+        priority = std::min(priority, blk.priority);
+    }
+    auto transfer = std::make_shared<PendingTransfer>();
+    transfer->claimed.store(false);
+    transfer->promotable = priority != 0;
+    transfer->blks = std::move(blks);
+
+    if (transfer->promotable) {
+        std::unique_lock<std::mutex> lock(_pendingMutex);
+        for (auto &blk : transfer->blks) {
+            _pending[((uint64_t)blk.req->fileIndex << 32) | blk.req->blkIndex] = transfer;
+        }
+    }
+    _transferPool.addTask(priority, [this, transfer, priority]() { //the transfer executes on an asynchronous tx thread.
+        runTransfer(transfer, priority);
+    });
+}
+
+void NetworkCache::runTransfer(std::shared_ptr<PendingTransfer> transfer, uint64_t priority) {
+    if (transfer->claimed.exchange(true)) { //Promoted and sent already
+        return;
+    }
+    auto &blks = transfer->blks;
+    bool prefetch = priority != 0;
+    uint32_t fileIndex = blks.front().req->fileIndex;
+    if (transfer->promotable) {
+        std::unique_lock<std::mutex> lock(_pendingMutex);
+        for (auto &blk : blks) {
+            auto entry = _pending.find(((uint64_t)blk.req->fileIndex << 32) | blk.req->blkIndex);
+            if (entry != _pending.end() && entry->second == transfer)
+                _pending.erase(entry);
+        }
+    }
+
+    Connection *sev = NULL;
+    while (!sev)
+        sev = _conPoolMap[fileIndex]->popConnection();
+    bool success = requestBlks(sev, blks, priority);
+    _conPoolMap[fileIndex]->pushConnection(sev, true);
+    if (!success) {
+        //raise(SIGSEGV);
+        exit(0);
+    }
+    for (auto &blk : blks) {
+        stats.addAmt(prefetch, CacheStats::Metric::hits, blk.req->size);
+    }
+}
+
+//Sends the queued prefetch holding this block at demand priority, the copy left in the queue finds it claimed and does nothing
+void NetworkCache::promoteBlock(uint32_t fileIndex, uint32_t blkIndex) {
+    std::shared_ptr<PendingTransfer> transfer;
+    std::unique_lock<std::mutex> lock(_pendingMutex);
+    auto entry = _pending.find(((uint64_t)fileIndex << 32) | blkIndex);
+    if (entry != _pending.end()) {
+        transfer = entry->second;
+    }
+    lock.unlock();
+
+    if (transfer && !transfer->claimed.load()) {
+        log(this) << _name << " promoting prefetch of block " << blkIndex << " file " << fileIndex << std::endl;
+        _transferPool.addTask(0, [this, transfer]() {
+            runTransfer(transfer, 0);
+        });
     }
-    // auto elapsed = Timer::getCurrentTime() - start;
-    // updateIoRate(elapsed, sizeSum);
-    server->unlock();
-    return fut;
 }
 
-void NetworkCache::readBlock(Request *req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> &reads, uint64_t priority) {
+void NetworkCache::readBlock(Request *req, uint64_t priority) {
     stats.start(); //read
     stats.start(); //ovh
     stats.start(); //hits
@@ -247,26 +378,80 @@ void NetworkCache::readBlock(Request *req, std::unordered_map<uint32_t, std::sha
     req->originating = this;
     bool prefetch = priority != 0;
 
-    auto task = std::packaged_task<std::shared_future<Request *>()>([this, req, priority, prefetch] { //packaged task allow the transfer to execute on an asynchronous tx thread.
-        Connection *sev = NULL;
-        if (!sev) {
-            while (!sev)
-                sev = _conPoolMap[req->fileIndex]->popConnection();
+    uint32_t slot = 0;
+    auto claim = _inflight ? _inflight->claim(req->fileIndex, req->blkIndex, slot) : InflightTable::UNTRACKED;
+    if (claim == InflightTable::WAIT) { //Another process is fetching it, the waiting happens on the reader's thread in finishRequest
+        req->defer(this, ((int64_t)std::min(priority, (uint64_t)INT32_MAX) << 32) | slot);
+    }
+    else {
+        req->reserved[_level] = claim == InflightTable::OWNER; //We release the block once it lands
+        if (_batchDepth) {
+            _batch.push_back(PendingBlk{req, priority});
         }
-        auto fut = requestBlk(sev, req, priority);
-        _conPoolMap[req->fileIndex]->pushConnection(sev, true);
-        stats.addAmt(prefetch, CacheStats::Metric::hits, req->size);
-        return fut.share();
-    });
-    auto fut = task.get_future();
-    _transferPool.addTask(priority, std::move(task));
-    reads[req->blkIndex] = fut.share();
+        else {
+            transferBlks(std::vector<PendingBlk>{PendingBlk{req, priority}});
+        }
+    }
 
     stats.end(prefetch, CacheStats::Metric::hits);
     stats.end(prefetch, CacheStats::Metric::ovh);
     stats.end(prefetch, CacheStats::Metric::read);
 }
 
+//A block another process was fetching, read it from the shared level it landed in. If it never got there
+//(no shared level, or none had room) or the owner died and handed the claim to us, we fetch it ourselves.
+void NetworkCache::finishRequest(Request *req, int64_t arg) {
+    uint32_t slot = arg & 0xffffffff;
+    uint64_t priority = arg >> 32;
+    auto claim = InflightTable::WAIT;
+    while (claim == InflightTable::WAIT) {
+        if (!_inflight->wait(slot, req->fileIndex, req->blkIndex)) {
+            log(this) << _name << " owner of block " << req->blkIndex << " file " << req->fileIndex << " is gone, fetching it" << std::endl;
+            claim = InflightTable::OWNER;
+        }
+        else if (_base->lookupBlock(req)) {
+            req->time = Timer::getCurrentTime() - req->time; //what a fetch cost us, the levels above weigh themselves against it
+            updateRequestTime(req->time);
+            return;
+        }
+        else {
+            claim = _inflight->claim(req->fileIndex, req->blkIndex, slot);
+        }
+    }
+    req->reserved[_level] = claim == InflightTable::OWNER;
+    transferBlks(std::vector<PendingBlk>{PendingBlk{req, priority}});
+    req->wait();
+}
+
+void NetworkCache::beginRequestBatch() {
+    _batchDepth++;
+}
+
+void NetworkCache::endRequestBatch() {
+    if (_batchDepth && --_batchDepth == 0 && !_batch.empty()) {
+        std::vector<PendingBlk> pending;
+        pending.swap(_batch);
+        std::sort(pending.begin(), pending.end(), [](const PendingBlk &a, const PendingBlk &b) {
+            return (a.req->fileIndex == b.req->fileIndex) ? a.req->blkIndex < b.req->blkIndex : a.req->fileIndex < b.req->fileIndex;
+        });
+
+        std::vector<PendingBlk> run;
+        for (auto &blk : pending) {
+            if (!run.empty()) {
+                Request *last = run.back().req;
+                if (last->fileIndex != blk.req->fileIndex || last->blkIndex + 1 != blk.req->blkIndex || run.size() >= Config::maxRangeBlks) {
+                    transferBlks(std::move(run));
+                    run.clear();
+                }
+            }
+            run.push_back(blk);
+        }
+        if (!run.empty()) {
+            transferBlks(std::move(run));
+        }
+    }
+}
+
 void NetworkCache::setFileCompress(uint32_t index, bool compress) {
     //if (_compressMap.count(index) == 0) {
     _lock->writerLock();
@@ -281,7 +466,7 @@ void NetworkCache::setFileConnectionPool(uint32_t index, ConnectionPool *conPool
     _lock->writerUnlock();
 }
 
-Cache *NetworkCache::addNewNetworkCache(std::string cacheName, PriorityThreadPool<std::packaged_task<std::shared_future<Request *>()>> &txPool, PriorityThreadPool<std::packaged_task<Request *()>> &decompPool) {
+Cache *NetworkCache::addNewNetworkCache(std::string cacheName, WorkStealingThreadPool<std::function<void()>> &txPool, WorkStealingThreadPool<std::function<void()>> &decompPool) {
     return Trackable<std::string, Cache *>::AddTrackable(
         cacheName, [&]() -> Cache * {
             Cache *temp = new NetworkCache(cacheName, txPool, decompPool);
@@ -296,7 +481,7 @@ void NetworkCache::addFile(uint32_t index, std::string filename, uint64_t blockS
     _lock->writerLock();
     if (_fileMap.count(index) == 0) {
         std::string hashstr(_name + filename); //should cause each level of the cache to have different indicies for a given file
-        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), filename.size(), 0);
+        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), hashstr.size(), 0);
 
         _fileMap.emplace(index, FileEntry{filename, blockSize, fileSize, hash});
 
@@ -0,0 +1,232 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+
+#include "Request.h"
+#include "Cache.h"
+#include <atomic>
+
+//Free requests cached by one thread. Requests released by the owning thread go straight on the
+//local list, everyone else pushes onto the remote list which the owner takes over wholesale
+//when the local one runs dry.
+struct RequestPool {
+    Request *local;
+    uint32_t numLocal;
+    std::atomic<Request *> remote;
+    std::atomic_bool alive;
+
+    static const uint32_t maxLocal = 1024;
+
+    RequestPool() : local(NULL), numLocal(0), remote(NULL), alive(true) {}
+
+    Request *pop() {
+        if (!local) {
+            adoptRemote();
+        }
+        Request *req = local;
+        if (req) {
+            local = req->_nextFree;
+            numLocal--;
+        }
+        return req;
+    }
+
+    //Takes over the remote list, counting it so push keeps to maxLocal and freeing whatever is past it
+    void adoptRemote() {
+        local = remote.exchange(NULL);
+        numLocal = 0;
+        for (Request *req = local; req; req = req->_nextFree) {
+            if (++numLocal == maxLocal) {
+                drain(req->_nextFree);
+                req->_nextFree = NULL;
+                break;
+            }
+        }
+    }
+
+    void push(Request *req) {
+        if (numLocal < maxLocal) {
+            req->_nextFree = local;
+            local = req;
+            numLocal++;
+        }
+        else {
+            delete req;
+        }
+    }
+
+    void pushRemote(Request *req) {
+        req->_nextFree = remote.load();
+        while (!remote.compare_exchange_weak(req->_nextFree, req)) {
+        }
+        if (!alive.load()) { //Owner exited while we were pushing, nobody else will clean up
+            drain(remote.exchange(NULL));
+        }
+    }
+
+    static void drain(Request *req) {
+        while (req) {
+            Request *next = req->_nextFree;
+            delete req;
+            req = next;
+        }
+    }
+};
+
+//The pool itself is never freed, other threads may still be handing requests back after the owner exits
+struct RequestPoolHolder {
+    RequestPool *pool;
+    RequestPoolHolder() : pool(new RequestPool()) {}
+    ~RequestPoolHolder() {
+        pool->alive.store(false);
+        RequestPool::drain(pool->local);
+        pool->local = NULL;
+        RequestPool::drain(pool->remote.exchange(NULL));
+    }
+};
+
+static thread_local RequestPoolHolder _requestPool;
+
+Request::Request(uint32_t blk, uint32_t fileIndex, uint64_t size, Cache *orig, uint8_t *data) : _pool(NULL),
+                                                                                                _nextFree(NULL) {
+    reset(blk, fileIndex, size, orig, data);
+}
+
+void Request::reset(uint32_t blk, uint32_t fileIndex, uint64_t size, Cache *orig, uint8_t *data) {
+    this->data = data;
+    this->dest = NULL;
+    this->originating = orig;
+    this->blkIndex = blk;
+    this->fileIndex = fileIndex;
+    this->size = size;
+    this->time = Timer::getCurrentTime();
+    memset(reserved, 0, sizeof(reserved));
+    ready = false;
+    waitingCache = NULL;
+    _deferred = NULL;
+    _deferredArg = 0;
+    _done = false;
+}
+
+Request *Request::allocate(uint32_t blk, uint32_t fileIndex, uint64_t size, Cache *orig, uint8_t *data) {
+    RequestPool *pool = _requestPool.pool;
+    Request *req = pool->pop();
+    if (req) {
+        req->reset(blk, fileIndex, size, orig, data);
+    }
+    else {
+        req = new Request(blk, fileIndex, size, orig, data);
+    }
+    req->_pool = pool;
+    return req;
+}
+
+void Request::release(Request *req) {
+    RequestPool *pool = req->_pool;
+    if (!pool) {
+        delete req;
+    }
+    else if (pool == _requestPool.pool) {
+        pool->push(req);
+    }
+    else if (pool->alive.load()) {
+        pool->pushRemote(req);
+    }
+    else {
+        delete req;
+    }
+}
+
+void Request::defer(Cache *cache, int64_t arg) {
+    _deferred = cache;
+    _deferredArg = arg;
+}
+
+void Request::complete() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done = true;
+    _cv.notify_all(); //Notify under the lock, the waiter may recycle the request as soon as it gets in
+}
+
+Request *Request::wait() {
+    if (_deferred) {
+        Cache *cache = _deferred;
+        _deferred = NULL;
+        cache->finishRequest(this, _deferredArg); //Leaves the request ready (or failed) before returning
+        return this;
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this] { return _done; });
+    return this;
+}
@@ -95,28 +95,38 @@
 //#define DPRINTF(...) fprintf(stderr, __VA_ARGS__)
 #define DPRINTF(...)
 
-SharedMemoryCache::SharedMemoryCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity) : BoundedCache(cacheName, cacheSize, blockSize, associativity) {
+SharedMemoryCache::SharedMemoryCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity) : BoundedCache(cacheName, cacheSize, blockSize, associativity, Config::sharedMemoryCacheEviction) {
     // std::cout<<"[TAZER] " << "Constructing " << _name << " in shared memory cache" << std::endl;
     stats.start();
-    std::string filePath("/" + Config::tazer_id + "_" + _name + "_" + std::to_string(_cacheSize) + "_" + std::to_string(_blockSize) + "_" + std::to_string(_associativity));
+    std::string filePath("/" + Config::tazer_id + "_" + _name + "_" + std::to_string(_cacheSize) + "_" + std::to_string(_blockSize) + "_" + std::to_string(_associativity) + "_v" + std::to_string(SHM_LAYOUT_VERSION));
 
+    //init flag, index, bin keys, locks and the admission sketch up front (index and keys cache line aligned), block data
+    //page aligned after them, so probing a bin never pulls in lines shared with data
+    uint64_t keysOffset = INDEX_ALIGN + ((_numBlocks * sizeof(MemBlockEntry) + INDEX_ALIGN - 1) / INDEX_ALIGN) * INDEX_ALIGN;
+    uint64_t lockOffset = keysOffset + _numBlocks * sizeof(uint64_t);
+    uint64_t sketchOffset = lockOffset + MultiReaderWriterLock::getDataSize(_numBins);
+    uint64_t blocksOffset = ((sketchOffset + FrequencySketch::getDataSize(_numBlocks) + 4095) / 4096) * 4096;
+    uint64_t shmSize = blocksOffset + _cacheSize;
     int fd = shm_open(filePath.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
     if (fd == -1) {
         DPRINTF("Reusing shared memory\n");
         log(this) << "Reusing shared memory" << std::endl;
         fd = shm_open(filePath.c_str(), O_RDWR, 0644);
         if (fd != -1) {
-            ftruncate(fd, sizeof(uint32_t) + _cacheSize + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins));
-            void *ptr = mmap(NULL, sizeof(uint32_t) + _cacheSize + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ftruncate(fd, shmSize);
+            void *ptr = mmap(NULL, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
             uint32_t *init = (uint32_t *)ptr;
             log(this) << "init: " << *init << std::endl;
             while (!*init) {
                 sched_yield();
             }
-            _blocks = (uint8_t *)init + sizeof(uint32_t);
-            _blkIndex = (MemBlockEntry *)((uint8_t *)_blocks + _cacheSize);
-            auto binLockDataAddr = (uint8_t *)_blkIndex + _numBlocks * sizeof(MemBlockEntry);
-            _binLock = new MultiReaderWriterLock(_numBins, binLockDataAddr);
+            _blkIndex = (MemBlockEntry *)((uint8_t *)ptr + INDEX_ALIGN);
+            _blkKeys = (uint64_t *)((uint8_t *)ptr + keysOffset);
+            _binLock = new MultiReaderWriterLock(_numBins, (uint8_t *)ptr + lockOffset);
+            if (Config::sharedMemoryCacheAdmission) { //shared so a one pass job is judged against what everyone else reuses
+                _sketch = new FrequencySketch(_numBlocks, (uint8_t *)ptr + sketchOffset);
+            }
+            _blocks = (uint8_t *)ptr + blocksOffset;
 
             log(this) << "init: " << (uint32_t)*init << std::endl;
         }
@@ -128,19 +138,23 @@ SharedMemoryCache::SharedMemoryCache(std::string cacheName, uint64_t cacheSize,
     else {
         DPRINTF("Created shared memory\n");
         log(this) << _name << "created shared memory" << std::endl;
-        ftruncate(fd, sizeof(uint32_t) + _cacheSize + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins));
-        void *ptr = mmap(NULL, sizeof(uint32_t) + _cacheSize + _numBlocks * sizeof(MemBlockEntry) + MultiReaderWriterLock::getDataSize(_numBins), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ftruncate(fd, shmSize);
+        void *ptr = mmap(NULL, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
         uint32_t *init = (uint32_t *)ptr;
         log(this) << "init: " << *init << std::endl;
         *init = 0;
         log(this) << "init: " << *init << std::endl;
-        _blocks = (uint8_t *)init + sizeof(uint32_t);
-        _blkIndex = (MemBlockEntry *)((uint8_t *)_blocks + _cacheSize);
-        auto binLockDataAddr = (uint8_t *)_blkIndex + _numBlocks * sizeof(MemBlockEntry);
-        _binLock = new MultiReaderWriterLock(_numBins, binLockDataAddr, true);
+        _blkIndex = (MemBlockEntry *)((uint8_t *)ptr + INDEX_ALIGN);
+        _blkKeys = (uint64_t *)((uint8_t *)ptr + keysOffset);
+        _binLock = new MultiReaderWriterLock(_numBins, (uint8_t *)ptr + lockOffset, true);
+        if (Config::sharedMemoryCacheAdmission) {
+            _sketch = new FrequencySketch(_numBlocks, (uint8_t *)ptr + sketchOffset, true);
+        }
+        _blocks = (uint8_t *)ptr + blocksOffset;
         _binLock->writerLock(0);
         memset(_blocks, 0, _cacheSize);
         memset(_blkIndex, 0, _numBlocks * sizeof(MemBlockEntry));
+        memset(_blkKeys, 0, _numBlocks * sizeof(uint64_t));
         _binLock->writerUnlock(0);
         *init = 1;
         log(this) << "init: " << *init << std::endl;
@@ -161,7 +175,7 @@ SharedMemoryCache::~SharedMemoryCache() {
     for (size_t i = 0; i < _numBlocks; i++) {
         if (_blkIndex[i].activeCnt > 0) {
             std::cout << "[TAZER] " << _name << " " << i << " " << _numBlocks << " " << _blkIndex[i].activeCnt << " " << _blkIndex[i].fileIndex - 1 << " " << _blkIndex[i].blockIndex - 1 << " "
-                      << "prefetched" << _blkIndex[i].prefetched << std::endl;
+                      << "prefetched" << (uint32_t)_blkIndex[i].prefetched << std::endl;
         }
     }
     stats.end(false, CacheStats::Metric::destructor);
@@ -192,24 +206,22 @@ uint8_t *SharedMemoryCache::getBlockData(unsigned int blockIndex) {
     return temp;
 }
 
-void SharedMemoryCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, std::string cacheName) {
+void SharedMemoryCache::blockSet(uint32_t index, uint32_t fileIndex, uint32_t blockIndex, uint8_t status, int32_t prefetched, uint8_t origin) {
     _blkIndex[index].fileIndex = fileIndex + 1;
     _blkIndex[index].blockIndex = blockIndex + 1;
+    setBlockKey(index, fileIndex + 1, blockIndex + 1);
     _blkIndex[index].timeStamp = Timer::getCurrentTime();
     if (prefetched >= 0) {
         _blkIndex[index].prefetched = prefetched;
     }
-    memset(_blkIndex[index].origCache, 0, MAX_CACHE_NAME_LEN);
-    memcpy(_blkIndex[index].origCache, cacheName.c_str(), MAX_CACHE_NAME_LEN);
+    _blkIndex[index].origin = origin;
     _blkIndex[index].status = status;
 }
 
-bool SharedMemoryCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, char *origCache) {
+bool SharedMemoryCache::blockAvailable(unsigned int index, unsigned int fileIndex, bool checkFs, uint32_t cnt, uint8_t *origin) {
     bool avail = _blkIndex[index].status == BLK_AVAIL;
-    if (origCache && avail) {
-        memset(origCache, 0, MAX_CACHE_NAME_LEN);
-        memcpy(origCache, _blkIndex[index].origCache, MAX_CACHE_NAME_LEN);
-        // std::cout << _name << " " << _blkIndex[index].origCache << std::endl;
+    if (origin && avail) {
+        *origin = _blkIndex[index].origin;
         return true;
     }
     return avail;
@@ -223,6 +235,7 @@ void SharedMemoryCache::readBlockEntry(uint32_t blockIndex, BlockEntry *entry) {
 }
 void SharedMemoryCache::writeBlockEntry(uint32_t blockIndex, BlockEntry *entry) {
     *(BlockEntry *)&_blkIndex[blockIndex] = *entry;
+    setBlockKey(blockIndex, entry->fileIndex, entry->blockIndex);
     // memcpy(&_blkIndex[blockIndex], entry, sizeof(BlockEntry));
 }
 
@@ -257,6 +270,10 @@ bool SharedMemoryCache::anyUsers(uint32_t blk) {
     return _blkIndex[blk].activeCnt;
 }
 
+BoundedCache<MultiReaderWriterLock>::BlockWaitWord *SharedMemoryCache::blockWaitWord(uint32_t blk) {
+    return &_blkIndex[blk].wait;
+}
+
 Cache *SharedMemoryCache::addNewSharedMemoryCache(std::string cacheName, uint64_t cacheSize, uint64_t blockSize, uint32_t associativity) {
     //std::string newFileName("SharedMemoryCache");
     return Trackable<std::string, Cache *>::AddTrackable(
@@ -0,0 +1,160 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "StridePrefetcher.h"
+#include "Cache.h"
+#include "Config.h"
+#include "Loggable.h"
+#include "Timer.h"
+
+#include <cmath>
+
+StridePrefetcher::StridePrefetcher(std::string name, Cache *origin) : Prefetcher(name),
+                                                                      _origin(origin) {
+    *this << "[TAZER] " << _name << " Constructing " << _name << std::endl;
+}
+
+StridePrefetcher::~StridePrefetcher() {
+    *this << "[TAZER] " << _name << " Ending " << _name << std::endl;
+}
+
+//Blocks to keep ahead: enough accesses to cover a fetch from the origin, never more than numBlocks (the file's prefetch window)
+uint64_t StridePrefetcher::depth(Stream &stream, uint64_t numBlocks, uint64_t blksPerAccess) {
+    uint64_t blocks = numBlocks;
+    double latency = (_origin) ? _origin->getRequestTime() : 0.0;
+    if (latency > 0.0 && stream.interval > 0.0) {
+        uint64_t accesses = (uint64_t)std::ceil(latency / stream.interval);
+        if (accesses * blksPerAccess < blocks)
+            blocks = accesses * blksPerAccess;
+    }
+    if (blocks > Config::prefetchMaxDepth)
+        blocks = Config::prefetchMaxDepth;
+    return blocks;
+}
+
+std::vector<uint64_t> StridePrefetcher::getBlocks(uint32_t fileIndex, uint64_t startBlk, uint64_t endBlk, uint64_t numBlocks, uint64_t blkSize, uint64_t fileSize) {
+    std::vector<uint64_t> blocks;
+    uint64_t now = Timer::getCurrentTime();
+    int64_t start = startBlk;
+
+    std::unique_lock<std::mutex> lock(_lock);
+    auto it = _streams.find(fileIndex);
+    if (it == _streams.end()) {
+        _streams[fileIndex] = {start, 0, 0, start, now, 0.0};
+        return blocks;
+    }
+    Stream &stream = it->second;
+
+    int64_t delta = start - stream.lastBlk;
+    if (delta == 0) //Still inside the same block(s), nothing new to learn
+        return blocks;
+
+    double elapsed = (now - stream.lastTime) / 1000000000.0;
+    stream.interval = (stream.interval > 0.0) ? 0.75 * stream.interval + 0.25 * elapsed : elapsed;
+    stream.lastBlk = start;
+    stream.lastTime = now;
+
+    if (delta == stream.stride) {
+        if (stream.confidence < Config::strideConfidence)
+            stream.confidence++;
+    }
+    else { //Pattern broke, stop until the new stride repeats
+        stream.stride = delta;
+        stream.confidence = 0;
+        stream.frontier = start;
+    }
+
+    if (stream.confidence < Config::strideConfidence) {
+        *this << "[TAZER] " << _name << " stride " << stream.stride << " confidence " << stream.confidence << std::endl;
+        return blocks;
+    }
+
+    int64_t numFileBlks = (fileSize + blkSize - 1) / blkSize;
+    uint64_t blksPerAccess = (endBlk > startBlk) ? endBlk - startBlk : 1;
+    uint64_t maxBlocks = depth(stream, numBlocks, blksPerAccess);
+
+    for (uint64_t i = 1; i <= maxBlocks && blocks.size() < maxBlocks; i++) {
+        int64_t pos = start + (int64_t)i * stream.stride;
+        if (pos < 0 || pos >= numFileBlks)
+            break;
+        if ((stream.stride > 0) ? pos <= stream.frontier : pos >= stream.frontier) //Handed out on an earlier access
+            continue;
+        for (uint64_t j = 0; j < blksPerAccess && pos + (int64_t)j < numFileBlks && blocks.size() < maxBlocks; j++)
+            blocks.push_back(pos + j);
+        stream.frontier = pos;
+    }
+
+    *this << "[TAZER] " << _name << " stride " << stream.stride << " depth " << maxBlocks << " Getting list of blocks to prefetch --> " << blocks2String(blocks) << std::endl;
+    return blocks;
+}
@@ -111,7 +111,7 @@ bool UnboundedCache::writeBlock(Request* req) {
     bool ret = false;
     if (req->originating == this) {
         cleanUpBlockData(req->data);
-        delete req;
+        Request::release(req);
         ret = true;
     }
     else {
@@ -132,7 +132,22 @@ bool UnboundedCache::writeBlock(Request* req) {
 }
 
 
-void UnboundedCache::readBlock(Request* req, std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request*>>> &reads, uint64_t priority) {
+void UnboundedCache::finishRequest(Request* req, int64_t reserved) {
+    //std::cout << req->fileIndex << " waiting for block " << req->blkIndex << "  to become available... checking FS: " << reserved << " " << (uint32_t)_blkIndex[req->fileIndex][req->blkIndex] << std::endl;
+    while (!blockAvailable(req->blkIndex, req->fileIndex, reserved)) {
+        sched_yield();
+    }
+    uint8_t *buff = getBlockData(req->blkIndex, req->fileIndex);
+    req->data=buff;
+    req->originating=this;
+    req->waitingCache=this;
+    req->reserved[_level]=1;
+    req->ready = true;
+    req->time = Timer::getCurrentTime()-req->time;
+    updateRequestTime(req->time);
+}
+
+void UnboundedCache::readBlock(Request* req, uint64_t priority) {
     //std::cout << "read " << _name << " fi: " << fileIndex << " i: " << index << std::endl;
     // std::cout << "[TAZER] " << _name << " entering read " << index << " " << size << " " << _blockSize << " " << priority << std::endl;
     uint64_t otime = Timer::getCurrentTime();
@@ -140,7 +155,6 @@ void UnboundedCache::readBlock(Request* req, std::unordered_map<uint32_t, std::s
     uint8_t *buff = nullptr;
     auto index = req->blkIndex;
     auto fileIndex = req->fileIndex;
-    bool prefetch = priority != 0;
 
     _lock->readerLock();
     uint64_t blksize = _fileMap[fileIndex].blockSize;
@@ -162,7 +176,7 @@ void UnboundedCache::readBlock(Request* req, std::unordered_map<uint32_t, std::s
             otime = Timer::getCurrentTime();
             req->data=buff;
             req->originating=this;
-            req->reservedMap[this]=1;
+            req->reserved[_level]=1;
             req->ready = true;
         }
         else {
@@ -182,7 +196,7 @@ void UnboundedCache::readBlock(Request* req, std::unordered_map<uint32_t, std::s
                 //     _ovhTime2 += Timer::getCurrentTime() - otime;
                 // }
                 uint64_t mtime = Timer::getCurrentTime();
-                _nextLevel->readBlock(req,reads,priority); //try to satisfy read at next level
+                _nextLevel->readBlock(req,priority); //try to satisfy read at next level
                 // if (!prefetch) {
                 //     _missTime += Timer::getCurrentTime() - mtime;
                 // }
@@ -202,32 +216,7 @@ void UnboundedCache::readBlock(Request* req, std::unordered_map<uint32_t, std::s
                 // if (!reserved) {
                 //     res.first = (char *)1; //signal that someone else has reserved it on our node.
                 // }
-                auto fut = std::async(std::launch::deferred, [this, req, reserved, prefetch] {
-                    // if (!prefetch) {
-                    //     _stalls_2++;
-                    // }
-                    uint64_t stime = Timer::getCurrentTime();
-                    //std::cout << fileIndex << " waiting for block " << index << "  to become available... checking FS: " << reserved << " " << (uint32_t)_blkIndex[fileIndex][index] << std::endl;
-                    while (!blockAvailable(req->blkIndex, req->fileIndex, reserved)) {
-                        sched_yield();
-                    }
-                    uint8_t *buff = getBlockData(req->blkIndex, req->fileIndex);
-                    req->data=buff;
-                    req->originating=this;
-                    req->reservedMap[this]=1;
-                    req->ready = true;
-                    req->time = Timer::getCurrentTime()-req->time;
-                    updateRequestTime(req->time);
-                    std::promise<Request*> prom;
-                    auto fut = prom.get_future();
-                    prom.set_value(req);
-
-                    // if (!prefetch) {
-                    //     _stallTime_2 += Timer::getCurrentTime() - stime;
-                    // }
-                    return fut.share();
-                });
-                reads[index] = fut.share();
+                req->defer(this, reserved); //wait for it on the reader's thread in finishRequest
                 
             }
         }
@@ -252,7 +241,7 @@ void UnboundedCache::addFile(uint32_t index, std::string filename, uint64_t bloc
     _lock->writerLock();
     if (_fileMap.count(index) == 0) {
         std::string hashstr(_name + filename); //should cause each level of the cache to have different indicies for a given file
-        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), filename.size(), 0);
+        uint64_t hash = (uint64_t)XXH32(hashstr.c_str(), hashstr.size(), 0);
 
         _fileMap.emplace(index, FileEntry{filename, blockSize, fileSize, hash});
 
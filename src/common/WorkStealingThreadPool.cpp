@@ -0,0 +1,270 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "WorkStealingThreadPool.h"
+#include "Cache.h"
+#include <iostream>
+
+//A thread belongs to at most one pool, so these are shared by every instantiation
+static thread_local void *tlsPool = NULL;
+static thread_local uint32_t tlsWorker = 0;
+static thread_local uint32_t tlsNext = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+template <class T>
+WorkStealingThreadPool<T>::WorkStealingThreadPool(uint32_t maxThreads) : WorkStealingThreadPool(maxThreads, "pool") {
+}
+
+template <class T>
+WorkStealingThreadPool<T>::WorkStealingThreadPool(uint32_t maxThreads, std::string name) : _maxThreads(maxThreads),
+                                                                                           _users(0),
+                                                                                           _alive(true),
+                                                                                           _currentThreads(0),
+                                                                                           _numTasks(0),
+                                                                                           _sleeping(0),
+                                                                                           _name(name) {
+    //Tasks queued before any thread starts still need somewhere to go
+    uint32_t numWorkers = maxThreads ? maxThreads : 1;
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        Worker *worker = new Worker;
+        for (uint32_t c = 0; c < NUM_PRIORITY_CLASSES; c++)
+            worker->size[c].store(0);
+        _workers.push_back(worker);
+    }
+}
+
+template <class T>
+WorkStealingThreadPool<T>::~WorkStealingThreadPool() {
+    terminate(true);
+    for (auto worker : _workers)
+        delete worker;
+}
+
+template <class T>
+uint32_t WorkStealingThreadPool<T>::priorityClass(uint32_t priority) {
+    if (priority == 0)
+        return 0;
+    if (priority < 4)
+        return 1;
+    if (priority < 16)
+        return 2;
+    return NUM_PRIORITY_CLASSES - 1;
+}
+
+template <class T>
+uint32_t WorkStealingThreadPool<T>::addThreads(uint32_t numThreads) {
+    uint32_t threadsToAdd = numThreads;
+    std::unique_lock<std::mutex> lock(_tMutex);
+    if (_alive.load()) {
+        _users++;
+
+        uint32_t currentThreads = _threads.size();
+        if (threadsToAdd + currentThreads > _maxThreads)
+            threadsToAdd = _maxThreads - currentThreads;
+
+        _currentThreads.fetch_add(threadsToAdd);
+        for (uint32_t i = 0; i < threadsToAdd; i++) {
+            uint32_t worker = currentThreads + i;
+            _threads.push_back(std::thread([this, worker] { workLoop(worker); }));
+        }
+    }
+    lock.unlock();
+    return threadsToAdd;
+}
+
+template <class T>
+uint32_t WorkStealingThreadPool<T>::initiate() {
+    return addThreads(_maxThreads);
+}
+
+template <class T>
+bool WorkStealingThreadPool<T>::terminate(bool force) {
+    bool ret = false;
+    std::unique_lock<std::mutex> lock(_tMutex);
+    if (_users) //So we can join and terminate if there are no users
+        _users--;
+    if (!_users || force) {
+        _alive.store(false);
+        while (_currentThreads.load()) {
+            std::unique_lock<std::mutex> sleepLock(_sleepMutex);
+            _cv.notify_all();
+        }
+        while (_threads.size()) {
+            _threads.back().join();
+            _threads.pop_back();
+        }
+        //if the force is called then we can't reuse the pool
+        _alive.store(!force);
+        ret = true;
+    }
+    lock.unlock();
+    return ret;
+}
+
+template <class T>
+void WorkStealingThreadPool<T>::addTask(uint32_t priority, T f) {
+    uint32_t c = priorityClass(priority);
+    //Workers keep what they spawn, everyone else deals round robin
+    uint32_t w = (tlsPool == this) ? tlsWorker : tlsNext++ % _workers.size();
+    Worker *worker = _workers[w];
+
+    std::unique_lock<std::mutex> lock(worker->lock);
+    worker->q[c].push_back(std::move(f));
+    worker->size[c].fetch_add(1);
+    lock.unlock();
+
+    //Pairs with the check in workLoop so a worker going to sleep can't miss this task
+    _numTasks.fetch_add(1);
+    if (_sleeping.load()) {
+        std::unique_lock<std::mutex> sleepLock(_sleepMutex);
+        _cv.notify_one();
+    }
+}
+
+//Takes the highest class task available anywhere, looking in our own queue first
+template <class T>
+bool WorkStealingThreadPool<T>::popTask(uint32_t worker, T &task) {
+    uint32_t numWorkers = _workers.size();
+    for (uint32_t c = 0; c < NUM_PRIORITY_CLASSES; c++) {
+        for (uint32_t i = 0; i < numWorkers; i++) {
+            Worker *victim = _workers[(worker + i) % numWorkers];
+            if (!victim->size[c].load(std::memory_order_relaxed))
+                continue;
+
+            std::unique_lock<std::mutex> lock(victim->lock);
+            if (!victim->q[c].empty()) {
+                task = std::move(victim->q[c].front()); //FIFO within a class, like the timestamps in PriorityThreadPool
+                victim->q[c].pop_front();
+                victim->size[c].fetch_sub(1);
+                lock.unlock();
+                _numTasks.fetch_sub(1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+template <class T>
+void WorkStealingThreadPool<T>::workLoop(uint32_t worker) {
+    tlsPool = this;
+    tlsWorker = worker;
+    T task;
+    while (_alive.load()) {
+        if (popTask(worker, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleeping.fetch_add(1);
+        //Don't make this a predicate wait or else we will never be able to join
+        if (!_numTasks.load() && _alive.load())
+            _cv.wait(lock);
+        _sleeping.fetch_sub(1);
+    }
+    //This is the end counter we need to decrement
+    _currentThreads.fetch_sub(1);
+    tlsPool = NULL;
+    if (_numTasks.load() > 0 && (uint32_t)_numTasks.load() > _currentThreads) {
+        std::cout << "[TAZER DEBUG] " << _name << " not empty while closing!!!! remaining threads: " << _currentThreads << " remaining tasks: " << _numTasks << std::endl;
+    }
+}
+
+template <class T>
+void WorkStealingThreadPool<T>::wait() {
+    while (_numTasks.load())
+        std::this_thread::yield();
+}
+
+template <class T>
+uint32_t WorkStealingThreadPool<T>::getMaxThreads() {
+    return _maxThreads;
+}
+
+template <class T>
+bool WorkStealingThreadPool<T>::addThreadWithTask(uint32_t priority, T f) {
+    uint32_t ret = addThreads(1);
+    addTask(priority, std::move(f));
+    return (ret == 1);
+}
+
+template <class T>
+int WorkStealingThreadPool<T>::numTasks() {
+    return _numTasks.load();
+}
+
+template class WorkStealingThreadPool<std::packaged_task<Request *()>>;
+template class WorkStealingThreadPool<std::packaged_task<std::future<Request *>()>>;
+template class WorkStealingThreadPool<std::packaged_task<std::shared_future<Request *>()>>;
+template class WorkStealingThreadPool<std::function<void()>>;
@@ -0,0 +1,145 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "CompressedBlockCache.h"
+#include "Config.h"
+#include "xxhash.h"
+
+CompressedBlockCache::CompressedBlockCache(std::string name, uint64_t cacheSize) : Loggable(Config::ServeFileLog, "CompressedBlockCache"),
+                                                                                    _name(name),
+                                                                                    _cacheSize(cacheSize),
+                                                                                    _usedSize(0) {
+}
+
+CompressedBlockCache::~CompressedBlockCache() {
+    stats.print(_name);
+}
+
+size_t CompressedBlockCache::KeyHash::operator()(const Key &key) const {
+    uint64_t fields[3] = {((uint64_t)key.fileIndex << 32) | key.blk, key.blkSize, (uint64_t)(int64_t)key.compLevel};
+    return XXH64(fields, sizeof(fields), 0);
+}
+
+std::shared_ptr<CompressedBlk> CompressedBlockCache::getBlock(uint32_t fileIndex, uint32_t blk, uint64_t blkSize, int compLevel, std::function<CompressedBlk *()> compressBlk) {
+    Key key = {fileIndex, blk, blkSize, compLevel};
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto entry = _blocks.find(key);
+    if (entry != _blocks.end()) {
+        _lru.splice(_lru.begin(), _lru, entry->second.lru);
+        auto fut = entry->second.blk;
+        lock.unlock();
+        auto ret = fut.get(); //Someone else may still be compressing it
+        if (ret)
+            stats.addAmt(false, CacheStats::Metric::hits, ret->size);
+        return ret;
+    }
+
+    std::promise<std::shared_ptr<CompressedBlk>> prom;
+    _lru.push_front(key);
+    _blocks[key] = Entry{prom.get_future().share(), _lru.begin(), 0};
+    lock.unlock();
+
+    std::shared_ptr<CompressedBlk> ret(compressBlk());
+
+    lock.lock();
+    entry = _blocks.find(key);
+    if (ret && ret->size <= _cacheSize) {
+        stats.addAmt(false, CacheStats::Metric::misses, ret->size);
+        entry->second.size = ret->size;
+        _usedSize += ret->size;
+        evict();
+    }
+    else { //Don't keep failures or blocks that will never fit
+        _lru.erase(entry->second.lru);
+        _blocks.erase(entry);
+    }
+    lock.unlock();
+    prom.set_value(ret);
+    return ret;
+}
+
+//Must lock _mutex
+void CompressedBlockCache::evict() {
+    auto it = _lru.end();
+    while (_usedSize > _cacheSize && it != _lru.begin()) {
+        --it;
+        auto entry = _blocks.find(*it);
+        if (entry->second.size) { //Blocks still being compressed stay, readers hold their own reference
+            _usedSize -= entry->second.size;
+            log(this) << _name << " evicting " << it->fileIndex << " " << it->blk << std::endl;
+            _blocks.erase(entry);
+            it = _lru.erase(it);
+        }
+    }
+}
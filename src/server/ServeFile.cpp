@@ -100,11 +100,12 @@
 #define DPRINTF(...) fprintf(stderr, __VA_ARGS__)
 //#define DPRINTF(...)
 Cache ServeFile::_cache;
+CompressedBlockCache ServeFile::_compCache("servercompressed", Config::serverCompressedCacheSize);
 
 ThreadPool<std::function<void()>> ServeFile::_pool(Config::numServerCompThreads);
 std::vector<Connection *> ServeFile::_connections;
-PriorityThreadPool<std::packaged_task<std::shared_future<Request *>()>> ServeFile::_transferPool(Config::numClientTransThreads, "transfer pool");
-PriorityThreadPool<std::packaged_task<Request *()>> ServeFile::_decompressionPool(Config::numClientDecompThreads, "decompress pool");
+WorkStealingThreadPool<std::function<void()>> ServeFile::_transferPool(Config::numClientTransThreads, "transfer pool");
+WorkStealingThreadPool<std::function<void()>> ServeFile::_decompressionPool(Config::numClientDecompThreads, "decompress pool");
 
 bool ServeFile::addConnections() {
     unixopen_t unixOpen = (unixopen_t)dlsym(RTLD_NEXT, "open");
@@ -219,7 +220,9 @@ ServeFile::ServeFile(std::string name, bool compress, uint64_t blkSize, uint64_t
                                                                                                                                    _size(0),
                                                                                                                                    _numBlks(0),
                                                                                                                                    _open(false),
-                                                                                                                                   _outstandingWrites(0) {
+                                                                                                                                   _fd(-1),
+                                                                                                                                   _pendingFp(0),
+                                                                                                                                   _dirty(false) {
     _pool.initiate();
 
     log(this) << "file: " << _name << std::endl;
@@ -247,6 +250,10 @@ ServeFile::ServeFile(std::string name, bool compress, uint64_t blkSize, uint64_t
 
         if (output) {
             std::experimental::filesystem::create_directories(std::experimental::filesystem::path(_name).parent_path());
+            _fd = ::open(_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (_fd < 0) {
+                log(this) << "ERROR: failed to open " << _name << " for output: " << strerror(errno) << std::endl;
+            }
         }
         if (!output) {
             if (_blkSize > _size) {
@@ -291,10 +298,11 @@ ServeFile::~ServeFile() {
     //Make sure outstanding prefetches are done first!!!
     _prefetchLock.writerLock();
 
-    while (_outstandingWrites) {
-        sched_yield();
-    }
     _pool.terminate();
+    if (_fd >= 0) {
+        flush(!_remove); //No point syncing a file we are about to remove
+        ::close(_fd);
+    }
 
     if (_output && _remove) {
         remove(_name.c_str());
@@ -308,7 +316,7 @@ void ServeFile::addCompressTask(uint32_t blk) {
     // if (_prefetchLock.tryReaderLock()) { //This makes sure the file isn't deleted
     //     if (std::atomic_compare_exchange_strong(&_blocks[blk].status, &zero, 1)) {
     //         _pool.addTask([this, blk] {
-    //             transferBlk(NULL, blk);
+    //             transferBlk(NULL, -1, blk);
     //             //                        compress(blk);
     //             if (blk + _initialCompressTasks < _numBlks && _cache.freeSpace() >= _blkSize)
     //                 addCompressTask(blk + _initialCompressTasks);
@@ -318,8 +326,12 @@ void ServeFile::addCompressTask(uint32_t blk) {
     // }
 }
 
-uint64_t ServeFile::compress(uint64_t blk, uint8_t *blkData, uint8_t *&msgData) {
+CompressedBlk *ServeFile::compress(uint32_t blk) {
     log(this) << "Compress " << std::endl;
+    Request *request = readBlk(blk);
+    if (!request) {
+        return NULL;
+    }
 
     int64_t size = _blkSize;
     if ((blk + 1) * _blkSize > _size) {
@@ -327,7 +339,8 @@ uint64_t ServeFile::compress(uint64_t blk, uint8_t *blkData, uint8_t *&msgData)
     }
 
     int64_t compSize;
-    msgData = new uint8_t[_maxCompSize];
+    uint8_t *msgData = new uint8_t[_maxCompSize];
+    uint8_t *blkData = request->data;
 
     if (_compLevel < 0) {
         compSize = LZ4_compress_fast((char *)blkData, (char *)msgData, size, _maxCompSize, -_compLevel);
@@ -338,98 +351,182 @@ uint64_t ServeFile::compress(uint64_t blk, uint8_t *blkData, uint8_t *&msgData)
     else {
         compSize = LZ4_compress_HC((char *)blkData, (char *)msgData, size, _maxCompSize, _compLevel);
     }
-    size = compSize;
-    return size;
-}
+    ServeFile::_cache.bufferWrite(request);
 
-bool ServeFile::sendData(Connection *connection, uint64_t blk, Request *request) {
-    uint8_t *msgData;
-    uint64_t msgSize = request->size;
-    if (_compress) {
-        msgSize = compress(blk, request->data, msgData);
-    }
-    else {
-        msgData = request->data;
+    if (compSize <= 0) {
+        delete[] msgData;
+        return NULL;
     }
+    //Blocks live in the compressed cache for a while, don't hold on to the worst case size
+    uint8_t *data = new uint8_t[compSize];
+    memcpy(data, msgData, compSize);
+    delete[] msgData;
+    return new CompressedBlk(data, compSize);
+}
+
+bool ServeFile::sendData(Connection *connection, int socket, uint64_t blk, uint32_t id, uint8_t *msgData, uint64_t msgSize) {
     sendBlkMsg packet;
     fillMsgHeader((char *)&packet, SEND_BLK_MSG, _name.size() + 1, msgSize + sizeof(sendBlkMsg) + _name.size() + 1);
     packet.compression = _compLevel; //I think this makes sense...
     packet.blk = blk;
+    packet.id = id;
     packet.dataSize = msgSize;
     bool ret = false;
     if (connection) {
+        connection->lockSocket(socket); //Other blocks may be going out on this socket
         ret = serverSendCloseNew(connection, &packet, _name, (char *)msgData, msgSize);
+        connection->unlockSocket();
     }
-    ServeFile::_cache.bufferWrite(request);
     log(this) << "sending: " << blk << " size: " << msgSize << " " << ret << std::endl;
     return ret;
 }
 
-bool ServeFile::transferBlk(Connection *connection, uint32_t blk) {
-    if (!_output && blk < _numBlks) {
-        log(this) << "Transfer blk " << blk << " of " << _numBlks << std::endl;
-        while (1) {
-            //See if it is in the cache or someone is in the process of loading it
-
-            std::unordered_map<uint32_t, std::shared_future<std::shared_future<Request *>>> reads;
+//Returns the raw block from the cache hierarchy, the caller must bufferWrite it when done
+Request *ServeFile::readBlk(uint32_t blk) {
+    while (1) {
+        //See if it is in the cache or someone is in the process of loading it
 
-            auto request = _cache.requestBlock(blk, _blkSize, _regFileIndex, reads, 0);
+        auto request = _cache.requestBlock(blk, _blkSize, _regFileIndex, 0);
+        if (request->ready) {
+            request->originating->stats.addAmt(false, CacheStats::Metric::read, _blkSize);
+            // std::cout << "cache: " << _name << " " << blk << std::endl;
+            return request;
+        }
+        else {
+            auto stallTime = Timer::getCurrentTime();
+            request->wait();
+            Cache *waiting = (request->waitingCache) ? request->waitingCache : request->originating;
+            waiting->stats.addTime(0, CacheStats::Metric::stalls, Timer::getCurrentTime() - stallTime, 1);
+            request->originating->stats.addTime(0, CacheStats::Metric::stalled, Timer::getCurrentTime() - stallTime, 1);
             if (request->ready) {
-                request->originating->stats.addAmt(false, CacheStats::Metric::read, _blkSize);
-                // std::cout << "cache: " << _name << " " << blk << std::endl;
-                return sendData(connection, blk, request);
+                // std::cout << "net: " << _name << " " << blk << std::endl;
+                waiting->stats.addAmt(0, CacheStats::Metric::stalls, _blkSize);
+                request->originating->stats.addAmt(false, CacheStats::Metric::stalled, _blkSize);
+                return request;
             }
             else {
-                auto pending = reads[blk];
-                auto stallTime = Timer::getCurrentTime();
-                auto request = pending.get().get();
-                _cache.getCacheByName(request->waitingCache)->stats.addTime(0, CacheStats::Metric::stalls, Timer::getCurrentTime() - stallTime, 1);
-                request->originating->stats.addTime(0, CacheStats::Metric::stalled, Timer::getCurrentTime() - stallTime, 1);
-                if (request->ready) {
-                    // std::cout << "net: " << _name << " " << blk << std::endl;
-                    _cache.getCacheByName(request->waitingCache)->stats.addAmt(0, CacheStats::Metric::stalls, _blkSize);
-                    request->originating->stats.addAmt(false, CacheStats::Metric::stalled, _blkSize);
-                    return sendData(connection, blk, request);
-                }
-                else {
-                    std::cout << "REQUEST failure" << std::endl;
-                    return false;
-                }
+                std::cout << "REQUEST failure" << std::endl;
+                return NULL;
             }
+        }
 
-            //could easily do a prefetching algorithm here....
-            sched_yield();
+        //could easily do a prefetching algorithm here....
+        sched_yield();
+    }
+    return NULL;
+}
+
+bool ServeFile::transferBlk(Connection *connection, int socket, uint32_t blk, uint32_t id) {
+    if (!_output && blk < _numBlks) {
+        log(this) << "Transfer blk " << blk << " of " << _numBlks << std::endl;
+        if (_compress) { //Hot blocks are only compressed once
+            auto compBlk = _compCache.getBlock(_regFileIndex, blk, _blkSize, _compLevel, [this, blk] { return compress(blk); });
+            if (compBlk) {
+                return sendData(connection, socket, blk, id, compBlk->data, compBlk->size);
+            }
+        }
+        else {
+            Request *request = readBlk(blk);
+            if (request) {
+                bool ret = sendData(connection, socket, blk, id, request->data, request->size);
+                ServeFile::_cache.bufferWrite(request);
+                return ret;
+            }
         }
     }
-    return false;
+    //The client waits for a reply to every block it asked for, an empty one tells it this block failed
+    log(this) << "Failed to read blk " << blk << std::endl;
+    return sendData(connection, socket, blk, id, NULL, 0);
 }
 
+//Small writes that continue where the last one left off are gathered in _pending and go out
+//as one pwrite, anything else goes straight to the file. Syncing waits for flush (or close).
 bool ServeFile::writeData(char *data, uint64_t size, uint64_t fp) {
-    if (_output) {
-        if (_prefetchLock.tryReaderLock()) {
-            _outstandingWrites++;
-            char *odata = new char[size];
-            memcpy(odata, data, size);
-            _pool.addTask([this, odata, size, fp] {
-                std::ofstream file;
-                file.open(_name, std::fstream::binary);
-                std::unique_lock<std::mutex> flock(_fileMutex);
-                file.seekp(fp, file.beg);
-                file.write(odata, size);
-                file.flush();
-                flock.unlock();
-                file.close();
-                delete[] odata;
-                _outstandingWrites--;
-            });
+    if (_output && _fd >= 0) {
+        bool ret = true;
+        if (_prefetchLock.tryReaderLock()) { //Makes sure the file isn't closed under us
+            std::unique_lock<std::mutex> flock(_fileMutex);
+            if (!_pending.empty() && fp != _pendingFp + _pending.size()) {
+                ret &= flushPending();
+            }
+            if (_pending.size() + size <= Config::serverWriteCoalesceSize) {
+                if (_pending.empty()) {
+                    _pendingFp = fp;
+                }
+                _pending.insert(_pending.end(), data, data + size);
+            }
+            else { //Too big to hold on to, write it together with whatever it continues
+                struct iovec iov[2] = {{_pending.data(), _pending.size()}, {data, size}};
+                ret &= (_pending.empty()) ? writeAt(&iov[1], 1, fp) : writeAt(iov, 2, _pendingFp);
+                _pending.clear();
+            }
+            _dirty = true;
+            flock.unlock();
             _prefetchLock.readerUnlock();
         }
-        return true;
+        else { //The file is being closed under us
+            log(this) << "ERROR: write to " << _name << " at " << fp << " after close" << std::endl;
+            ret = false;
+        }
+        return ret;
     }
     *this << "Not an output file... no writing!!!" << std::endl;
     return false;
 }
 
+//Hands any gathered writes to the file and, if sync is set, makes everything written so far durable
+bool ServeFile::flush(bool sync) {
+    std::unique_lock<std::mutex> flock(_fileMutex);
+    bool ret = flushPending();
+    if (sync && _dirty && _fd >= 0) {
+        if (fdatasync(_fd) != 0) {
+            log(this) << "ERROR: fdatasync " << _name << " failed: " << strerror(errno) << std::endl;
+            ret = false;
+        }
+        _dirty = false;
+    }
+    return ret;
+}
+
+//Must hold _fileMutex
+bool ServeFile::flushPending() {
+    bool ret = true;
+    if (!_pending.empty()) {
+        struct iovec iov = {_pending.data(), _pending.size()};
+        ret = writeAt(&iov, 1, _pendingFp);
+        _pending.clear();
+    }
+    return ret;
+}
+
+//pwritev until everything is written, iov is consumed along the way
+bool ServeFile::writeAt(struct iovec *iov, int iovcnt, uint64_t fp) {
+    while (iovcnt) {
+        ssize_t ret = ::pwritev(_fd, iov, iovcnt, fp);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            log(this) << "ERROR: write to " << _name << " at " << fp << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (ret == 0) {
+            log(this) << "ERROR: write to " << _name << " at " << fp << " made no progress" << std::endl;
+            return false;
+        }
+        fp += ret;
+        while (iovcnt && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return true;
+}
+
 std::string ServeFile::name() {
     return _name;
 }
@@ -79,6 +79,7 @@
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <pthread.h>
@@ -96,6 +97,12 @@
 #include <time.h>
 #include <unistd.h>
 #include <unordered_set>
+#include <vector>
+#ifdef USE_RSOCKETS
+#include <sys/eventfd.h>
+#else
+#include <sys/epoll.h>
+#endif
 
 #include "Config.h"
 //#include "CounterData.h"
@@ -110,9 +117,12 @@
 
 int sockfd = -1;
 std::atomic_bool alive(true);
-ThreadPool<std::function<void()>> threadPool(Config::numServerThreads);
+ThreadPool<std::function<void()>> threadPool(Config::numServerThreads); //Reads and serves requests the reactor finds
+ThreadPool<std::function<void()>> blockPool(Config::numServerBlockThreads); //Serves block requests outside of the poll loop
 
-void openFile(Connection *connection, char *buff) {
+//The handlers below run with the socket they read from set (Connection::setSocket), block tasks may be
+//sending on it at the same time so replies go out under lockSocket
+void openFile(Connection *connection, int socket, char *buff) {
     unsigned int blkSize;
     bool compress;
     bool output;
@@ -120,7 +130,10 @@ void openFile(Connection *connection, char *buff) {
     ServeFile *file = ServeFile::addNewServeFile(fileName, compress, blkSize, (output) ? 0 : Config::numCompressTask, output, Config::removeOutput);
     bool opened = (file != NULL);
     uint64_t size = (opened) ? file->size() : 0;
-    if (sendFileSizeMsg(connection, fileName, size, opened)) {
+    connection->lockSocket(socket);
+    bool sent = sendFileSizeMsg(connection, fileName, size, opened);
+    connection->unlockSocket();
+    if (sent) {
         //        if(opened) {
         //            PRINTF("Opened %s size: %lu blkSize: %u compress: %u\n", file->name().c_str(), file->size(), file->blkSize(), file->compress());
         //        }
@@ -132,25 +145,38 @@ void openFile(Connection *connection, char *buff) {
     //std::cout<<"[TAZER] "<<"open file"<<fileName<<" "<<connection->addr()<<":"<<connection->port()<<" "<<file<<std::endl;
 }
 
-void closeFile(Connection *connection, char *buff) {
+void closeFile(Connection *connection, int socket, char *buff) {
     std::string fileName = parseCloseFileMsg(buff);
-    if (!sendAckMsg(connection, CLOSE_FILE_MSG)) {
-        PRINTF("Failed ack close %s\n", fileName.c_str());
+    //The client takes the ack to mean its writes are on disk, so flush (and sync) before sending it
+    //and tell it if that failed, close() reports it
+    ServeFile *file = ServeFile::getServeFile(fileName);
+    bool flushed = true;
+    if (file) {
+        flushed = file->flush(!Config::removeOutput);
+        if (!flushed) {
+            PRINTF("Failed to flush %s\n", fileName.c_str());
+        }
     }
     ServeFile::removeServeFile(fileName);
+    connection->lockSocket(socket);
+    if (!sendAckMsg(connection, CLOSE_FILE_MSG, 0, !flushed)) {
+        PRINTF("Failed ack close %s\n", fileName.c_str());
+    }
+    connection->unlockSocket();
 
     //  std::cout<<"[TAZER] "<<"close file"<<fileName<<" "<<connection->addr()<<":"<<connection->port()<<std::endl;
 }
 
-void requestBlockFromFile(Connection *connection, char *buff) {
-    unsigned int start, end;
-    std::string fileName = parseRequestBlkMsg(buff, start, end);
+//Runs on the blockPool so a connection can have many requests served at once
+void requestBlockFromFile(Connection *connection, int socket, char *buff) {
+    unsigned int start, end, id;
+    std::string fileName = parseRequestBlkMsg(buff, start, end, id);
     //PRINTF("Request blocks %u - %u from %s\n", start, end, fileName.c_str());
     ServeFile *file = ServeFile::getServeFile(fileName);
     //std::cout<<"[TAZER] "<<"get block "<<fileName<<" "<<connection->addr()<<":"<<connection->port()<<" "<<file<<std::endl;
     if (file) {
         for (unsigned int i = start; i <= end; i++) {
-            if (!file->transferBlk(connection, i)) {
+            if (!file->transferBlk(connection, socket, i, id)) {
                 PRINTF("Block transfer failed\n");
                 break;
             }
@@ -161,26 +187,39 @@ void requestBlockFromFile(Connection *connection, char *buff) {
     }
 }
 
-void writeDataToFile(Connection *connection, char *buff) {
+void writeDataToFile(Connection *connection, int socket, char *buff) {
     unsigned int dataSize = 0;
     unsigned int compSize = 0;
     uint64_t fp = 0;
+    unsigned int sn = 0;
     char *data = NULL;
-    std::string fileName = parseWriteMsg(buff, &data, dataSize, compSize, fp);
+    std::string fileName = parseWriteMsg(buff, &data, dataSize, compSize, fp, sn);
     ServeFile *file = ServeFile::getServeFile(fileName);
     if (file) {
+        bool written = true;
         if (compSize != dataSize) {
             char *decompData = new char[dataSize + 1];
-            if (LZ4_decompress_safe(data, decompData, compSize, dataSize + 1) < 0)
+            if (LZ4_decompress_safe(data, decompData, compSize, dataSize + 1) < 0) {
                 PRINTF("A negative result from LZ4_decompress_fast indicates a failure trying to decompress the data.  See exit code (echo $?) for value returned. ");
+                written = false;
+            }
             data = decompData;
         }
 
         //        PRINTF("WRITING DATA: %s %u %lu %p %s\n", fileName.c_str(), dataSize, fp, data, data);
         //PRINTF("WRITING DATA: %s %u %lu %p\n", fileName.c_str(), dataSize, fp, data);
-        file->writeData(data, dataSize, fp);
+        written = written && file->writeData(data, dataSize, fp);
+        if (!written) {
+            PRINTF("Failed to write %u bytes at %lu to %s\n", dataSize, fp, fileName.c_str());
+        }
 
-        sendAckMsg(connection, WRITE_MSG);
+        //Acks are cumulative, if the client has already sent the next write let its ack cover this one.
+        //A failed write is acked right away as failed, so no later ack covers it
+        if (!written || !connection->msgWaiting()) {
+            connection->lockSocket(socket);
+            sendAckMsg(connection, WRITE_MSG, sn, !written);
+            connection->unlockSocket();
+        }
 
         if (compSize != dataSize)
             delete[] data;
@@ -190,21 +229,54 @@ void writeDataToFile(Connection *connection, char *buff) {
     }
 }
 
-void getFileSize(Connection *connection, char *buff) {
+void getFileSize(Connection *connection, int socket, char *buff) {
     std::string fileName = parseRequestFileSizeMsg(buff);
     struct stat64 sb;
     int ret = stat64(fileName.c_str(), &sb);
     bool opened = (ret != -1);
     uint64_t size = (opened) ? (uint64_t)sb.st_size : 0;
+    connection->lockSocket(socket);
     if (!sendFileSizeMsg(connection, fileName, size, opened)) {
         PRINTF("Failed to send file size %s\n", fileName.c_str());
     }
+    connection->unlockSocket();
 }
 
-void pingResponse(Connection *connection, char *buff) {
+void pingResponse(Connection *connection, int socket, char *buff) {
+    connection->lockSocket(socket);
     if (!sendAckMsg(connection, PING_MSG)) {
         PRINTF("Failed acking ping\n");
     }
+    connection->unlockSocket();
+}
+
+//A client socket registered with the reactor. The reader and every block task
+//sending on it hold a reference, the last one out closes it
+struct ServerSocket {
+    ServerSocket(Connection *connection, int socket) : connection(connection), socket(socket), refs(1) {}
+    Connection *connection;
+    int socket;
+    std::atomic_uint refs;
+};
+
+#ifdef USE_RSOCKETS
+//rsockets can not be registered with epoll, so armed sockets are handed to rpoll instead
+std::mutex armedMutex;
+std::vector<ServerSocket *> armed;
+int wakefd = -1; //Wakes the reactor out of rpoll when a socket is armed or we shut down
+#else
+int epollfd = -1;
+std::mutex watchedMutex;
+std::unordered_set<ServerSocket *> watched; //Everything registered with epoll, released at shutdown
+#endif
+
+void wakeReactor() {
+#ifdef USE_RSOCKETS
+    uint64_t one = 1;
+    if (write(wakefd, &one, sizeof(one)) != sizeof(one)) {
+        PRINTF("Failed to wake the reactor\n");
+    }
+#endif
 }
 
 void shutDownServer() {
@@ -212,65 +284,183 @@ void shutDownServer() {
     alive.store(false);
     rshutdown(sockfd, SHUT_RDWR);
     rclose(sockfd);
+    wakeReactor();
 }
 
-void pollConnection(Connection *connection) {
-    if (connection && alive.load()) {
-        unsigned int closeConCount = 0;
+//Wait for the next request on this socket, only one worker reads a socket at a time
+void armSocket(ServerSocket *serverSocket, bool add) {
+#ifdef USE_RSOCKETS
+    std::unique_lock<std::mutex> lock(armedMutex);
+    armed.push_back(serverSocket);
+    lock.unlock();
+    wakeReactor();
+#else
+    if (add) {
+        std::unique_lock<std::mutex> lock(watchedMutex);
+        watched.insert(serverSocket);
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = serverSocket;
+    if (epoll_ctl(epollfd, (add) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, serverSocket->socket, &event) == -1) {
+        PRINTF("Failed to arm socket %d\n", serverSocket->socket);
+    }
+#endif
+}
+
+void unwatchSocket(ServerSocket *serverSocket) {
+#ifndef USE_RSOCKETS
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, serverSocket->socket, NULL);
+    std::unique_lock<std::mutex> lock(watchedMutex);
+    watched.erase(serverSocket);
+#endif
+}
+
+void releaseSocket(ServerSocket *serverSocket) {
+    if (serverSocket->refs.fetch_sub(1) == 1) {
+        Connection *connection = serverSocket->connection;
         connection->lock();
-        while (pollWrapper(connection) > 0) { //We have a message!
-            char *buff = NULL;
-            if (pollRecWrapper(connection, &buff) >= (int64_t)sizeof(msgHeader)) {
-
-                printMsgHeader(buff);
-
-                msgHeader *header = (msgHeader *)buff;
-                switch (header->type) {
-                case OPEN_FILE_MSG: {
-                    openFile(connection, buff);
-                    break;
-                }
-                case REQ_FILE_SIZE_MSG: {
-                    getFileSize(connection, buff);
-                    break;
-                }
-                case REQ_BLK_MSG: {
-                    requestBlockFromFile(connection, buff);
-                    break;
-                }
-                case WRITE_MSG: {
-                    writeDataToFile(connection, buff);
-                    break;
-                }
-                case CLOSE_FILE_MSG: {
-                    closeFile(connection, buff);
-                    break;
-                }
-                case CLOSE_SERVER_MSG: {
-                    shutDownServer();
-                    break;
-                }
-                case PING_MSG:
-                    pingResponse(connection, buff);
-                case CLOSE_CON_MSG:
-                default: //Close connection on incorrect message type
-                    connection->closeSocket();
-                }
-                if (buff)
+        connection->closeSocket(serverSocket->socket);
+        connection->unlock();
+        Connection::removeConnection(connection); //Each socket holds one use of its connection
+        delete serverSocket;
+    }
+}
+
+//Blocks until the listening socket or some armed client sockets are ready
+//Returns true if there is a client waiting to be accepted
+bool waitForSockets(std::vector<ServerSocket *> &ready) {
+    bool newClient = false;
+#ifdef USE_RSOCKETS
+    std::vector<ServerSocket *> sockets;
+    std::unique_lock<std::mutex> lock(armedMutex);
+    sockets.swap(armed);
+    lock.unlock();
+
+    std::vector<struct pollfd> pfds(sockets.size() + 2);
+    pfds[0].fd = sockfd;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    pfds[1].fd = wakefd;
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
+    for (unsigned int i = 0; i < sockets.size(); i++) {
+        pfds[i + 2].fd = sockets[i]->socket;
+        pfds[i + 2].events = POLLIN;
+        pfds[i + 2].revents = 0;
+    }
+    //Sockets armed while we wait wake us through wakefd, the timeout is only a fallback
+    int numReady = rpoll(pfds.data(), pfds.size(), 100);
+    newClient = numReady > 0 && pfds[0].revents;
+    if (numReady > 0 && pfds[1].revents) {
+        uint64_t wakeups;
+        if (read(wakefd, &wakeups, sizeof(wakeups)) != sizeof(wakeups)) {
+            PRINTF("Failed to clear reactor wakeups\n");
+        }
+    }
+    for (unsigned int i = 0; i < sockets.size(); i++) {
+        if (numReady > 0 && pfds[i + 2].revents)
+            ready.push_back(sockets[i]);
+        else
+            armSocket(sockets[i], false);
+    }
+#else
+    struct epoll_event events[Config::socketStep];
+    int numReady = epoll_wait(epollfd, events, Config::socketStep, 100); //Timeout so we notice a shutdown
+    for (int i = 0; i < numReady; i++) {
+        if (events[i].data.ptr)
+            ready.push_back((ServerSocket *)events[i].data.ptr);
+        else
+            newClient = true;
+    }
+#endif
+    return newClient;
+}
+
+void acceptClient() {
+    struct sockaddr_in cli_addr;
+    socklen_t clilen = sizeof(cli_addr);
+    int newsockfd = raccept(sockfd, (struct sockaddr *)&cli_addr, &clilen); //newsockfd is either used to create a new connection or added to existing connection.
+    if (alive.load() && newsockfd > 0) {
+        std::string clientAddr(inet_ntoa(cli_addr.sin_addr));
+        bool created = false;
+        Connection *newCon = Connection::addNewHostConnection(clientAddr, cli_addr.sin_port, newsockfd, created);
+        if (newCon) {
+            std::cout << "[TAZER] " << clientAddr << ":" << cli_addr.sin_port << " " << newsockfd << " " << created << std::endl;
+            armSocket(new ServerSocket(newCon, newsockfd), true);
+        }
+        else {
+            rclose(newsockfd);
+        }
+    }
+}
+
+//Runs on the threadPool once the reactor sees a request on the socket
+void serveSocket(ServerSocket *serverSocket) {
+    Connection *connection = serverSocket->connection;
+    bool keep = alive.load();
+    if (keep) {
+        char *buff = NULL;
+        int socket = serverSocket->socket;
+        connection->setSocket(socket); //Only the replies need the send lock, not the (possibly long) receive
+        if (pollRecWrapper(connection, &buff) >= (int64_t)sizeof(msgHeader)) {
+
+            printMsgHeader(buff);
+
+            msgHeader *header = (msgHeader *)buff;
+            switch (header->type) {
+            case OPEN_FILE_MSG: {
+                openFile(connection, socket, buff);
+                break;
+            }
+            case REQ_FILE_SIZE_MSG: {
+                getFileSize(connection, socket, buff);
+                break;
+            }
+            case REQ_BLK_MSG: {
+                serverSocket->refs.fetch_add(1);
+                blockPool.addTask([serverSocket, buff] {
+                    requestBlockFromFile(serverSocket->connection, serverSocket->socket, buff);
                     delete[] buff;
+                    releaseSocket(serverSocket);
+                });
+                buff = NULL; //The block task owns it now
+                break;
+            }
+            case WRITE_MSG: {
+                writeDataToFile(connection, socket, buff);
+                break;
             }
-            else { //We were not able to read a message header... Must be an error... close socket
-                PRINTF("Recv failed for client %s\n", connection->addr().c_str());
-                connection->closeSocket();
+            case CLOSE_FILE_MSG: {
+                closeFile(connection, socket, buff);
+                break;
             }
+            case CLOSE_SERVER_MSG: {
+                shutDownServer();
+                break;
+            }
+            case PING_MSG:
+                pingResponse(connection, socket, buff);
+            case CLOSE_CON_MSG:
+            default: //Close connection on incorrect message type
+                keep = false;
+            }
+            if (buff)
+                delete[] buff;
         }
-
-        closeConCount += connection->unlock(); //Check and see how many connections were closed inside connection class
-        bool deleted = (closeConCount) ? Connection::removeConnection(connection, closeConCount) : false;
-        if (!deleted) { //Put the connection back into the task queue
-            //Side note on the capture:  Connection is captured by value since it is a pointer
-            threadPool.addTask([connection] { pollConnection(connection); });
+        else { //We were not able to read a message header... Must be an error... close socket
+            PRINTF("Recv failed for client %s\n", connection->addr().c_str());
+            keep = false;
         }
+        connection->setSocket(-1);
+    }
+
+    if (keep) {
+        armSocket(serverSocket, false);
+    }
+    else {
+        unwatchSocket(serverSocket);
+        releaseSocket(serverSocket);
     }
 }
 
@@ -304,30 +494,50 @@ int main(int argc, char *argv[]) {
     std::cerr << "[TAZER] "
               << "Starting server on port " << portno << " socket " << sockfd << std::endl;
     //    signal(SIGCHLD, SIG_IGN); //hack for now, possibly implement a child handler?
+    threadPool.initiate();
+    blockPool.initiate();
     rlisten(sockfd, 128);
-    struct sockaddr_in cli_addr;
+#ifndef USE_RSOCKETS
+    epollfd = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; //The listening socket
+    if (epollfd == -1 || epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event) == -1) {
+        perror("ERROR on epoll");
+        exit(1);
+    }
+#else
+    wakefd = eventfd(0, EFD_NONBLOCK);
+    if (wakefd == -1) {
+        perror("ERROR on eventfd");
+        exit(1);
+    }
+#endif
+    //The reactor only waits, requests are read and served on the pools
+    std::vector<ServerSocket *> ready;
     while (alive.load()) {
-        socklen_t clilen = sizeof(cli_addr);
-        int newsockfd = raccept(sockfd, (struct sockaddr *)&cli_addr, &clilen); //newsockfd is either used to create a new connection or added to existing connection.
-        if (alive.load() && newsockfd > 0) {
-            std::string clientAddr(inet_ntoa(cli_addr.sin_addr));
-            //std::cout<<"[TAZER] " << clientAddr << ":" << cli_addr.sin_port << " " << newsockfd << std::endl;
-            threadPool.addThreadWithTask([=] {
-                bool created = false;
-                Connection *newCon = Connection::addNewHostConnection(clientAddr, cli_addr.sin_port, newsockfd, created);
-                if (newCon) {
-                    std::cout << "[TAZER] " << clientAddr << ":" << cli_addr.sin_port << " " << newsockfd << " " << created << std::endl;
-                    if (created) {
-                        pollConnection(newCon);
-                    }
-                }
-                else {
-                    rclose(newsockfd);
-                }
-            });
-        }
+        if (waitForSockets(ready) && alive.load())
+            acceptClient();
+        for (auto serverSocket : ready)
+            threadPool.addTask([serverSocket] { serveSocket(serverSocket); });
+        ready.clear();
     }
     threadPool.terminate(true);
+    blockPool.terminate(true);
+    //Whatever is still armed was waiting on its next request
+#ifdef USE_RSOCKETS
+    for (auto serverSocket : armed)
+        releaseSocket(serverSocket);
+    armed.clear();
+    ::close(wakefd);
+#else
+    std::vector<ServerSocket *> remaining(watched.begin(), watched.end());
+    for (auto serverSocket : remaining) {
+        unwatchSocket(serverSocket);
+        releaseSocket(serverSocket);
+    }
+    ::close(epollfd);
+#endif
     Connection::closeAllConnections();
     PRINTF("Exiting Server\n");
     return 0;
@@ -0,0 +1,119 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+
+#include "CompressedBlockCache.h"
+#include <iostream>
+#include <string.h>
+
+//Counts how often the cache had to compress, a hit must not run compressBlk
+static int compressions = 0;
+
+static std::function<CompressedBlk *()> fakeCompress(uint8_t fill, uint64_t size) {
+    return [fill, size] {
+        compressions++;
+        uint8_t *data = new uint8_t[size];
+        memset(data, fill, size);
+        return new CompressedBlk(data, size);
+    };
+}
+
+static bool check(std::string what, bool ok) {
+    std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    CompressedBlockCache cache("test", 1024 * 1024);
+    bool ok = true;
+
+    auto blk = cache.getBlock(1, 7, 4096, 0, fakeCompress(1, 100));
+    ok &= check("miss compresses", compressions == 1 && blk && blk->data[0] == 1);
+
+    blk = cache.getBlock(1, 7, 4096, 0, fakeCompress(2, 100));
+    ok &= check("hit reuses", compressions == 1 && blk->data[0] == 1);
+
+    //Same file and block, but reopened with another block size the old data is the wrong block
+    blk = cache.getBlock(1, 7, 8192, 0, fakeCompress(3, 100));
+    ok &= check("block size is part of the key", compressions == 2 && blk->data[0] == 3);
+
+    blk = cache.getBlock(1, 7, 4096, 9, fakeCompress(4, 100));
+    ok &= check("compression level is part of the key", compressions == 3 && blk->data[0] == 4);
+
+    blk = cache.getBlock(1, 7, 8192, 0, fakeCompress(5, 100));
+    ok &= check("each variant is kept", compressions == 3 && blk->data[0] == 3);
+
+    std::cout << (ok ? "passed" : "failed") << std::endl;
+    return ok ? 0 : 1;
+}
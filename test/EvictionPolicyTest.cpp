@@ -0,0 +1,196 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "EvictionPolicy.h"
+#include <iostream>
+#include <string>
+
+//A bin of valid, evictable slots, one per timeStamp, all on the given list
+static std::vector<EvictionSlot> makeBin(std::vector<EvictionEntry> &states, std::vector<uint64_t> times, uint8_t queue) {
+    std::vector<EvictionSlot> bin;
+    states.assign(times.size(), EvictionEntry());
+    for (uint32_t i = 0; i < times.size(); i++) {
+        states[i].admitted = times[i];
+        states[i].queue = queue;
+        bin.push_back({&states[i], times[i], 1, i, true, true, false});
+    }
+    return bin;
+}
+
+//Evicts until nothing is left, pinning each victim so the next call has to pick another slot
+static std::vector<int> victimOrder(EvictionPolicy *policy, std::vector<EvictionSlot> &bin) {
+    std::vector<int> order;
+    int slot;
+    while ((slot = policy->victim(bin, 2, 0)) >= 0) {
+        order.push_back(slot);
+        bin[slot].evictable = false;
+    }
+    return order;
+}
+
+static bool check(std::string name, std::vector<int> order, std::vector<int> expected) {
+    bool ok = order == expected;
+    std::cout << name << ":";
+    for (auto slot : order) {
+        std::cout << " " << slot;
+    }
+    std::cout << (ok ? " ok" : " wrong") << std::endl;
+    return ok;
+}
+
+static bool testLRU() {
+    EvictionPolicy *policy = EvictionPolicy::newEvictionPolicy(LRU_EVICTION);
+    std::vector<EvictionEntry> states;
+    auto bin = makeBin(states, {30, 10, 40, 20}, EVICT_NONE);
+    bool ok = check("lru", victimOrder(policy, bin), {1, 3, 0, 2});
+    delete policy;
+    return ok;
+}
+
+//Referenced slots get a second chance, the hand resumes after the last victim
+static bool testClock() {
+    EvictionPolicy *policy = EvictionPolicy::newEvictionPolicy(CLOCK_EVICTION);
+    std::vector<EvictionEntry> states;
+    auto bin = makeBin(states, {10, 20, 30, 40}, 0);
+    states[0].queue = 1;
+    states[2].queue = 1;
+    bool ok = check("clock", victimOrder(policy, bin), {1, 3, 0, 2});
+    delete policy;
+    return ok;
+}
+
+//T1 goes first while it is over the target, T2 first once the target covers it
+static bool testARC() {
+    EvictionPolicy *policy = EvictionPolicy::newEvictionPolicy(ARC_EVICTION);
+    std::vector<EvictionEntry> states;
+    auto bin = makeBin(states, {10, 20, 5, 15}, EVICT_RECENT);
+    states[2].queue = EVICT_FREQUENT;
+    states[3].queue = EVICT_FREQUENT;
+    bool ok = check("arc p=0", victimOrder(policy, bin), {0, 1, 2, 3});
+
+    bin = makeBin(states, {10, 20, 5, 15}, EVICT_RECENT);
+    states[2].queue = EVICT_FREQUENT;
+    states[3].queue = EVICT_FREQUENT;
+    states[0].binState = 4;
+    ok = check("arc p=4", victimOrder(policy, bin), {2, 3, 0, 1}) && ok;
+    delete policy;
+    return ok;
+}
+
+//A1in is evicted in admission order regardless of hits, Am by last access
+static bool testTwoQ() {
+    EvictionPolicy *policy = EvictionPolicy::newEvictionPolicy(TWOQ_EVICTION);
+    std::vector<EvictionEntry> states;
+    auto bin = makeBin(states, {50, 40, 15, 5}, EVICT_RECENT);
+    states[0].admitted = 10;
+    states[1].admitted = 20;
+    states[2].queue = EVICT_FREQUENT;
+    states[3].queue = EVICT_FREQUENT;
+    bool ok = check("2q", victimOrder(policy, bin), {0, 1, 3, 2});
+    delete policy;
+    return ok;
+}
+
+//A B1 ghost hit grows T1's target, a B2 ghost hit shrinks it, and either way the block enters T2
+static bool testARCAdapt() {
+    EvictionPolicy *policy = EvictionPolicy::newEvictionPolicy(ARC_EVICTION);
+    std::vector<EvictionEntry> states;
+    auto bin = makeBin(states, {10, 20, 30, 40}, EVICT_RECENT);
+    states[3].ghostFileIndex = 9;
+    states[3].ghostBlockIndex = 9;
+    states[3].ghostQueue = EVICT_RECENT;
+    policy->admit(bin, 0, 9, 9);
+    bool ok = states[0].binState == 1 && states[0].queue == EVICT_FREQUENT && states[3].ghostQueue == EVICT_NONE;
+    ok = ok && states[0].ghostQueue == EVICT_RECENT && bin[0].dirty; //slot 0's old block is now the B1 ghost
+    std::cout << "arc b1 hit: p=" << states[0].binState << (ok ? " ok" : " wrong") << std::endl;
+
+    states[1].ghostFileIndex = 8;
+    states[1].ghostBlockIndex = 8;
+    states[1].ghostQueue = EVICT_FREQUENT;
+    policy->admit(bin, 2, 8, 8);
+    bool ok2 = states[0].binState == 0 && states[2].queue == EVICT_FREQUENT && states[1].ghostQueue == EVICT_NONE;
+    std::cout << "arc b2 hit: p=" << states[0].binState << (ok2 ? " ok" : " wrong") << std::endl;
+    delete policy;
+    return ok && ok2;
+}
+
+int main(int argc, char **argv) {
+    bool ok = testLRU();
+    ok = testClock() && ok;
+    ok = testARC() && ok;
+    ok = testTwoQ() && ok;
+    ok = testARCAdapt() && ok;
+    std::cout << (ok ? "passed" : "failed") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "FrequencySketch.h"
+#include <iostream>
+
+static uint64_t key(uint32_t fileIndex, uint32_t blockIndex) {
+    return ((uint64_t)(fileIndex + 1) << 32) | (blockIndex + 1);
+}
+
+//Frequent blocks displace rare ones, never the other way around, and unseen blocks displace nothing
+static bool testAdmit(FrequencySketch &sketch) {
+    for (int i = 0; i < 12; i++) {
+        sketch.increment(key(0, 1));
+    }
+    for (int i = 0; i < 3; i++) {
+        sketch.increment(key(0, 2));
+    }
+    bool ok = sketch.frequency(key(0, 1)) == 12 && sketch.frequency(key(0, 2)) == 3;
+    ok = ok && sketch.admit(key(0, 1), key(0, 2)) && !sketch.admit(key(0, 2), key(0, 1));
+    ok = ok && !sketch.admit(key(0, 3), key(0, 2)) && !sketch.admit(key(0, 3), key(0, 3));
+    std::cout << "admit: " << sketch.frequency(key(0, 1)) << " vs " << sketch.frequency(key(0, 2)) << (ok ? " ok" : " wrong") << std::endl;
+    return ok;
+}
+
+//Counters saturate at 15 and are all halved once the sample period (10 increments per block) is reached
+static bool testHalving(FrequencySketch &sketch, uint32_t numBlocks, uint32_t samples) {
+    for (int i = 0; i < 20; i++) {
+        sketch.increment(key(0, 1));
+    }
+    samples += 20;
+    bool ok = sketch.frequency(key(0, 1)) == 15;
+    while (samples < 10 * numBlocks - 1) {
+        sketch.increment(key(1, 0));
+        samples++;
+    }
+    ok = ok && sketch.frequency(key(0, 1)) == 15 && sketch.frequency(key(0, 2)) == 3;
+    sketch.increment(key(1, 0));
+    uint32_t hot = sketch.frequency(key(0, 1));
+    uint32_t warm = sketch.frequency(key(0, 2));
+    ok = ok && hot == 7 && warm == 1 && sketch.frequency(key(1, 0)) == 7;
+    std::cout << "halving: " << hot << " " << warm << (ok ? " ok" : " wrong") << std::endl;
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    uint32_t numBlocks = 16;
+    FrequencySketch sketch(numBlocks);
+    bool ok = testAdmit(sketch);
+    ok = testHalving(sketch, numBlocks, 15) && ok;
+    std::cout << (ok ? "passed" : "failed") << std::endl;
+    return ok ? 0 : 1;
+}
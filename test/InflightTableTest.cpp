@@ -0,0 +1,131 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+
+#include "InflightTable.h"
+#include "Timer.h"
+#include <iostream>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//A child process claims a block, the parent must wait for it and then either see it released
+//or, when the child dies holding it, inherit the claim
+static bool waitOnChild(InflightTable &table, uint32_t blk, bool dies) {
+    int ready[2];
+    if (pipe(ready)) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        uint32_t slot;
+        char c = table.claim(1, blk, slot) == InflightTable::OWNER;
+        write(ready[1], &c, 1);
+        if (!dies) {
+            usleep(200000);
+            table.release(1, blk);
+        }
+        _exit(0);
+    }
+    char owned = 0;
+    read(ready[0], &owned, 1);
+    uint32_t slot;
+    bool ok = owned && table.claim(1, blk, slot) == InflightTable::WAIT;
+    uint64_t start = Timer::getCurrentTime();
+    ok = ok && table.wait(slot, 1, blk) != dies;
+    std::cout << (dies ? "dead owner" : "released") << " after " << (Timer::getCurrentTime() - start) / 1000000.0 << "ms" << std::endl;
+    if (dies) {
+        table.release(1, blk);
+    }
+    waitpid(pid, NULL, 0);
+    ok = ok && table.claim(1, blk, slot) == InflightTable::OWNER;
+    table.release(1, blk);
+    close(ready[0]);
+    close(ready[1]);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    signal(SIGCHLD, SIG_IGN); //reap the child as it exits, a zombie still looks alive
+    InflightTable *table = InflightTable::openInflightTable();
+    if (!table) {
+        std::cout << "in flight table disabled" << std::endl;
+        return 1;
+    }
+    bool ok = waitOnChild(*table, 1, false);
+    ok = waitOnChild(*table, 2, true) && ok;
+    std::cout << (ok ? "passed" : "failed") << std::endl;
+    delete table;
+    return ok ? 0 : 1;
+}
@@ -81,13 +81,13 @@ const std::string fileName(Config::InputsDir + "/warAndPeace.txt");
 
 //Wrapper function to read blocks and print them
 void readBlocks(Connection *connection, std::string name, unsigned int start, unsigned int end, std::stringstream &ss) {
-    if (sendRequestBlkMsg(connection, name, start, end)) {
+    if (sendRequestBlkMsg(connection, name, start, end, start)) {
         std::cout << "Requesting file block " << name << " " << start << " - " << end << std::endl;
         for (unsigned int i = start; i <= end; i++) {
             char *data = NULL;
-            unsigned int blk = 0, dataSize = 0;
-            std::string fileName = recSendBlkMsg(connection, &data, blk, dataSize);
-            std::cout << "Received " << fileName << " " << blk << " " << dataSize << std::endl;
+            unsigned int blk = 0, dataSize = 0, id = 0;
+            std::string fileName = recSendBlkMsg(connection, &data, blk, dataSize, id);
+            std::cout << "Received " << fileName << " " << blk << " " << dataSize << " id " << id << std::endl;
             std::string temp(data, dataSize);
             ss << temp;
         }
@@ -0,0 +1,132 @@
+// -*-Mode: C++;-*- // technically C99
+
+//*BeginLicense**************************************************************
+//
+//---------------------------------------------------------------------------
+// TAZeR (github.com/pnnl/tazer/)
+//---------------------------------------------------------------------------
+//
+// Copyright ((c)) 2019, Battelle Memorial Institute
+//
+// 1. Battelle Memorial Institute (hereinafter Battelle) hereby grants
+//    permission to any person or entity lawfully obtaining a copy of
+//    this software and associated documentation files (hereinafter "the
+//    Software") to redistribute and use the Software in source and
+//    binary forms, with or without modification.  Such person or entity
+//    may use, copy, modify, merge, publish, distribute, sublicense,
+//    and/or sell copies of the Software, and may permit others to do
+//    so, subject to the following conditions:
+//    
+//    * Redistributions of source code must retain the above copyright
+//      notice, this list of conditions and the following disclaimers.
+//
+//    * Redistributions in binary form must reproduce the above
+//      copyright notice, this list of conditions and the following
+//      disclaimer in the documentation and/or other materials provided
+//      with the distribution.
+//
+//    * Other than as used herein, neither the name Battelle Memorial
+//      Institute or Battelle may be used in any form whatsoever without
+//      the express written consent of Battelle.
+//
+// 2. THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+//    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+//    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//    DISCLAIMED. IN NO EVENT SHALL BATTELLE OR CONTRIBUTORS BE LIABLE
+//    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+//    OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+//    BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+//    LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+//    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+//    DAMAGE.
+//
+// ***
+//
+// This material was prepared as an account of work sponsored by an
+// agency of the United States Government.  Neither the United States
+// Government nor the United States Department of Energy, nor Battelle,
+// nor any of their employees, nor any jurisdiction or organization that
+// has cooperated in the development of these materials, makes any
+// warranty, express or implied, or assumes any legal liability or
+// responsibility for the accuracy, completeness, or usefulness or any
+// information, apparatus, product, software, or process disclosed, or
+// represents that its use would not infringe privately owned rights.
+//
+// Reference herein to any specific commercial product, process, or
+// service by trade name, trademark, manufacturer, or otherwise does not
+// necessarily constitute or imply its endorsement, recommendation, or
+// favoring by the United States Government or any agency thereof, or
+// Battelle Memorial Institute. The views and opinions of authors
+// expressed herein do not necessarily state or reflect those of the
+// United States Government or any agency thereof.
+//
+//                PACIFIC NORTHWEST NATIONAL LABORATORY
+//                             operated by
+//                               BATTELLE
+//                               for the
+//                  UNITED STATES DEPARTMENT OF ENERGY
+//                   under Contract DE-AC05-76RL01830
+// 
+//*EndLicense****************************************************************
+
+#include "PriorityThreadPool.h"
+#include "WorkStealingThreadPool.h"
+#include "Timer.h"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Usage: ThreadPoolBenchmark [threads] [producers] [tasksPerProducer] [workPerTask]
+//Producers mimic client threads handing out demand and prefetch tasks with mixed priorities
+
+std::atomic<uint64_t> done(0);
+
+static void work(uint64_t iters) {
+    volatile uint64_t x = 0;
+    for (uint64_t i = 0; i < iters; i++)
+        x += i;
+    done.fetch_add(1);
+}
+
+template <class Pool>
+double run(Pool &pool, uint32_t producers, uint64_t tasks, uint64_t iters) {
+    done.store(0);
+    pool.initiate();
+    uint64_t start = Timer::getCurrentTime();
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; p++) {
+        threads.push_back(std::thread([&pool, tasks, iters] {
+            for (uint64_t i = 0; i < tasks; i++)
+                pool.addTask((i % 8) ? 1 + i % 20 : 0, [iters] { work(iters); });
+        }));
+    }
+    for (auto &t : threads)
+        t.join();
+    while (done.load() < producers * tasks)
+        std::this_thread::yield();
+    double seconds = (Timer::getCurrentTime() - start) / 1000000000.0;
+    pool.terminate();
+    return seconds;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t numThreads = (argc > 1) ? std::stoul(argv[1]) : 32;
+    uint32_t producers = (argc > 2) ? std::stoul(argv[2]) : 8;
+    uint64_t tasks = (argc > 3) ? std::stoull(argv[3]) : 100000;
+    uint64_t iters = (argc > 4) ? std::stoull(argv[4]) : 100;
+    uint64_t total = producers * tasks;
+
+    PriorityThreadPool<std::function<void()>> priorityPool(numThreads, "priority pool");
+    double pSecs = run(priorityPool, producers, tasks, iters);
+    std::cout << "PriorityThreadPool:     " << total << " tasks " << pSecs << " s " << total / pSecs << " tasks/s" << std::endl;
+
+    WorkStealingThreadPool<std::function<void()>> stealingPool(numThreads, "work stealing pool");
+    double wSecs = run(stealingPool, producers, tasks, iters);
+    std::cout << "WorkStealingThreadPool: " << total << " tasks " << wSecs << " s " << total / wSecs << " tasks/s" << std::endl;
+    return 0;
+}